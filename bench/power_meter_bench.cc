@@ -0,0 +1,400 @@
+/*
+Benchmarks for the sampling hot path
+
+Micro-benchmarks measure the cost per call of the functions a sample goes through, against a
+file-backed fake MSR device. Macro-benchmarks run the monitoring loop at several sampling
+intervals, reading RAPL from fake MSR devices and the GPUs from the stub NVML library, and
+measure the achieved sampling rate and the jitter of the sampling period. Results are written
+as JSON
+
+Usage: power_meter_bench [--iterations N] [--duration-ms N] [--output file.json, defaults to power_meter_bench.json]
+*/
+
+#include "power_meter.hh"
+#include "rapl_utils.hh"
+#include "msr_reader.hh"
+#include "topology.hh"
+#include "rapl_source.hh"
+#include "nvml_source.hh"
+#include "synthetic_source.hh"
+#include "output_sink.hh"
+#include "trace_format.hh"
+#include "sample_ring.hh"
+#include "live_stats.hh"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+// Keeps the compiler from optimizing away the value of x
+template <typename T>
+static inline void do_not_optimize(T const &x)
+{
+    asm volatile("" : : "r,m"(x) : "memory");
+}
+
+struct MicroResult
+{
+    std::string name;
+    unsigned long long iterations;
+    double ns_per_op;
+};
+
+struct LoopResult
+{
+    unsigned int interval_us;
+    size_t samples;
+    double achieved_rate_hz;
+    double period_mean_us;
+    double period_stddev_us;
+    double period_min_us;
+    double period_max_us;
+    double period_p99_us;
+    unsigned long long overruns;
+};
+
+static MicroResult run_micro(const std::string &name, unsigned long long iterations, const std::function<void()> &op)
+{
+    // Warm up caches and the page cache of the fake device
+    for (unsigned long long i = 0; i < std::min(iterations, 1000ULL); ++i)
+    {
+        op();
+    }
+    auto start = bench_clock::now();
+    for (unsigned long long i = 0; i < iterations; ++i)
+    {
+        op();
+    }
+    auto end = bench_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    return {name, iterations, ns / (double)iterations};
+}
+
+static void write_msr(const std::filesystem::path &file, unsigned int address, unsigned long long value)
+{
+    std::fstream msr(file, std::ios::in | std::ios::out | std::ios::binary);
+    msr.seekp(address);
+    msr.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+/*
+Creates a fake MSR device in dir holding the registers read on Intel and AMD machines
+*/
+static void create_fake_msr(const std::filesystem::path &dir)
+{
+    std::filesystem::create_directories(dir);
+    std::ofstream(dir / "msr", std::ios::binary).close();
+    // Energy units of 2^-14 J, power units of 2^-3 W, time units of 2^-10 s
+    write_msr(dir / "msr", INTEL_MSR_RAPL_POWER_UNIT, 0xA0E03);
+    write_msr(dir / "msr", INTEL_MSR_PKG_ENERGY_STATUS, 123456789);
+    write_msr(dir / "msr", INTEL_MSR_PP0_ENERGY_STATUS, 23456789);
+    write_msr(dir / "msr", AMD_MSR_RAPL_POWER_UNIT, 0xA0E03);
+    write_msr(dir / "msr", AMD_MSR_PKG_ENERGY_STATUS, 123456789);
+}
+
+/*
+Creates a fake MSR device per node under root, laid out like /dev/cpu, and sets up the
+RAPL state as rapl_utils::init() would on an Intel machine with that many nodes
+*/
+static void setup_fake_rapl(const std::filesystem::path &root, int nodes)
+{
+    rapl_utils::set_msr_device_root(root.string());
+    rapl_utils::vendor_id = rapl_utils::VENDOR_ID::INTEL;
+    rapl_utils::numa_nodes = nodes;
+    rapl_utils::num_packages = nodes;
+    rapl_utils::first_package_core = std::make_unique<int[]>(nodes);
+    for (int i = 0; i < nodes; ++i)
+    {
+        rapl_utils::first_package_core[i] = i;
+        create_fake_msr(root / std::to_string(i));
+        rapl_utils::open_msr_fd(i);
+    }
+    rapl_utils::energy_increment = 1.0f / (1 << 14);
+    rapl_utils::power_increment = 1.0f / (1 << 3);
+    rapl_utils::time_increment = 1.0f / (1 << 10);
+    rapl_utils::energy_counter_max = ((long)1U << 32) * rapl_utils::energy_increment;
+}
+
+/*
+Creates a fake MSR device under root for every CPU of this machine, so rapl_utils::init() and
+RaplSource run on them as they would on the real devices
+*/
+static void setup_fake_msr_devices(const std::filesystem::path &root)
+{
+    for (const auto &cpu : topology::get_topology().cpus)
+    {
+        create_fake_msr(root / std::to_string(cpu.id));
+    }
+    rapl_utils::set_msr_device_root(root.string());
+}
+
+static std::vector<MicroResult> run_micro_benchmarks(const std::filesystem::path &work_dir, unsigned long long iterations)
+{
+    std::vector<MicroResult> results;
+    const int nodes = 2;
+    setup_fake_rapl(work_dir / "msr", nodes);
+
+    unsigned long long values[INTEL_MSR_PKG_ENERGY_STATUS_NUMFIELDS];
+    results.push_back(run_micro("read_msr_fields", iterations, [&]
+                                {
+        rapl_utils::read_msr_fields(0, INTEL_MSR_PKG_ENERGY_STATUS, INTEL_MSR_PKG_ENERGY_STATUS_NUMFIELDS,
+                                    rapl_utils::INTEL_MSR_PKG_ENERGY_STATUS_OFFSETS,
+                                    rapl_utils::INTEL_MSR_PKG_ENERGY_STATUS_SIZES, values);
+        do_not_optimize(values[0]); }));
+
+    results.push_back(run_micro("get_node_energy", iterations, [&]
+                                { do_not_optimize(rapl_utils::get_node_energy(0, 0)); }));
+
+    rapl_utils::EnergyAux previous, current;
+    rapl_utils::update_package_energy(previous);
+    results.push_back(run_micro("update_aux_data", iterations, [&]
+                                {
+        rapl_utils::update_aux_data(current, 0);
+        do_not_optimize(current); }));
+
+    // One node advancing and one wrapping around
+    current.counter[0] = previous.counter[0] + 24576;
+    current.counter[1] = previous.counter[1] - 24576;
+    current.time.tv_nsec = previous.time.tv_nsec + 1000000;
+    current.time.tv_sec = previous.time.tv_sec;
+    results.push_back(run_micro("get_energy_diff", iterations, [&]
+                                { do_not_optimize(rapl_utils::get_energy_diff(current, previous)); }));
+
+    rapl_utils::EnergyData data;
+    results.push_back(run_micro("update_energy_data", iterations, [&]
+                                {
+        rapl_utils::update_energy_data(data, previous, current);
+        do_not_optimize(data); }));
+
+    // Same row formatting as the writer thread, which flushes once per batch
+    std::ofstream csv(work_dir / "format.csv");
+    power_meter::CsvSink csv_sink({&csv});
+    std::vector<power_meter::SourceInfo> csv_sources{{"cpu", "RAPL", {{"node0", "Package", 1.0 / (1 << 14), 1ULL << 32}}}};
+    power_meter::SourceReading reading;
+    reading.counters = std::make_unique<uint64_t[]>(1);
+    csv_sink.begin(csv_sources);
+    results.push_back(run_micro("csv_format_sample", iterations, [&]
+                                {
+        reading.time.tv_nsec = (reading.time.tv_nsec + 1000000) % 1000000000;
+        reading.counters[0] += 100;
+        csv_sink.write_sample(&reading); }));
+    csv_sink.end();
+
+    // Compressed trace output of the same samples, blocks written to the file as they fill up
+    power_meter::TraceWriter compressed_writer;
+    power_meter::TraceInfo trace_info;
+    trace_info.sources = csv_sources;
+    compressed_writer.open(work_dir / "compressed.pmz", trace_info, true);
+    results.push_back(run_micro("compressed_trace_sample", iterations, [&]
+                                {
+        reading.time.tv_nsec = (reading.time.tv_nsec + 1000000) % 1000000000;
+        reading.counters[0] += 100;
+        compressed_writer.write_sample(&reading); }));
+    compressed_writer.close();
+
+    // Hand-off of a sample from the monitoring loop to the writer thread
+    power_meter::SampleRing ring(4096, 2 + nodes + 4);
+    results.push_back(run_micro("sample_ring_push_pop", iterations, [&]
+                                {
+        uint64_t *record = ring.claim();
+        record[0] = 1;
+        ring.publish();
+        do_not_optimize(ring.peek(0)[0]);
+        ring.release(ring.available()); }));
+
+    // Live statistics the writer thread updates with every record, over the default windows
+    power_meter::SyntheticSource live_source({power_meter::PowerProfile{}}, 1.0 / (1 << 14), 32, 1000000);
+    live_source.init();
+    power_meter::LiveStats live_stats;
+    live_stats.begin({&live_source}, {std::chrono::seconds(1), std::chrono::seconds(10)});
+    uint64_t live_record[2]{};
+    long long live_time = 0;
+    results.push_back(run_micro("live_stats_update", iterations, [&]
+                                {
+        struct timespec time;
+        live_source.read_counters(time, live_record + 1);
+        live_time += 1000000;
+        live_record[0] = (uint64_t)live_time;
+        live_stats.update(live_record, live_time); }));
+
+    // No loop is running, the benchmark drains the marker queue itself
+    results.push_back(run_micro("mark", iterations, []
+                                {
+        power_meter::mark("bench");
+        power_meter::marker_queue.pop(); }));
+
+    rapl_utils::close_msr_fds();
+    return results;
+}
+
+/*
+Wraps a source and records the time of every reading taken by the monitoring loop
+*/
+class TimedSource : public power_meter::EnergySource
+{
+public:
+    TimedSource(std::unique_ptr<EnergySource> source, std::vector<bench_clock::time_point> &times)
+        : source(std::move(source)), times(times) {}
+
+    const char *name() const override { return source->name(); }
+    int init() override
+    {
+        int error = source->init();
+        device_info = source->devices();
+        return error;
+    }
+    void shutdown() override { source->shutdown(); }
+    void read_counters(struct timespec &time, uint64_t *counters) override
+    {
+        times.push_back(bench_clock::now());
+        source->read_counters(time, counters);
+    }
+
+private:
+    std::unique_ptr<EnergySource> source;
+    std::vector<bench_clock::time_point> &times;
+};
+
+static LoopResult run_loop_benchmark(const std::filesystem::path &work_dir, unsigned int interval_us, unsigned int duration_ms)
+{
+    std::vector<bench_clock::time_point> times;
+    times.reserve((size_t)duration_ms * 1000 / interval_us + 1024);
+
+    setup_fake_msr_devices(work_dir / "loop_msr");
+    power_meter::set_cpu_source(std::make_unique<TimedSource>(std::make_unique<power_meter::RaplSource>(), times));
+#ifdef POWER_METER_BENCH_NVML_STUB
+    // Simulated GPUs, polled like the driver's. A library set in the environment is used instead
+    setenv("POWER_METER_NVML_LIBRARY", POWER_METER_BENCH_NVML_STUB, 0);
+    setenv("POWER_METER_NVML_STUB_GPUS", "4", 0);
+    power_meter::set_gpu_source(std::make_unique<power_meter::NvmlSource>());
+#else
+    power_meter::set_gpu_source(nullptr);
+    power_meter::set_gpu_energy(false);
+#endif
+    power_meter::set_output_dir((work_dir / ("loop_" + std::to_string(interval_us))).string());
+
+    if (!power_meter::launch_monitoring_loop(std::chrono::microseconds(interval_us)))
+    {
+        fprintf(stderr, "Could not launch the monitoring loop at %u us\n", interval_us);
+        return {interval_us, 0, 0, 0, 0, 0, 0, 0, 0};
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+    power_meter::stop_monitoring_loop();
+
+    LoopResult result{interval_us, 0, 0, 0, 0, 0, 0, 0, power_meter::get_jitter_stats().overruns};
+    if (times.size() < 3)
+    {
+        return result;
+    }
+    // The first reading is the initial one taken before entering the loop
+    std::vector<double> periods;
+    for (size_t i = 2; i < times.size(); ++i)
+    {
+        periods.push_back(std::chrono::duration<double, std::micro>(times[i] - times[i - 1]).count());
+    }
+    double total_us = std::chrono::duration<double, std::micro>(times.back() - times[1]).count();
+    double mean = total_us / (double)periods.size();
+    double variance = 0;
+    for (double period : periods)
+    {
+        variance += (period - mean) * (period - mean);
+    }
+    std::sort(periods.begin(), periods.end());
+
+    result.samples = periods.size();
+    result.achieved_rate_hz = 1E6 / mean;
+    result.period_mean_us = mean;
+    result.period_stddev_us = std::sqrt(variance / (double)periods.size());
+    result.period_min_us = periods.front();
+    result.period_max_us = periods.back();
+    result.period_p99_us = periods[std::min(periods.size() - 1, (size_t)((double)periods.size() * 0.99))];
+    return result;
+}
+
+static void write_json(std::ostream &out, const std::vector<MicroResult> &micro, const std::vector<LoopResult> &loops)
+{
+    out << "{\n  \"benchmark\": \"power_meter_bench\",\n  \"micro\": [\n";
+    for (size_t i = 0; i < micro.size(); ++i)
+    {
+        out << "    {\"name\": \"" << micro[i].name << "\", \"iterations\": " << micro[i].iterations
+            << ", \"ns_per_op\": " << micro[i].ns_per_op << "}" << (i + 1 < micro.size() ? "," : "") << "\n";
+    }
+    out << "  ],\n  \"loop\": [\n";
+    for (size_t i = 0; i < loops.size(); ++i)
+    {
+        const auto &loop = loops[i];
+        out << "    {\"interval_us\": " << loop.interval_us << ", \"samples\": " << loop.samples
+            << ", \"achieved_rate_hz\": " << loop.achieved_rate_hz
+            << ", \"period_mean_us\": " << loop.period_mean_us
+            << ", \"period_stddev_us\": " << loop.period_stddev_us
+            << ", \"period_min_us\": " << loop.period_min_us
+            << ", \"period_max_us\": " << loop.period_max_us
+            << ", \"period_p99_us\": " << loop.period_p99_us
+            << ", \"overruns\": " << loop.overruns << "}"
+            << (i + 1 < loops.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long iterations = 100000;
+    unsigned int duration_ms = 2000;
+    std::string output{"power_meter_bench.json"};
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--iterations") && i + 1 < argc)
+        {
+            iterations = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--duration-ms") && i + 1 < argc)
+        {
+            duration_ms = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--iterations N] [--duration-ms N] [--output file.json]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    char work_dir_template[] = "/tmp/power_meter_bench.XXXXXX";
+    if (!mkdtemp(work_dir_template))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::filesystem::path work_dir{work_dir_template};
+
+    auto micro = run_micro_benchmarks(work_dir, iterations);
+    std::vector<LoopResult> loops;
+    for (unsigned int interval_us : {10000u, 1000u, 100u})
+    {
+        loops.push_back(run_loop_benchmark(work_dir, interval_us, duration_ms));
+    }
+
+    std::filesystem::remove_all(work_dir);
+
+    std::ofstream out(output);
+    write_json(out, micro, loops);
+    if (!out)
+    {
+        fprintf(stderr, "Could not write %s\n", output.c_str());
+        return 1;
+    }
+    printf("Results written to %s\n", output.c_str());
+    return 0;
+}
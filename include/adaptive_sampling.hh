@@ -0,0 +1,108 @@
+#ifndef ADAPTIVE_SAMPLING_HH
+#define ADAPTIVE_SAMPLING_HH
+
+#include "energy_source.hh"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// Peak power assumed for a device whose source gives no estimate, in Watts
+#define ASSUMED_PEAK_POWER_W 500
+// The safe interval is this fraction of the time a counter takes to wrap at peak power
+#define WRAP_SAFETY_FACTOR 2
+
+namespace power_meter
+{
+    /*
+    Configuration of the adaptive sampling mode. The monitoring loop samples at the interval
+    passed to launch_monitoring_loop while power is steady, and at burst_interval for
+    burst_duration after the total power changes sharply or the application requests a burst.
+    Neither interval ever exceeds the maximum safe interval (see get_max_safe_interval_ns)
+    */
+    struct AdaptiveSampling
+    {
+        bool enabled{false};
+        std::chrono::microseconds burst_interval{1000};
+        std::chrono::milliseconds burst_duration{1000};
+        // Relative change of the total power between two consecutive windows that starts a burst
+        double change_threshold{0.25};
+        // Shortest window power changes are evaluated over, shorter intervals are aggregated.
+        // RAPL updates its counters about once per millisecond, shorter windows mostly see noise
+        std::chrono::milliseconds change_window{10};
+    };
+
+    /*
+    Returns the longest interval in ns between two readings of the sources that guarantees no
+    counter wraps around more than once: 1 / WRAP_SAFETY_FACTOR of the time the fastest wrapping
+    counter takes to wrap at its device's peak power. The peak power of a device is the highest of
+    its source's estimate (ASSUMED_PEAK_POWER_W if unknown) and the power observed so far, given
+    per device of each source in observed_peak (which may be empty). Returns LLONG_MAX if no
+    counter wraps
+    */
+    long long get_max_safe_interval_ns(const std::vector<EnergySource *> &sources,
+                                       const std::vector<std::vector<double>> &observed_peak = {});
+
+    /*
+    Chooses the interval to the next sample of the monitoring loop in adaptive mode from the
+    records the loop takes (a timestamp and the counters of each source, see SampleRing)
+    */
+    class AdaptiveController
+    {
+    public:
+        void begin(const AdaptiveSampling &config, long long background_interval_ns,
+                   const std::vector<EnergySource *> &sources);
+
+        /*
+        Called by the monitoring loop with every record, taken at now_ns on CLOCK_MONOTONIC.
+        Returns the interval to the next sample in ns
+        */
+        long long next_interval(const uint64_t *record, long long now_ns);
+
+        /*
+        Sleeps until deadline_ns on CLOCK_MONOTONIC. Returns true if woken up early by
+        request_burst or wake
+        */
+        bool sleep_until(long long deadline_ns);
+
+        /*
+        Starts a burst lasting until until_ns, or extends the current one. Thread safe
+        */
+        void request_burst(long long until_ns);
+
+        /*
+        Wakes up the loop if it's sleeping, e.g. to stop it. Thread safe
+        */
+        void wake();
+
+        long long max_safe_interval() const { return safe_interval_ns.load(std::memory_order_relaxed); }
+
+    private:
+        AdaptiveSampling config;
+        long long background_interval_ns{0};
+        std::vector<EnergySource *> sources;
+
+        // Previous record and the time it was taken
+        std::vector<uint64_t> previous;
+        long long previous_ns{0};
+        bool has_previous{false};
+        // Highest power observed for each device of each source
+        std::vector<std::vector<double>> observed_peak;
+        std::atomic<long long> safe_interval_ns{0};
+
+        // Energy and time accumulated in the current change window, and the power of the last one
+        double window_energy{0};
+        long long window_ns{0};
+        double window_power{-1};
+
+        long long burst_until_ns{0};
+        std::atomic<long long> requested_until_ns{0};
+
+        std::mutex wake_lock;
+        std::condition_variable wake_cv;
+        bool wake_requested{false};
+    };
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef CORE_ENERGY_SOURCE_HH
+#define CORE_ENERGY_SOURCE_HH
+
+#include "energy_source.hh"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace power_meter
+{
+    /*
+    Energy source reading AMD's per-core energy counter (AMD_MSR_CORE_ENERGY_STATUS) on every
+    online core. Exposes one device per physical core in the "Core" domain, named after the
+    first logical CPU of the core ("core<cpu>"), SMT siblings share the counter and are read once
+
+    Reading an MSR of another CPU goes through an IPI, so reading every core from one thread
+    grows linearly with the core count. The cores are split into contiguous slices, the calling
+    thread reads the first one and a small pool of helper threads, each pinned to a CPU of its
+    slice, read the others in parallel
+    */
+    class CoreEnergySource : public EnergySource
+    {
+    public:
+        /*
+        helper_threads is the number of helper threads besides the calling thread, 0 picks one
+        per CORES_PER_HELPER cores, up to MAX_CORE_HELPERS
+        */
+        explicit CoreEnergySource(unsigned int helper_threads = 0) : requested_helpers(helper_threads) {}
+        ~CoreEnergySource() override
+        {
+            stop_helpers();
+            close_fds();
+        }
+
+        const char *name() const override { return "RAPL cores"; }
+        int init() override;
+        void shutdown() override;
+        void read_counters(struct timespec &time, uint64_t *counters) override;
+
+        static constexpr unsigned int CORES_PER_HELPER = 32;
+        static constexpr unsigned int MAX_CORE_HELPERS = 8;
+
+    private:
+        // Reads the counters of devices [begin, end), a device that can't be read keeps its last value
+        void read_slice(size_t begin, size_t end, uint64_t *counters);
+        void helper_loop(unsigned int slice);
+        void stop_helpers();
+        void close_fds();
+
+        unsigned int requested_helpers;
+        // Logical CPU and MSR descriptor of each device, the descriptors are opened and closed by
+        // this source alone
+        std::vector<int> cpus;
+        std::vector<int> fds;
+        // Last value read from each device, every slice only touches its own
+        std::vector<uint64_t> values;
+        // Device range of each slice, slice 0 is read by the calling thread
+        std::vector<std::pair<size_t, size_t>> slices;
+        std::vector<std::thread> helpers;
+
+        // Hand-off between read_counters and the helpers: every reading bumps generation,
+        // each helper reads its slice into target and decrements pending
+        std::mutex lock;
+        std::condition_variable start_cv;
+        std::condition_variable done_cv;
+        unsigned long long generation{0};
+        unsigned int pending{0};
+        uint64_t *target{nullptr};
+        bool stopping{false};
+    };
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef ENERGY_SOURCE_HH
+#define ENERGY_SOURCE_HH
+
+#include <time.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace power_meter
+{
+    // Static description of one of the energy counters exposed by a source
+    struct DeviceInfo
+    {
+        std::string name;
+        // What the counter measures, e.g. "Package" or "DRAM". Devices of a source sharing a domain
+        // are added up in the outputs
+        std::string domain;
+        // Energy in Joules represented by one tick of the counter
+        double energy_unit{1};
+        // Value at which the counter wraps back to 0, 0 if it never wraps
+        uint64_t counter_max{0};
+    };
+
+    // Raw counter readings of every device of a source along with the time they were taken
+    struct SourceReading
+    {
+        struct timespec time{};
+        std::unique_ptr<uint64_t[]> counters;
+        // Time each device was read at in ns on CLOCK_MONOTONIC, only set for sources with
+        // per-device timestamps (see EnergySource::device_times)
+        std::unique_ptr<uint64_t[]> device_times;
+    };
+
+    // Stores the average power consumption and energy consumption during the last
+    // measurement interval, and total energy consumption. Sum of all devices of a source
+    struct EnergyData
+    {
+        double power{0};
+        double energy{0};
+        double total_energy{0};
+    };
+
+    /*
+    Interface for the backends the monitoring loop takes its measurements from. A source
+    exposes a fixed set of monotonically increasing (modulo wraparound) energy counters
+    */
+    class EnergySource
+    {
+    public:
+        virtual ~EnergySource() = default;
+
+        /*
+        Short name of the source, used in messages
+        */
+        virtual const char *name() const = 0;
+
+        /*
+        Discovers the devices of this source and prepares it for reading. Returns 0 on success
+        */
+        virtual int init() = 0;
+
+        /*
+        Releases the resources acquired in init()
+        */
+        virtual void shutdown() {}
+
+        /*
+        Reads the raw counter of every device into counters, which must hold num_devices()
+        values, and stores the time of the reading
+        */
+        virtual void read_counters(struct timespec &time, uint64_t *counters) = 0;
+
+        /*
+        Returns an estimate of the highest power in Watts the device can draw, used to bound the
+        sampling interval so that its counter can't wrap around twice between two readings.
+        0 if unknown
+        */
+        virtual double max_power(unsigned int /*device*/) const { return 0; }
+
+        /*
+        For sources whose devices are read at different times, returns the time in ns on
+        CLOCK_MONOTONIC each device was read at by the last read_counters call. nullptr if every
+        device is read at the time returned by read_counters. Whether it is nullptr is fixed by init()
+        */
+        virtual const uint64_t *device_times() const { return nullptr; }
+
+        const std::vector<DeviceInfo> &devices() const { return device_info; }
+
+        unsigned int num_devices() const { return (unsigned int)device_info.size(); }
+
+        /*
+        Number of 64 bit words taken by a reading of this source in a sample record: its timestamp,
+        the counters, and the time of every device for sources with per-device timestamps
+        */
+        unsigned int record_words() const { return 1 + num_devices() * (device_times() ? 2 : 1); }
+
+        /*
+        Allocates the counters (and device times) of reading for this source and fills it with a new reading
+        */
+        void read(SourceReading &reading);
+
+    protected:
+        std::vector<DeviceInfo> device_info;
+    };
+
+    /*
+    Returns the number of ticks a device's counter advanced between two readings.
+    A single counter wraparound between both readings is detected and corrected
+    */
+    inline uint64_t get_device_tick_diff(const DeviceInfo &device, uint64_t previous_counter, uint64_t current_counter)
+    {
+        // If the counter has wrapped around, add the value it had before wrapping
+        if (current_counter < previous_counter && device.counter_max != 0)
+        {
+            return device.counter_max - previous_counter + current_counter;
+        }
+        return current_counter - previous_counter;
+    }
+
+    /*
+    Returns the energy in Joules consumed by a device between two readings of its counter.
+    A single counter wraparound between both readings is detected and corrected
+    */
+    inline double get_device_energy_diff(const DeviceInfo &device, uint64_t previous_counter, uint64_t current_counter)
+    {
+        return (double)get_device_tick_diff(device, previous_counter, current_counter) * device.energy_unit;
+    }
+
+    /*
+    Per-device state of the counters of a source, one contiguous array per field sized once for
+    the source's devices. update() extends the wrapping counters into monotonic 64 bit tick totals
+    and computes the energy and power of every device in branchless passes the compiler can
+    vectorize. Totals are kept exactly in ticks and only converted to Joules when requested
+    */
+    class DeviceCounters
+    {
+    public:
+        void init(const std::vector<DeviceInfo> &devices);
+
+        /*
+        Updates the devices with a new reading of their counters, taken time_diff seconds after the
+        previous one. The first update only records the counters
+        */
+        void update(const uint64_t *counters, double time_diff);
+        // Same, for devices read at different times, time_diff holds the interval of each device.
+        // Devices that weren't read again (an interval of 0) keep their last power
+        void update(const uint64_t *counters, const double *time_diff);
+        // Same, with the time in ns of each device's reading, the intervals are taken from the
+        // device times of the previous update
+        void update(const uint64_t *counters, const uint64_t *device_times);
+
+        size_t size() const { return last_counter.size(); }
+        // Energy in Joules and average power in Watts of each device during the last interval
+        const double *energy() const { return device_energy.data(); }
+        const double *power() const { return device_power.data(); }
+        // Energy in Joules consumed by a device since the first update
+        double total_energy(size_t device) const { return (double)total_ticks[device] * energy_unit[device]; }
+
+    private:
+        // Accumulates the ticks of a new reading, returns false on the first one
+        bool update_ticks(const uint64_t *counters);
+
+        std::vector<uint64_t> counter_max;
+        std::vector<double> energy_unit;
+        std::vector<uint64_t> last_counter;
+        std::vector<uint64_t> interval_ticks;
+        std::vector<uint64_t> total_ticks;
+        std::vector<double> device_energy;
+        std::vector<double> device_power;
+        std::vector<uint64_t> last_device_time;
+        std::vector<double> device_interval;
+        bool started{false};
+    };
+
+    /*
+    Returns the energy in Joules consumed by the devices of source between two readings.
+    A single counter wraparound between both readings is detected and corrected
+    */
+    double get_energy_diff(const EnergySource &source, const uint64_t *previous_counters,
+                           const uint64_t *current_counters);
+    double get_energy_diff(const std::vector<DeviceInfo> &devices, const uint64_t *previous_counters,
+                           const uint64_t *current_counters);
+
+    /*
+    Uses two readings of source to update the provided EnergyData struct. Sets the computed power
+    usage and energy consumption, and updates the total energy consumption measured in this EnergyData struct
+    */
+    void update_energy_data(EnergyData &output_data, const EnergySource &source,
+                            const SourceReading &previous_data, const SourceReading &current_data);
+    void update_energy_data(EnergyData &output_data, const std::vector<DeviceInfo> &devices,
+                            const SourceReading &previous_data, const SourceReading &current_data);
+
+    /*
+    Copies the time, counters and device times of a reading of a source with num_devices devices
+    */
+    void copy_reading(SourceReading &destination, const SourceReading &source, unsigned int num_devices);
+
+    /*
+    Returns the time in seconds elapsed between two timestamps
+    */
+    double get_time_diff(const struct timespec &previous, const struct timespec &current);
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef HISTOGRAM_HH
+#define HISTOGRAM_HH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+
+namespace power_meter
+{
+    /*
+    Fixed-size histogram of 64 bit values with logarithmic buckets. Each power of 2 is split into
+    2^SUB_BITS linear sub-buckets, so percentiles are approximated within ~3% of the exact value
+    using constant memory and O(1) updates
+    */
+    class LogHistogram
+    {
+    public:
+        static constexpr unsigned int SUB_BITS = 5;
+        static constexpr size_t SUB_BUCKETS = (size_t)1 << SUB_BITS;
+        static constexpr size_t NUM_BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+        void add(uint64_t value)
+        {
+            ++buckets[bucket(value)];
+            ++total;
+        }
+
+        /*
+        Removes a value previously added
+        */
+        void remove(uint64_t value)
+        {
+            --buckets[bucket(value)];
+            --total;
+        }
+
+        void clear()
+        {
+            buckets.fill(0);
+            total = 0;
+        }
+
+        uint64_t count() const { return total; }
+
+        /*
+        Returns an approximation of the value below which the given fraction (0-1) of the values fall
+        */
+        uint64_t percentile(double fraction) const
+        {
+            if (total == 0)
+            {
+                return 0;
+            }
+            uint64_t rank = (uint64_t)(fraction * (double)(total - 1)) + 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < NUM_BUCKETS; ++i)
+            {
+                seen += buckets[i];
+                if (seen >= rank)
+                {
+                    return bucket_middle(i);
+                }
+            }
+            return bucket_middle(NUM_BUCKETS - 1);
+        }
+
+    private:
+        static size_t bucket(uint64_t value)
+        {
+            if (value < SUB_BUCKETS)
+            {
+                return (size_t)value;
+            }
+            unsigned int shift = 63 - (unsigned int)__builtin_clzll(value) - SUB_BITS;
+            return (shift + 1) * SUB_BUCKETS + (size_t)((value >> shift) - SUB_BUCKETS);
+        }
+
+        static uint64_t bucket_middle(size_t index)
+        {
+            if (index < SUB_BUCKETS)
+            {
+                return index;
+            }
+            unsigned int shift = (unsigned int)(index / SUB_BUCKETS) - 1;
+            uint64_t lower = (uint64_t)(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+            return lower + (((uint64_t)1 << shift) >> 1);
+        }
+
+        std::array<uint64_t, NUM_BUCKETS> buckets{};
+        uint64_t total{0};
+    };
+}
+
+#endif
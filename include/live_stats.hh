@@ -0,0 +1,121 @@
+#ifndef LIVE_STATS_HH
+#define LIVE_STATS_HH
+
+#include "energy_source.hh"
+#include "histogram.hh"
+#include "seqlock.hh"
+
+#include <chrono>
+#include <deque>
+
+// Sources and rolling windows a live snapshot can hold
+#define MAX_LIVE_SOURCES 4
+#define MAX_LIVE_WINDOWS 4
+// The percentiles of the rolling windows are refreshed at most this often
+#define LIVE_PERCENTILE_PERIOD_MS 10
+
+namespace power_meter
+{
+    // Power statistics of a source over a rolling window, powers in Watts and energy in Joules
+    struct LiveWindow
+    {
+        // Configured length of the window and time actually covered by its samples, in seconds
+        double length{0};
+        double covered{0};
+        unsigned long long samples{0};
+        double mean_power{0};
+        double min_power{0};
+        double max_power{0};
+        // Approximated within ~3%, and refreshed every LIVE_PERCENTILE_PERIOD_MS
+        double p95_power{0};
+        double p99_power{0};
+        double energy{0};
+    };
+
+    // Latest measurements of a source, all devices added up
+    struct LiveSnapshot
+    {
+        // Samples taken since the loop was launched
+        unsigned long long samples{0};
+        // Time of the latest reading in ns on CLOCK_MONOTONIC
+        long long time_ns{0};
+        // Power and energy of the latest interval, and total energy since the loop was launched
+        EnergyData latest;
+        unsigned int num_windows{0};
+        LiveWindow windows[MAX_LIVE_WINDOWS];
+    };
+
+    /*
+    Keeps the latest measurements and rolling-window statistics of the sources of the monitoring
+    loop, updated by the writer thread with every record (a timestamp and the counters of each
+    source, see SampleRing), off the sampler. Every window is updated in amortized O(1): running sums for the energy and
+    mean, monotonic queues for the min and max, and a log histogram for the percentiles
+
+    Readers get a consistent copy from a seqlock per source, they never take a lock nor delay
+    the writer. The storage is fixed, snapshots can be read at any time from any thread
+    */
+    class LiveStats
+    {
+    public:
+        /*
+        Writer: starts over for the given sources and windows (up to MAX_LIVE_SOURCES and
+        MAX_LIVE_WINDOWS, the rest are ignored). Windows that aren't longer than 0 are ignored too
+        */
+        void begin(const std::vector<EnergySource *> &sources, const std::vector<std::chrono::milliseconds> &windows);
+
+        /*
+        Writer: adds a record taken at now_ns on CLOCK_MONOTONIC and publishes new snapshots
+        */
+        void update(const uint64_t *record, long long now_ns);
+
+        /*
+        Any thread: copies the latest snapshot of a source. Returns false if it has none yet
+        */
+        bool snapshot(unsigned int source, LiveSnapshot &snapshot) const;
+
+    private:
+        struct Entry
+        {
+            long long time_ns;
+            long long interval_ns;
+            double energy;
+            double power;
+        };
+
+        // Writer-side state of a rolling window
+        struct Window
+        {
+            long long length_ns{0};
+            std::deque<Entry> entries;
+            double energy{0};
+            long long covered_ns{0};
+            // Candidates for the min and max, increasing and decreasing power
+            std::deque<Entry> min_queue;
+            std::deque<Entry> max_queue;
+            // Power in mW of the entries
+            LogHistogram histogram;
+            double p95_power{0};
+            double p99_power{0};
+
+            void add(const Entry &entry);
+            void expire(long long now_ns);
+        };
+
+        struct Source
+        {
+            EnergySource *source;
+            unsigned int record_words;
+            DeviceCounters counters;
+            long long previous_ns{0};
+            bool started{false};
+            LiveSnapshot current;
+            std::vector<Window> windows;
+        };
+
+        std::vector<Source> sources;
+        long long percentiles_ns{0};
+        Seqlock<LiveSnapshot> published[MAX_LIVE_SOURCES];
+    };
+}
+
+#endif
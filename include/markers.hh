@@ -0,0 +1,109 @@
+#ifndef MARKERS_HH
+#define MARKERS_HH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+
+// Longest marker name kept, including the terminating null character
+#define MARKER_NAME_SIZE 32
+// Markers waiting for the writer thread, more are dropped
+#define MARKER_QUEUE_CAPACITY 4096
+
+namespace power_meter
+{
+    enum MARKER_TYPE : uint32_t
+    {
+        MARKER_POINT = 1,
+        MARKER_PHASE_BEGIN = 2,
+        MARKER_PHASE_END = 3,
+        // Entry and exit of an energy region, see set_region_markers
+        MARKER_REGION_BEGIN = 4,
+        MARKER_REGION_END = 5
+    };
+
+    // An event of the application, interleaved with the samples in the outputs
+    struct Marker
+    {
+        // Time in ns on CLOCK_MONOTONIC, the clock of the samples
+        uint64_t time_ns;
+        // MARKER_TYPE
+        uint32_t type;
+        // Number of the thread that issued it, in order of their first marker
+        uint32_t thread;
+        // Truncated to MARKER_NAME_SIZE - 1 characters
+        char name[MARKER_NAME_SIZE];
+    };
+
+    /*
+    Bounded lock-free multi-producer/single-consumer queue of markers. Producers claim a slot by
+    incrementing the enqueue position and publish it through the slot's sequence number, so they
+    never wait for each other nor for the consumer. A full queue makes push fail and the marker
+    is counted as dropped
+    */
+    class MarkerQueue
+    {
+    public:
+        // capacity is rounded up to the next power of 2
+        explicit MarkerQueue(size_t capacity);
+
+        /*
+        Any thread: appends a marker, returns false if the queue is full
+        */
+        bool push(const Marker &marker);
+
+        /*
+        Consumer: returns the oldest marker without removing it, nullptr if the queue is empty
+        */
+        const Marker *front();
+
+        /*
+        Consumer: removes the marker returned by front
+        */
+        void pop();
+
+        /*
+        Consumer: removes every marker
+        */
+        void clear();
+
+        unsigned long long dropped_markers() const { return dropped.load(std::memory_order_relaxed); }
+
+    private:
+        struct alignas(64) Slot
+        {
+            // Position the slot can be written at, or that position + 1 once written
+            std::atomic<size_t> sequence;
+            Marker marker;
+        };
+
+        std::unique_ptr<Slot[]> slots;
+        size_t mask;
+        alignas(64) std::atomic<size_t> enqueue_position{0};
+        std::atomic<unsigned long long> dropped{0};
+        alignas(64) size_t dequeue_position{0};
+    };
+
+    // Markers of every thread, drained by the writer thread of the monitoring loop
+    extern MarkerQueue marker_queue;
+
+    /*
+    Application markers, from any thread. mark records an instant, begin_phase and end_phase
+    the bounds of a phase (phases of a thread may be nested). They are timestamped on the clock
+    of the samples and interleaved with them by the writer thread, in the binary trace and the
+    markers file of the CSV output (see MarkerSink). A marker takes no lock, no system call and
+    no allocation. Markers issued while the monitoring loop isn't running stay queued, as long as
+    the queue has room, and are discarded when the loop is next launched
+    */
+    void mark(const char *name);
+    void begin_phase(const char *name);
+    void end_phase(const char *name);
+
+    /*
+    Timestamps a marker of the given type and queues it, for the functions above and the regions
+    */
+    void push_marker(MARKER_TYPE type, const char *name);
+}
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef METER_HH
+#define METER_HH
+
+#include "output_sink.hh"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace power_meter
+{
+    /*
+    A measurement session with its own interval, sources, domains and sinks. Any number of meters
+    can run at once in a process, e.g. one per library, and they share a single sampling engine:
+    the monitoring loop reads every counter once per tick, at the shortest interval of the running
+    meters, and the writer thread hands every meter the samples closest to its own interval. The
+    cost of sampling the hardware doesn't grow with the number of meters
+
+    The first meter started launches the engine with the sources configured in power_meter.hh
+    (set_cpu_source, enable_core_energy...), the last one stopped stops it. A meter joining an
+    engine running at a longer interval gets its first sample at the engine's next tick
+
+        power_meter::Meter meter(std::chrono::milliseconds(10));
+        meter.set_domains({"Package"});
+        meter.add_sink(std::make_unique<power_meter::SummarySink>(summary));
+        meter.start();
+        ...
+        meter.stop();
+    */
+    class Meter
+    {
+    public:
+        explicit Meter(std::chrono::microseconds interval) : sampling_interval(interval) {}
+        ~Meter() { stop(); }
+        Meter(const Meter &) = delete;
+        Meter &operator=(const Meter &) = delete;
+
+        /*
+        Configuration, before start. set_sources keeps the sources written to the given outputs
+        (e.g. "cpu", "gpu"), set_domains the devices of the given domains (e.g. "Package", "DRAM").
+        Empty (the default) keeps everything. The sinks get the samples of the selected sources
+        and devices only, sources left without devices are dropped
+        */
+        void set_sources(std::vector<std::string> labels) { source_labels = std::move(labels); }
+        void set_domains(std::vector<std::string> domains) { this->domains = std::move(domains); }
+        void add_sink(std::unique_ptr<OutputSink> sink) { sinks.push_back(std::move(sink)); }
+
+        /*
+        Subscribes to the sampling engine, launching it if no meter is running. Returns false if
+        the engine couldn't be launched or the meter is already running
+        */
+        bool start();
+
+        /*
+        Unsubscribes from the engine, once the samples taken so far have been written to the
+        sinks, and ends the sinks. Stops the engine if this was the last meter
+        */
+        void stop();
+
+        bool running() const { return bound; }
+        std::chrono::microseconds interval() const { return sampling_interval; }
+
+        // The selected sources as described to the sinks, valid while running
+        const std::vector<SourceInfo> &sources() const { return selected; }
+
+        /*
+        Engine: selects the sources and devices of the engine's sources and begins the sinks
+        */
+        void bind(const std::vector<SourceInfo> &engine_sources);
+
+        /*
+        Engine: hands a sample to the sinks if it's due, time_ns is the time of its first
+        reading and engine_interval_ns the interval the engine samples at
+        */
+        void write_sample(const std::vector<SourceReading> &readings, long long time_ns, long long engine_interval_ns);
+
+        /*
+        Engine: hands an application marker to the sinks, every meter gets every marker
+        */
+        void write_marker(const Marker &marker);
+
+        /*
+        Engine: flushes the sinks if they got samples since the last flush
+        */
+        void flush();
+
+        /*
+        Engine: ends the sinks, after the meter's last sample
+        */
+        void unbind();
+
+    private:
+        // A selected source: the engine's source it comes from and the devices kept, empty if all
+        struct Selection
+        {
+            size_t source;
+            std::vector<size_t> devices;
+        };
+
+        std::chrono::microseconds sampling_interval;
+        std::vector<std::string> source_labels;
+        std::vector<std::string> domains;
+        std::vector<std::unique_ptr<OutputSink>> sinks;
+
+        bool bound{false};
+        std::vector<SourceInfo> selected;
+        std::vector<Selection> selections;
+        std::vector<SourceReading> readings;
+        // Time the next sample is due, 0 before the first one
+        long long next_ns{0};
+        bool pending_flush{false};
+    };
+}
+
+#endif
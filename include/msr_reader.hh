@@ -3,13 +3,25 @@
 
 #include <stdio.h>
 #include <unistd.h>
+#include <filesystem>
+#include <string>
 
 namespace rapl_utils
 {
+    /*
+    Directory holding the per-core MSR device files, laid out as [root]/[core]/msr
+
+    Defaults to /dev/cpu. It may point to a directory of regular files, which will
+    be read at the same offsets as the real devices
+    */
+    extern std::filesystem::path msr_device_root;
+
+    void set_msr_device_root(std::string dir);
+
     /*
     Returns an open file for the MSRs of the specified core
 
-    Needs read permissions for /dev/cpu/[core]/msr
+    Needs read permissions for [msr_device_root]/[core]/msr
     */
     FILE *open_msr(int core);
 
@@ -18,6 +30,26 @@ namespace rapl_utils
     */
     unsigned long long read_msr(FILE *file, unsigned int address);
 
+    /*
+    Returns a file descriptor for the MSRs of the specified core. The descriptor is
+    opened on the first call and cached in a per-core table, following calls return
+    the cached descriptor
+
+    Throws std::filesystem::filesystem_error if the device can't be opened
+    */
+    int open_msr_fd(int core);
+
+    /*
+    Closes every descriptor in the per-core table
+    */
+    void close_msr_fds();
+
+    /*
+    Reads the raw value of the MSR at the specified address of the specified core
+    with a single pread on its cached descriptor. Returns false if the read failed
+    */
+    bool read_msr_raw(int core, unsigned int address, unsigned long long *data);
+
     /*
     Reads all fields from the msr at msr_address and stores their values in the
     msr_values array
@@ -27,8 +59,10 @@ namespace rapl_utils
     msr_offsets: An array containing the offset in bits from the start of the MSR to
     each of the fields msr_sizes: An array containing the size in bits of each field
     msr_values: The array in which the values of each field will be stored.
+
+    Returns false, leaving msr_values unchanged, if the MSR can't be read
     */
-    void read_msr_fields(int core, const unsigned int msr_address,
+    bool read_msr_fields(int core, const unsigned int msr_address,
                          const unsigned int msr_numfields,
                          const unsigned int *msr_offsets,
                          const unsigned int *msr_sizes,
@@ -40,4 +74,4 @@ namespace rapl_utils
     unsigned long long get_mask(unsigned int size);
 } // namespace rapl_utils
 
-#endif
\ No newline at end of file
+#endif
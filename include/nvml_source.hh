@@ -0,0 +1,72 @@
+#ifndef NVML_SOURCE_HH
+#define NVML_SOURCE_HH
+
+#include "energy_source.hh"
+#include "seqlock.hh"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace power_meter
+{
+    /*
+    Energy source reading the total energy consumption of every Nvidia GPU through NVML
+
+    An NVML call can take milliseconds, so the GPUs are not read by the monitoring thread. A pool
+    of poller threads reads them, each GPU timestamped on its own, and publishes the readings
+    through a seqlock per GPU. read_counters returns the last published readings along with their
+    timestamps (see device_times) and asks the pollers for new ones without waiting for them
+    */
+    class NvmlSource : public EnergySource
+    {
+    public:
+        /*
+        poll_threads is the number of poller threads, 0 picks one per GPU, up to MAX_NVML_POLLERS
+        */
+        explicit NvmlSource(unsigned int poll_threads = 0) : requested_pollers(poll_threads) {}
+        ~NvmlSource() override { stop_pollers(); }
+
+        const char *name() const override { return "NVML"; }
+        int init() override;
+        void shutdown() override;
+        void read_counters(struct timespec &time, uint64_t *counters) override;
+        const uint64_t *device_times() const override { return times.empty() ? nullptr : times.data(); }
+
+        static constexpr unsigned int MAX_NVML_POLLERS = 8;
+
+    private:
+        struct GpuReading
+        {
+            uint64_t counter;
+            uint64_t time_ns;
+        };
+        // Last reading of a GPU, written by its poller and read by read_counters
+        struct alignas(64) PublishedReading
+        {
+            Seqlock<GpuReading> reading;
+        };
+
+        // Reads and publishes GPUs [begin, end)
+        void poll_slice(size_t begin, size_t end);
+        void poller_loop(unsigned int slice);
+        void stop_pollers();
+
+        bool initialized{false};
+        unsigned int requested_pollers;
+        std::unique_ptr<PublishedReading[]> published;
+        // Timestamps of the readings returned by the last read_counters
+        std::vector<uint64_t> times;
+        // GPU range of each poller
+        std::vector<std::pair<size_t, size_t>> slices;
+        std::vector<std::thread> pollers;
+
+        // Every read_counters call bumps generation, the pollers read their GPUs again when it changes
+        std::mutex lock;
+        std::condition_variable poll_cv;
+        unsigned long long generation{0};
+        bool stopping{false};
+    };
+}
+
+#endif
@@ -3,20 +3,45 @@
 
 #include <time.h>
 #include <memory>
-#include <nvml.h>
+#include <vector>
 
-#define MAX_GPUS 4
+// Opaque NVML device, declared as in nvml.h
+struct nvmlDevice_st;
 
 namespace nvml_utils
 {
+    /*
+    NVML is not linked, libnvml is loaded at runtime by load() the first time GPUs are requested,
+    so the library builds without CUDA and runs on machines without a driver. These are the
+    types and return codes of the NVML functions used, with the same values as nvml.h
+    */
+    typedef ::nvmlDevice_st *nvmlDevice_t;
+    typedef int nvmlReturn_t;
+    enum NVML_RETURN
+    {
+        NVML_SUCCESS = 0,
+        NVML_ERROR_UNINITIALIZED = 1,
+        NVML_ERROR_INVALID_ARGUMENT = 2,
+        NVML_ERROR_NOT_SUPPORTED = 3
+    };
+
+    // Entry points of libnvml, set by load()
+    struct NvmlApi
+    {
+        nvmlReturn_t (*init)(){nullptr};
+        nvmlReturn_t (*shutdown)(){nullptr};
+        nvmlReturn_t (*device_get_count)(unsigned int *){nullptr};
+        nvmlReturn_t (*device_get_handle_by_index)(unsigned int, nvmlDevice_t *){nullptr};
+        nvmlReturn_t (*device_get_total_energy_consumption)(nvmlDevice_t, unsigned long long *){nullptr};
+    };
+
     struct EnergyAux
     {
         // Timestamp when this struct was last updated
         struct timespec time;
-        // Last measured energy per CUDA GPU
-        // We need a counter for each GPU node in the system, this assumes
-        // a maximum of 4 GPUs, but may be increased or decreased as needed
-        float energy[MAX_GPUS];
+        // Last energy counter per CUDA GPU, in mili Joules. Sized for the number
+        // of GPUs by the first update
+        std::vector<unsigned long long> counter;
     };
 
     // Stores the average power consumption and energy consumption during the last
@@ -26,18 +51,45 @@ namespace nvml_utils
         double power{0};
         double energy{0};
         double total_energy{0};
+        // Total energy consumption in mili Joules, total_energy is computed from it
+        unsigned long long total_mj{0};
     };
 
     extern std::unique_ptr<nvmlDevice_t[]> device_handles;
     extern unsigned int num_GPUs;
+    extern NvmlApi api;
+
+    /*
+    Loads libnvml and resolves its entry points into api, once per process. The library is
+    $POWER_METER_NVML_LIBRARY if set, libnvidia-ml.so.1 otherwise. Returns false without
+    loading anything if it can't be found or the library was built without NVML support
+    */
+    bool load();
 
     /*
-    Initialize the number of GPUs in the machine and get their nvml handles
+    Loads libnvml if needed and initializes NVML. Returns false if NVML is not available
+    */
+    bool start();
+
+    /*
+    Initialize the number of GPUs in the machine and get their nvml handles. NVML must have
+    been started
     */
     void init();
 
     /*
-    Updates the input EnergyAux struct with the last per-gpu energy readings in Joules
+    Returns the energy consumed by the specified GPU since the driver was loaded, in mili Joules
+    */
+    unsigned long long get_gpu_energy_counter(unsigned int gpu);
+
+    /*
+    Reads the energy counter of the specified GPU into energy, in mili Joules. Returns false
+    and leaves energy unchanged if it can't be read
+    */
+    bool read_gpu_energy_counter(unsigned int gpu, unsigned long long &energy);
+
+    /*
+    Updates the input EnergyAux struct with the last per-gpu energy counters
     */
     void update_gpu_energy(EnergyAux &data);
 
@@ -0,0 +1,240 @@
+#ifndef OUTPUT_SINK_HH
+#define OUTPUT_SINK_HH
+
+#include "energy_source.hh"
+#include "markers.hh"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace power_meter
+{
+    // Description of one of the sources whose readings are written to a sink
+    struct SourceInfo
+    {
+        // Name of the output this source is written to, e.g. "cpu" or "gpu"
+        std::string label;
+        // Name of the backend, as returned by EnergySource::name()
+        std::string name;
+        std::vector<DeviceInfo> devices;
+        // Whether its readings carry the time of each device, see EnergySource::device_times
+        bool device_times{false};
+    };
+
+    /*
+    Returns the number of 64 bit words a reading of the source takes in a sample record, see
+    EnergySource::record_words
+    */
+    inline size_t record_words(const SourceInfo &source)
+    {
+        return 1 + source.devices.size() * (source.device_times ? 2 : 1);
+    }
+
+    /*
+    Sizes readings for the sources, one reading per source with its counters (and device times)
+    allocated
+    */
+    void allocate_readings(const std::vector<SourceInfo> &sources, std::vector<SourceReading> &readings);
+
+    /*
+    Unpacks a sample record into one reading per source, allocated with allocate_readings. A record
+    holds, for each source, its timestamp in ns followed by the raw counter of each of its devices,
+    and the time of each device's reading for sources with per-device timestamps
+    */
+    void unpack_record(const uint64_t *record, const std::vector<SourceInfo> &sources, std::vector<SourceReading> &readings);
+
+    /*
+    Destination of the readings taken by the monitoring loop. Every sample holds one reading
+    per source, in the same order as the sources passed to begin()
+    */
+    class OutputSink
+    {
+    public:
+        virtual ~OutputSink() = default;
+
+        /*
+        Called once before the first sample
+        */
+        virtual void begin(const std::vector<SourceInfo> &sources) = 0;
+
+        /*
+        Called for every sample, including the initial readings taken before the first interval
+        */
+        virtual void write_sample(const SourceReading *readings) = 0;
+
+        /*
+        Called for every application marker (see markers.hh), between the samples taken before
+        and after it
+        */
+        virtual void write_marker(const Marker & /*marker*/) {}
+
+        /*
+        Called after every batch of samples, sinks may buffer samples until then
+        */
+        virtual void flush() {}
+
+        /*
+        Called once after the last sample
+        */
+        virtual void end() {}
+    };
+
+    /*
+    Columns written for a source besides its per-domain series. DEVICE_COLUMNS adds the power and
+    energy of every device ("core0 power, core0 energy, ..."), TOP_DEVICES adds the top_n devices
+    that drew the most power during the interval ("Top 1, Top 1 power, ...")
+    */
+    enum CSV_COLUMNS
+    {
+        DOMAIN_COLUMNS,
+        DEVICE_COLUMNS,
+        TOP_DEVICES
+    };
+
+    // Output stream of one source and the columns written to it
+    struct CsvStream
+    {
+        std::ostream *stream;
+        CSV_COLUMNS columns{DOMAIN_COLUMNS};
+        unsigned int top_n{0};
+    };
+
+    /*
+    Computes the series of the CSV output from the readings of every sample: the power, energy
+    and total energy of each domain of each source (its devices added up), and of each device.
+    Devices of sources with per-device timestamps are measured over their own intervals
+    */
+    class DomainSeries
+    {
+    public:
+        void begin(const std::vector<SourceInfo> &sources);
+
+        /*
+        Updates the series with a sample, returns false on the first one which only records the
+        counters
+        */
+        bool update(const SourceReading *readings);
+
+        size_t num_sources() const { return counters.size(); }
+        const std::vector<std::string> &domains(size_t source) const { return source_domains[source]; }
+        // Domain of each device of a source, as an index into domains
+        const std::vector<unsigned int> &device_domains(size_t source) const { return device_groups[source]; }
+        // Power, energy and total energy of each domain of a source over the last interval
+        const EnergyData *results(size_t source) const { return domain_results[source].data(); }
+        const DeviceCounters &devices(size_t source) const { return counters[source]; }
+        // Length of the last interval of a source in seconds
+        double interval(size_t source) const { return time_diff[source]; }
+
+    private:
+        std::vector<SourceInfo> sources;
+        std::vector<std::vector<std::string>> source_domains;
+        std::vector<std::vector<unsigned int>> device_groups;
+        std::vector<struct timespec> previous_time;
+        std::vector<double> time_diff;
+        std::vector<DeviceCounters> counters;
+        std::vector<std::vector<EnergyData>> domain_results;
+        bool first_sample{true};
+    };
+
+    /*
+    Writes the "Power, Energy, Total energy" CSV series of each source to its own stream. Devices are
+    added up per domain, the first domain of a source takes the first three columns and every other
+    domain adds three more, e.g. "DRAM power, DRAM energy, DRAM total energy"
+
+    With interval_column, every row ends with the length of its interval in seconds, for samples
+    taken at a variable interval
+
+    The power of the devices of a source with per-device timestamps is computed over each
+    device's own interval, and the power of a domain is the sum of its devices'
+    */
+    class CsvSink : public OutputSink
+    {
+    public:
+        // One stream per source, in the same order as the sources
+        explicit CsvSink(std::vector<std::ostream *> streams, bool interval_column = false);
+        explicit CsvSink(std::vector<CsvStream> streams, bool interval_column = false)
+            : streams(std::move(streams)), interval_column(interval_column) {}
+
+        void begin(const std::vector<SourceInfo> &sources) override;
+        void write_sample(const SourceReading *readings) override;
+        void flush() override;
+        void end() override;
+
+    private:
+        std::vector<CsvStream> streams;
+        bool interval_column;
+        std::vector<SourceInfo> sources;
+        DomainSeries series;
+        // Devices of the current source ordered by energy, for TOP_DEVICES
+        std::vector<unsigned int> ranking;
+    };
+
+    /*
+    Writes the application markers as CSV, "Time, Row, Event, Name, Thread": the time in seconds
+    since the first sample, the row of the CSV series whose interval holds the marker (the first
+    row is 1), the event (mark, begin, end, region begin, region end), the marker's name and the
+    number of its thread
+    */
+    class MarkerSink : public OutputSink
+    {
+    public:
+        explicit MarkerSink(std::ostream *stream) : stream(stream) {}
+
+        void begin(const std::vector<SourceInfo> &sources) override;
+        void write_sample(const SourceReading *readings) override;
+        void write_marker(const Marker &marker) override;
+        void flush() override;
+        void end() override;
+
+    private:
+        std::ostream *stream;
+        // Samples written so far, and time of the first one in ns
+        unsigned long long samples{0};
+        long long start_ns{0};
+    };
+
+    // Energy and power of a domain of a source over a whole run
+    struct DomainSummary
+    {
+        // Label of the source, e.g. "cpu" or "gpu", and domain, e.g. "Package"
+        std::string label;
+        std::string domain;
+        // Energy in Joules, mean and peak power over the sampling intervals in Watts
+        double energy{0};
+        double mean_power{0};
+        double peak_power{0};
+    };
+
+    struct RunSummary
+    {
+        // Time between the first and the last sample in seconds
+        double duration{0};
+        // Domains of every source, in order of first appearance within each source
+        std::vector<DomainSummary> domains;
+    };
+
+    /*
+    Adds up the energy of every domain of every source over a run, and tracks their peak power.
+    Devices are grouped by domain like the CSV series are. The summary is copied to output
+    when the run ends, output must outlive the sink
+    */
+    class SummarySink : public OutputSink
+    {
+    public:
+        explicit SummarySink(RunSummary &output) : output(output) {}
+
+        void begin(const std::vector<SourceInfo> &sources) override;
+        void write_sample(const SourceReading *readings) override;
+        void end() override;
+
+    private:
+        RunSummary &output;
+        RunSummary summary;
+        DomainSeries series;
+        struct timespec start_time{};
+        bool first_sample{true};
+    };
+}
+
+#endif
@@ -1,41 +1,248 @@
 #ifndef POWER_METER_HH
 #define POWER_METER_HH
 
+#include "energy_source.hh"
+#include "output_sink.hh"
+#include "adaptive_sampling.hh"
+#include "live_stats.hh"
+#include "shm_ring.hh"
+#include "meter.hh"
+#include "markers.hh"
+
+#include <atomic>
 #include <thread>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <memory>
 
 namespace power_meter
 {
     // Flag used to stop the monitoring loop
-    extern bool do_monitoring;
+    extern std::atomic<bool> do_monitoring;
     extern std::thread monitoring_thread; // Default-constructed thread, will get replaced when we launch an actual thread
+    extern std::thread writer_thread;     // Writes the samples taken by monitoring_thread to the outputs
+
+    // Statistics of the actual sampling period of the last run of the monitoring loop
+    struct JitterStats
+    {
+        unsigned long long samples{0};
+        // Sampling period in microseconds
+        double min_us{0};
+        double mean_us{0};
+        double max_us{0};
+        double p99_us{0};
+        // Deadlines skipped because sampling fell behind by more than a whole interval
+        unsigned long long overruns{0};
+    };
+
+    // Placement of the monitoring thread, see set_sampler_affinity/set_sampler_priority
+    extern int sampler_core;
+    extern int sampler_priority;
+
+    // Sources the measurements are taken from. When not set, launch_monitoring_loop
+    // reads RAPL for the CPU and NVML for the GPUs
+    extern std::unique_ptr<EnergySource> cpu_source;
+    extern std::unique_ptr<EnergySource> gpu_source;
+    // Whether the GPUs are measured when no GPU source is set, see set_gpu_energy
+    extern bool gpu_energy;
+    // Optional per-core source, see enable_core_energy
+    extern std::unique_ptr<EnergySource> core_source;
+
+    /*
+    Output format enum. CSV writes the "Power, Energy, Total energy" series of the CPU and
+    the GPUs to their own files, BINARY writes the raw counters to a single binary trace
+    (see trace_format.hh), which power_meter_convert turns back into the CSV files. CHROME_JSON
+    and PERFETTO write the counters and the markers as a timeline for chrome://tracing and
+    ui.perfetto.dev (see trace_event_sink.hh). BINARY_COMPRESSED writes the binary trace delta
+    and varint encoded in blocks (see trace_compression.hh), for long runs. NO_OUTPUT writes no
+    files, for loops only read live or through shared memory
+    */
+    enum OUTPUT_FORMAT
+    {
+        CSV,
+        BINARY,
+        NO_OUTPUT,
+        CHROME_JSON,
+        PERFETTO,
+        BINARY_COMPRESSED
+    };
 
     // Output
+    extern OUTPUT_FORMAT output_format;
     extern std::filesystem::path output_dir;
     extern std::filesystem::path cpu_out_filename;
     extern std::filesystem::path gpu_out_filename;
+    extern std::filesystem::path trace_filename;
+    // Whether binary traces get a summary pyramid, see trace_pyramid.hh
+    extern bool trace_pyramid;
+    // Empty for the default of the format, trace.json or trace.perfetto-trace
+    extern std::filesystem::path timeline_filename;
+    extern std::filesystem::path core_out_filename;
+    extern std::filesystem::path markers_out_filename;
+    extern bool device_columns;
+    extern CSV_COLUMNS core_columns;
+    extern unsigned int core_top_n;
     extern std::ofstream cpu_out;
     extern std::ofstream gpu_out;
+    extern std::ofstream core_out;
+    extern std::ofstream markers_out;
 
     /*
-    Launch a thread that will take measurements in the background
+    Launch a thread that will take measurements in the background, and a thread that writes
+    them to the outputs. Samples are handed from one to the other through a ring holding up to
+    ring_capacity samples, if the writer falls further behind samples are dropped
+
+    The loop is the default session of the sampling engine shared with the meters (see Meter),
+    if meters are already running it joins their engine and ring_capacity is ignored. Returns
+    false if the sources couldn't be initialized or the loop is already running
     */
-    void launch_monitoring_loop(unsigned int sampling_interval_ms);
+    bool launch_monitoring_loop(std::chrono::microseconds sampling_interval, size_t ring_capacity = 4096);
+    bool launch_monitoring_loop(unsigned int sampling_interval_ms, size_t ring_capacity = 4096);
 
     void stop_monitoring_loop();
 
     /*
-    Power measurement loop, intended to run on a separate thread
+    Sampling engine shared by the meters, called by Meter::start and Meter::stop. attach_meter
+    launches the engine if it isn't running and subscribes the meter, detach_meter unsubscribes
+    it once the samples taken so far are written, and stops the engine after its last meter
+    */
+    bool attach_meter(Meter *meter);
+    void detach_meter(Meter *meter);
+
+    /*
+    Power measurement loop, intended to run on a separate thread. Samples are taken at absolute
+    deadlines on CLOCK_MONOTONIC, so the time spent sampling doesn't add up to the period
     */
+    void monitoring_loop(std::chrono::microseconds sampling_interval);
     void monitoring_loop(unsigned int sampling_interval_ms);
 
+    /*
+    Output loop, intended to run on a separate thread
+    */
+    void writer_loop();
+
+    /*
+    Returns the number of samples of the current (or last) run dropped because the ring was full
+    */
+    unsigned long long get_dropped_samples();
+
+    /*
+    Returns the statistics of the sampling period of the last run, available after stop_monitoring_loop
+    */
+    JitterStats get_jitter_stats();
+
+    /*
+    Sampler placement, must be called before launch_monitoring_loop
+
+    set_sampler_affinity pins the monitoring thread to the given core, typically a housekeeping
+    core not used by the measured application. -1 (the default) lets the scheduler place it
+
+    set_sampler_priority runs the monitoring thread with the SCHED_FIFO real-time policy at the given
+    priority (1-99), which needs CAP_SYS_NICE. 0 (the default) keeps the normal policy
+    */
+    void set_sampler_affinity(int core);
+    void set_sampler_priority(int priority);
+
+    /*
+    Adaptive sampling, must be configured before launch_monitoring_loop. While power is steady the
+    loop samples at the interval passed to launch_monitoring_loop, and switches to the burst interval
+    when the power changes sharply or request_burst is called (see AdaptiveSampling). The interval
+    never exceeds the maximum safe interval, so counters can't wrap around twice between samples.
+    The CSV files get an "Interval" column with each row's interval in seconds
+
+    request_burst samples at the burst interval for the given duration from now, it can be called
+    from any thread while the loop runs
+
+    get_max_safe_interval returns the maximum safe interval for the sources of the current (or
+    last) run, from their peak power estimates and the highest power observed so far
+    */
+    void set_adaptive_sampling(AdaptiveSampling config);
+    void request_burst(std::chrono::milliseconds duration);
+    std::chrono::microseconds get_max_safe_interval();
+
+    /*
+    Live measurements, for applications reacting to the current power. The writer thread keeps
+    the latest power and energy of every source, and rolling statistics of its power over each
+    of the windows set with set_live_windows (1 s and 10 s by default, up to MAX_LIVE_WINDOWS,
+    none turns them off, windows of 0 ms or less are ignored), see LiveSnapshot. Snapshots trail
+    the sampler by the writer's period (10 ms) at most
+
+    get_live_source returns the index of the source written to the given output (e.g. "cpu",
+    "gpu"), -1 if it isn't measured. Valid once launch_monitoring_loop has returned
+
+    get_live_snapshot copies the latest snapshot of a source, from any thread and without taking
+    locks. Returns false until the source's first interval is measured
+    */
+    void set_live_windows(std::vector<std::chrono::milliseconds> windows);
+    int get_live_source(const std::string &label);
+    bool get_live_snapshot(int source, LiveSnapshot &snapshot);
+
+    /*
+    Shared memory publishing, must be called before launch_monitoring_loop. Every sample is also
+    published to the POSIX shared memory object name (see shm_ring.hh), a ring of the latest
+    capacity samples (rounded up to a power of 2) that unprivileged processes read with ShmClient.
+    If it can't be created the loop runs without it. An empty name disables it
+    */
+    void set_shm_publishing(std::string name = POWER_METER_SHM_DEFAULT_NAME, size_t capacity = 4096);
+
+    /*
+    Source configuration, must be called before launch_monitoring_loop. Allows replacing
+    the hardware counters with a simulated or replayed source
+    */
+    void set_cpu_source(std::unique_ptr<EnergySource> source);
+    void set_gpu_source(std::unique_ptr<EnergySource> source);
+
+    /*
+    GPU measurement, must be called before launch_monitoring_loop. GPUs are measured by default,
+    disabling it leaves NVML unloaded and writes no GPU output, for CPU-only runs
+    */
+    void set_gpu_energy(bool enabled);
+
+    /*
+    Per-core energy, must be called before launch_monitoring_loop. Reads the energy counter of
+    every core on AMD CPUs (see CoreEnergySource) and writes them to core_out_filename. columns
+    selects a wide series with the power and energy of every core (DEVICE_COLUMNS) or the top_n
+    cores drawing the most power in each interval (TOP_DEVICES). If the per-core counters can't
+    be read the loop runs without them
+
+    set_core_source replaces the per-core counters with another source, nullptr disables them
+    */
+    void enable_core_energy(CSV_COLUMNS columns = DEVICE_COLUMNS, unsigned int top_n = 8, unsigned int helper_threads = 0);
+    void set_core_source(std::unique_ptr<EnergySource> source);
+
     /*
     Output configuration
     */
     void set_output_dir(std::string dir);
     void set_cpu_out_filename(std::string filename);
     void set_gpu_out_filename(std::string filename);
+    void set_core_out_filename(std::string filename);
+    // File of the application markers in CSV mode, see mark
+    void set_markers_out_filename(std::string filename);
+
+    /*
+    Whether the CSV files of sources with several devices (NUMA nodes, GPUs) also get the power
+    and energy of each device after the aggregate series, enabled by default
+    */
+    void set_device_columns(bool enabled);
+    void set_output_format(OUTPUT_FORMAT format);
+    void set_trace_filename(std::string filename);
+    /*
+    Whether the BINARY and BINARY_COMPRESSED formats also write the summary pyramid of the trace
+    to the trace's path with .pyramid appended, for fast zooming over long traces (see
+    trace_pyramid.hh). Disabled by default
+    */
+    void set_trace_pyramid(bool enabled);
+    // File of the CHROME_JSON and PERFETTO formats
+    void set_timeline_filename(std::string filename);
+
+    /*
+    Adds a sink receiving the samples of the next run along with the output format's, e.g. a
+    SummarySink. Must be called before launch_monitoring_loop, the sink is destroyed when the
+    loop stops
+    */
+    void add_output_sink(std::unique_ptr<OutputSink> sink);
 }
 
-#endif
\ No newline at end of file
+#endif
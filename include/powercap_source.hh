@@ -0,0 +1,45 @@
+#ifndef POWERCAP_SOURCE_HH
+#define POWERCAP_SOURCE_HH
+
+#include "energy_source.hh"
+#include "rapl_utils.hh"
+
+#include <filesystem>
+
+namespace power_meter
+{
+    /*
+    Energy source reading RAPL through the kernel's powercap interface, which doesn't need
+    access to the MSRs. Exposes the energy_uj counter of every package zone and its subzones
+    (intel-rapl:<package>[:<subzone>] under root) in one device per package for each selected
+    domain, named "package<N>". Domains are selected as a bitmask of (1 << RAPL_DOMAIN), zones
+    of other domains are exposed under their own name when every domain is selected
+
+    Counters are in micro Joules and wrap at max_energy_range_uj + 1. The energy_uj files are
+    opened once in init(), each reading is a single pread per file. A file that can't be read
+    keeps its previous value
+    */
+    class PowercapSource : public EnergySource
+    {
+    public:
+        explicit PowercapSource(unsigned int domains = rapl_utils::ALL_RAPL_DOMAINS,
+                                std::filesystem::path root = "/sys/class/powercap")
+            : domains(domains), root(std::move(root)) {}
+        ~PowercapSource() override { shutdown(); }
+
+        const char *name() const override { return "powercap"; }
+        int init() override;
+        void shutdown() override;
+        void read_counters(struct timespec &time, uint64_t *counters) override;
+
+    private:
+        unsigned int domains;
+        std::filesystem::path root;
+        // Open energy_uj file of each device
+        std::vector<int> fds;
+        // Last value read from each file, kept when a read fails
+        std::vector<uint64_t> values;
+    };
+}
+
+#endif
@@ -44,6 +44,30 @@ namespace rapl_utils
     inline const unsigned int AMD_MSR_CORE_ENERGY_STATUS_SIZES[] = {32};
     inline const unsigned int AMD_MSR_CORE_ENERGY_STATUS_OFFSETS[] = {0};
 
+// The uncore RAPL domain is called PP1 on Intel CPUs, usually the integrated GPU on client parts
+#define INTEL_MSR_PP1_ENERGY_STATUS 0x641
+#define INTEL_MSR_PP1_ENERGY_STATUS_NUMFIELDS 1
+    inline const char *INTEL_MSR_PP1_ENERGY_STATUS_NAMES[] = {"Total Energy Consumed"};
+    inline const unsigned int INTEL_MSR_PP1_ENERGY_STATUS_SIZES[] = {32};
+    inline const unsigned int INTEL_MSR_PP1_ENERGY_STATUS_OFFSETS[] = {0};
+
+#define INTEL_MSR_DRAM_ENERGY_STATUS 0x619
+#define INTEL_MSR_DRAM_ENERGY_STATUS_NUMFIELDS 1
+    inline const char *INTEL_MSR_DRAM_ENERGY_STATUS_NAMES[] = {"Total Energy Consumed"};
+    inline const unsigned int INTEL_MSR_DRAM_ENERGY_STATUS_SIZES[] = {32};
+    inline const unsigned int INTEL_MSR_DRAM_ENERGY_STATUS_OFFSETS[] = {0};
+
+// The platform (PSys) domain covers the whole SoC, it has a single counter per system
+#define INTEL_MSR_PLATFORM_ENERGY_STATUS 0x64D
+#define INTEL_MSR_PLATFORM_ENERGY_STATUS_NUMFIELDS 1
+    inline const char *INTEL_MSR_PLATFORM_ENERGY_STATUS_NAMES[] = {"Total Energy Consumed"};
+    inline const unsigned int INTEL_MSR_PLATFORM_ENERGY_STATUS_SIZES[] = {32};
+    inline const unsigned int INTEL_MSR_PLATFORM_ENERGY_STATUS_OFFSETS[] = {0};
+
+// On server parts the DRAM domain uses a fixed energy unit of 2^-16 J instead of the one in
+// MSR_RAPL_POWER_UNIT
+#define INTEL_DRAM_FIXED_ENERGY_UNIT_BITS 16
+
 #define INTEL_MSR_PKG_POWER_INFO 0x614
 #define INTEL_MSR_PKG_POWER_INFO_NUMFIELDS 4
     inline const char *INTEL_MSR_PKG_POWER_INFO_NAMES[] = {
@@ -0,0 +1,49 @@
+#ifndef RAPL_SOURCE_HH
+#define RAPL_SOURCE_HH
+
+#include "energy_source.hh"
+#include "rapl_utils.hh"
+
+namespace power_meter
+{
+    /*
+    Energy source reading RAPL's energy counters through the CPU's MSRs. Exposes one counter
+    per package for each selected domain that is available on this machine, named "package<N>"
+    (PSys only has one counter for the whole system). Domains are selected as a bitmask of
+    (1 << RAPL_DOMAIN)
+
+    The registers to read are resolved once in init(), each reading is a single pread per
+    register on the cached MSR descriptors. A register that can't be read keeps its previous
+    value, so its interval reads as no energy
+    */
+    class RaplSource : public EnergySource
+    {
+    public:
+        explicit RaplSource(unsigned int domains = rapl_utils::ALL_RAPL_DOMAINS) : domains(domains) {}
+
+        const char *name() const override { return "RAPL"; }
+        int init() override;
+        void shutdown() override;
+        void read_counters(struct timespec &time, uint64_t *counters) override;
+        // The package's TDP on Intel CPUs, unknown on AMD
+        double max_power(unsigned int device) const override;
+
+    private:
+        // A register read by every reading, in device order
+        struct RegisterRead
+        {
+            int fd;
+            unsigned int address;
+            // Last value read, kept when a read fails
+            uint64_t value;
+        };
+
+        unsigned int domains;
+        std::vector<RegisterRead> reads;
+        // TDP of a package and of the whole system, 0 if unknown
+        double package_tdp{0};
+        double system_tdp{0};
+    };
+}
+
+#endif
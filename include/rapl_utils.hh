@@ -3,26 +3,28 @@
 
 #include "rapl_const.hh"
 #include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 #include <unistd.h>
 #include <memory>
+#include <vector>
 
-#define MAX_NUMA_NODES 8
 namespace rapl_utils
 {
     //////////////////////////////////////////////////////////////////////
     //						  	   DATA
     //////////////////////////////////////////////////////////////////////
 
-    // This struct contains per-node energy measurements along with the time they were taken
+    // This struct contains per-package energy measurements along with the time they were taken
     struct EnergyAux
     {
         // Timestamp when this struct was last updated
         struct timespec time;
-        // Last measured energy per NUMA node
-        // We need a counter for each NUMA node in the system, this assumes
-        // a maximum of 8 nodes, but may be increased or decreased as needed
-        float energy[MAX_NUMA_NODES];
+        // Last raw energy counter per package, in ticks of energy_unit. Sized for
+        // the number of packages by the first update
+        std::vector<uint32_t> counter;
+        // Energy in Joules of one tick of the counters, set for the domain read by update_aux_data
+        double energy_unit;
     };
 
     // Stores the machine's average power consumption and energy consumption during the last
@@ -32,6 +34,9 @@ namespace rapl_utils
         double power{0};
         double energy{0};
         double total_energy{0};
+        // Total energy consumption in counter ticks, total_energy is computed from it so it
+        // keeps full resolution over long runs
+        unsigned long long total_ticks{0};
     };
 
     extern unsigned long long
@@ -40,6 +45,12 @@ namespace rapl_utils
         INTEL_MSR_PKG_ENERGY_STATUS_VALUES[INTEL_MSR_PKG_ENERGY_STATUS_NUMFIELDS];
     extern unsigned long long
         INTEL_MSR_PP0_ENERGY_STATUS_VALUES[INTEL_MSR_PP0_ENERGY_STATUS_NUMFIELDS];
+    extern unsigned long long
+        INTEL_MSR_PP1_ENERGY_STATUS_VALUES[INTEL_MSR_PP1_ENERGY_STATUS_NUMFIELDS];
+    extern unsigned long long
+        INTEL_MSR_DRAM_ENERGY_STATUS_VALUES[INTEL_MSR_DRAM_ENERGY_STATUS_NUMFIELDS];
+    extern unsigned long long
+        INTEL_MSR_PLATFORM_ENERGY_STATUS_VALUES[INTEL_MSR_PLATFORM_ENERGY_STATUS_NUMFIELDS];
     extern unsigned long long
         INTEL_MSR_PKG_POWER_INFO_VALUES[INTEL_MSR_PKG_POWER_INFO_NUMFIELDS];
 
@@ -57,16 +68,45 @@ namespace rapl_utils
     extern float energy_increment;
     extern float time_increment;
 
+    /*
+    Energy increment of the DRAM domain, which differs from energy_increment on server parts
+    */
+    extern float dram_energy_increment;
+
     /*
     Store the value at which the energy counter wraps around
     */
     extern float energy_counter_max;
 
     /*
-    Store NUMA-related information (Number of nodes, cores per node, id of
-    the first core in each node)
+    RAPL domain enum, the values are the domain numbers taken by get_node_energy
+    */
+    enum RAPL_DOMAIN
+    {
+        PACKAGE,
+        CORES,
+        UNCORE,
+        DRAM,
+        PSYS,
+        NUM_RAPL_DOMAINS
+    };
+    inline const char *RAPL_DOMAIN_NAMES[] = {"Package", "Cores", "Uncore", "DRAM", "PSys"};
+    // Bitmask with every domain set, for selecting domains as (1 << domain)
+    inline const unsigned int ALL_RAPL_DOMAINS = (1U << NUM_RAPL_DOMAINS) - 1;
+
+    /*
+    Whether each domain can be read on this machine, probed by init()
+    */
+    extern bool domain_available[NUM_RAPL_DOMAINS];
+
+    /*
+    Store topology-related information (Number of NUMA nodes, number of RAPL packages and
+    the id of the core each package's counters are read on). A package is a socket, or a
+    die on Intel parts with several dies per socket, which may span several NUMA nodes
     */
     extern int numa_nodes;
+    extern int num_packages;
+    extern std::unique_ptr<int[]> first_package_core;
 
     /*
     Vendor ID enum
@@ -78,7 +118,7 @@ namespace rapl_utils
     };
     extern int vendor_id;
 
-    extern std::unique_ptr<int[]> first_node_core;
+    // Highest online core id + 1
     extern int numcores;
 
     //////////////////////////////////////////////////////////////////////
@@ -91,32 +131,49 @@ namespace rapl_utils
     */
     int init();
 
+    /*
+    Returns the address of the energy status MSR of the specified RAPL domain for this
+    machine's vendor, 0 if the vendor has no such domain
+    */
+    unsigned int get_domain_msr(int domain);
+
+    /*
+    Returns the energy increment of the specified RAPL domain in Joules
+    */
+    float get_domain_energy_increment(int domain);
+
     /*
     Returns the last energy reading of the specified RAPL domain in Joules
     The value returned is the sum of the energy consumed by the CPU in the specified
-    NUMA node
+    package (node is an index in first_package_core)
+    */
+    double get_node_energy(int node, int domain);
+
+    /*
+    Returns the raw value of the energy counter of the specified RAPL domain in the
+    specified package, in units of energy_increment
     */
-    float get_node_energy(int node, int domain);
+    unsigned long long get_node_counter(int node, int domain);
 
     /*
-    Updates the input EnergyAux struct with the last per-node energy readings of the specified RAPL domain in Joules
+    Updates the input EnergyAux struct with the last per-package energy counters of the specified RAPL domain
     */
     void update_aux_data(EnergyAux &data, int domain);
 
     /*
-    Updates the input EnergyAux struct with the last per-node energy readings of RAPL's Package domain in Joules
+    Updates the input EnergyAux struct with the last per-package energy counters of RAPL's Package domain
     */
     void update_package_energy(EnergyAux &data);
 
     /*
-    Updates the input EnergyAux struct with the last per-node energy readings of RAPL's Cores domain in Joules
+    Updates the input EnergyAux struct with the last per-package energy counters of RAPL's Cores domain
     */
     void update_cores_energy(EnergyAux &data);
 
     /*
     Uses the measurements in the two provided EnergyAux structs to compute the average power consumed in Watts.
     */
-    float get_power(const EnergyAux &previous_data, const EnergyAux &current_data);
+    double get_power(const EnergyAux &previous_data, const EnergyAux &current_data);
 
     /*
     Uses the measurements from two EnergyAux structs to update the provided EnergyData struct. Sets the computed power
@@ -125,17 +182,22 @@ namespace rapl_utils
     void update_energy_data(EnergyData &output_data, const EnergyAux &previous_data, const EnergyAux &current_data);
 
     /*
-    Receives two arrays, one with current energy measurements for each NUMA node in
-    the system and another with old ones. Returns the energy consumed between both
-    measurements.
+    Receives two arrays, one with current energy counters for each package in
+    the system and another with old ones. Returns the number of ticks elapsed
+    between both measurements.
 
     This function takes into account possible hardware counter wraparounds. For each
-    NUMA node, the hardware counter that stores the energy consumed will reset back
-    to 0 when it reaches its maximum value (2^32 per specification). Whenever this
-    event happens between the taking of two measurements, it needs to be detected
-    and corrected.
+    package, the hardware counter that stores the energy consumed will reset back
+    to 0 when it reaches its maximum value (2^32 per specification). The counters being
+    32 bit wide, the difference modulo 2^32 corrects a wraparound between the two
+    measurements exactly.
+    */
+    unsigned long long get_counter_diff(const uint32_t *current_counter, const uint32_t *previous_counter);
+
+    /*
+    Returns the energy in Joules consumed between two measurements, see get_counter_diff
     */
-    float get_energy_diff(const float *current_energy, const float *previous_energy);
+    double get_energy_diff(const EnergyAux &current_data, const EnergyAux &previous_data);
 
     /*
     Returns the TDP of the CPU in Watts
@@ -157,6 +219,12 @@ namespace rapl_utils
 
     void read_INTEL_MSR_PP0_ENERGY_STATUS(int core, unsigned long long *output);
 
+    void read_INTEL_MSR_PP1_ENERGY_STATUS(int core, unsigned long long *output);
+
+    void read_INTEL_MSR_DRAM_ENERGY_STATUS(int core, unsigned long long *output);
+
+    void read_INTEL_MSR_PLATFORM_ENERGY_STATUS(int core, unsigned long long *output);
+
     void read_INTEL_MSR_PKG_POWER_INFO(int core, unsigned long long *output);
 
     void read_AMD_MSR_RAPL_POWER_UNIT(int core, unsigned long long *output);
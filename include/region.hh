@@ -0,0 +1,90 @@
+#ifndef REGION_HH
+#define REGION_HH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace power_meter
+{
+    // Accumulated measurements of every instance of a named region
+    struct RegionSummary
+    {
+        std::string name;
+        unsigned long long calls{0};
+        // Total time spent in the region in seconds
+        double time{0};
+        // Energy consumed while in the region in Joules
+        double cpu_energy{0};
+        double gpu_energy{0};
+        // (cpu_energy + gpu_energy) / time
+        double mean_power{0};
+    };
+
+    /*
+    Scoped energy region. Snapshots the RAPL package counters (and the NVML counters, if enabled in
+    init_regions) when constructed and when destroyed, and accumulates the calls, time and energy in
+    between under its name:
+
+        {
+            power_meter::Region region("assemble_matrix");
+            ...
+        }
+
+    Measurements go to a table local to the calling thread, so regions don't contend with each other.
+    Works whether the monitoring loop is running or not. Nested regions each account for the whole
+    energy consumed while they are active, as does any other code running on the machine
+
+    name must outlive the program's regions, string literals are the intended use
+    */
+    class Region
+    {
+    public:
+        explicit Region(const char *name);
+        ~Region();
+
+        Region(const Region &) = delete;
+        Region &operator=(const Region &) = delete;
+
+    private:
+        const char *name;
+        long long start_time;
+        // Position of the counters taken on entry in the calling thread's snapshot stack
+        size_t snapshot;
+    };
+
+    /*
+    Prepares the region counters, called on the first region if not called before. Initializes RAPL
+    if it wasn't, and opens one MSR descriptor per package used by every region. If with_gpus is
+    set, also snapshots the GPUs' counters, which costs an NVML call per GPU on each region entry
+    and exit
+
+    Returns 0 on success. Regions keep measuring time if the counters are not accessible
+    */
+    int init_regions(bool with_gpus = false);
+
+    /*
+    Whether every region entry and exit is also a marker (see markers.hh), so the regions show up
+    as spans in the traces written while the monitoring loop runs. Disabled by default, each
+    marker costs about as much as a mark() call
+    */
+    void set_region_markers(bool enabled);
+
+    /*
+    Merges the tables of every thread and returns the accumulated measurements of each region
+    */
+    std::vector<RegionSummary> get_region_summary();
+
+    /*
+    Writes the region summary as a table
+    */
+    void print_region_summary(FILE *output = stdout);
+
+    /*
+    Clears the measurements of every region
+    */
+    void reset_regions();
+}
+
+#endif
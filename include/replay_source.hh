@@ -0,0 +1,57 @@
+#ifndef REPLAY_SOURCE_HH
+#define REPLAY_SOURCE_HH
+
+#include "energy_source.hh"
+
+#include <filesystem>
+
+namespace power_meter
+{
+    /*
+    Energy source playing back a recorded trace of raw counters. The trace is a text file
+    with a declaration per device followed by one line per reading:
+
+        # device [name] [energy unit in Joules] [counter max, 0 if it never wraps] [domain, optional]
+        ...
+        [timestamp in ns] [counter of device 0] [counter of device 1] ...
+
+    Other lines starting with '#' are ignored. Binary traces written by the monitoring loop
+    (see trace_format.hh) can be played back as well, selecting one of their sources by index
+
+    With a speed of 0 every call to read_counters() returns the next reading of the trace.
+    Otherwise the trace is played back speed times faster than wall-clock time, and the
+    counters are interpolated between the readings surrounding the current playback time.
+    Once the end of the trace is reached its last reading is returned
+    */
+    class ReplaySource : public EnergySource
+    {
+    public:
+        explicit ReplaySource(std::filesystem::path trace_path, double speed = 1.0, unsigned int source_index = 0);
+
+        const char *name() const override { return "Replay"; }
+        int init() override;
+        void read_counters(struct timespec &time, uint64_t *counters) override;
+
+        /*
+        Returns true once every reading of the trace has been played back
+        */
+        bool finished() const;
+
+    private:
+        int load_text_trace();
+        int load_binary_trace();
+
+        std::filesystem::path trace_path;
+        double speed;
+        unsigned int source_index;
+        // Timestamps in ns and counters of every reading, in order
+        std::vector<long long> timestamps;
+        std::vector<uint64_t> trace_counters;
+        // Index of the last reading played back
+        size_t cursor{0};
+        unsigned long long num_readings{0};
+        struct timespec start_time{};
+    };
+}
+
+#endif
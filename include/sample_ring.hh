@@ -0,0 +1,109 @@
+#ifndef SAMPLE_RING_HH
+#define SAMPLE_RING_HH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+
+namespace power_meter
+{
+    /*
+    Lock-free single-producer/single-consumer ring of fixed-size records of 64 bit words
+
+    The producer claims the next free slot, fills it in place and publishes it. The consumer
+    looks at the published records in order and releases them once processed. Neither side
+    ever blocks, a full ring makes claim() fail and the record is counted as dropped
+    */
+    class SampleRing
+    {
+    public:
+        // capacity is rounded up to the next power of 2
+        SampleRing(size_t capacity, size_t record_words)
+            : record_words(record_words)
+        {
+            size_t slots = 1;
+            while (slots < capacity)
+            {
+                slots <<= 1;
+            }
+            mask = slots - 1;
+            records = std::make_unique<uint64_t[]>(slots * record_words);
+        }
+
+        size_t capacity() const { return mask + 1; }
+        size_t record_size() const { return record_words; }
+
+        /*
+        Producer: returns the next free slot, or nullptr if the ring is full. In that case the
+        record is counted as dropped
+        */
+        uint64_t *claim()
+        {
+            size_t head = write_index.load(std::memory_order_relaxed);
+            if (head - cached_read_index > mask)
+            {
+                cached_read_index = read_index.load(std::memory_order_acquire);
+                if (head - cached_read_index > mask)
+                {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+            }
+            return &records[(head & mask) * record_words];
+        }
+
+        /*
+        Producer: makes the slot returned by the last claim() visible to the consumer
+        */
+        void publish()
+        {
+            write_index.store(write_index.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        /*
+        Consumer: returns the number of published records that have not been released yet
+        */
+        size_t available()
+        {
+            cached_write_index = write_index.load(std::memory_order_acquire);
+            return cached_write_index - read_index.load(std::memory_order_relaxed);
+        }
+
+        /*
+        Consumer: returns the i-th unreleased record, i must be lower than available()
+        */
+        const uint64_t *peek(size_t i) const
+        {
+            return &records[((read_index.load(std::memory_order_relaxed) + i) & mask) * record_words];
+        }
+
+        /*
+        Consumer: hands the first count records back to the producer
+        */
+        void release(size_t count)
+        {
+            read_index.store(read_index.load(std::memory_order_relaxed) + count, std::memory_order_release);
+        }
+
+        /*
+        Number of records published and dropped since the ring was created
+        */
+        unsigned long long published_records() const { return write_index.load(std::memory_order_relaxed); }
+        unsigned long long dropped_records() const { return dropped.load(std::memory_order_relaxed); }
+
+    private:
+        size_t record_words;
+        size_t mask;
+        std::unique_ptr<uint64_t[]> records;
+
+        // Each index lives in its own cache line, along with the copy of the other index its owner caches
+        alignas(64) std::atomic<size_t> write_index{0};
+        size_t cached_read_index{0};
+        std::atomic<unsigned long long> dropped{0};
+        alignas(64) std::atomic<size_t> read_index{0};
+        size_t cached_write_index{0};
+    };
+}
+
+#endif
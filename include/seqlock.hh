@@ -0,0 +1,74 @@
+#ifndef SEQLOCK_HH
+#define SEQLOCK_HH
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+namespace power_meter
+{
+    /*
+    Single-writer sequence lock holding a trivially copyable value. The writer never waits, and
+    readers never block it: a reader copies the value and retries only if the writer stored a new
+    one meanwhile. The value is kept in atomic words, so concurrent copies are well defined
+    */
+    template <typename T>
+    class Seqlock
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Seqlock values are copied word by word");
+
+    public:
+        /*
+        Writer: publishes a new value. Must not be called from several threads at once
+        */
+        void store(const T &value)
+        {
+            uint64_t buffer[WORDS]{};
+            memcpy(buffer, &value, sizeof(T));
+            uint64_t sequence = this->sequence.load(std::memory_order_relaxed);
+            // Odd while the words are being written
+            this->sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < WORDS; ++i)
+            {
+                words[i].store(buffer[i], std::memory_order_relaxed);
+            }
+            this->sequence.store(sequence + 2, std::memory_order_release);
+        }
+
+        /*
+        Reader: copies the last value published into value. Returns false, leaving value
+        unchanged, if nothing was published yet
+        */
+        bool load(T &value) const
+        {
+            uint64_t buffer[WORDS];
+            uint64_t before, after;
+            do
+            {
+                before = sequence.load(std::memory_order_acquire);
+                for (size_t i = 0; i < WORDS; ++i)
+                {
+                    buffer[i] = words[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                after = sequence.load(std::memory_order_relaxed);
+            } while (before != after || (before & 1) != 0);
+            if (before == 0)
+            {
+                return false;
+            }
+            memcpy(&value, buffer, sizeof(T));
+            return true;
+        }
+
+    private:
+        static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+        std::atomic<uint64_t> sequence{0};
+        std::atomic<uint64_t> words[WORDS]{};
+    };
+}
+
+#endif
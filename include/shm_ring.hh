@@ -0,0 +1,148 @@
+#ifndef SHM_RING_HH
+#define SHM_RING_HH
+
+#include "output_sink.hh"
+#include "trace_format.hh"
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+/*
+Shared memory ring layout
+
+A publisher (power_meterd, or any process calling set_shm_publishing) creates a POSIX shared
+memory object holding:
+
+    ShmHeader
+    num_sources x (TraceSourceHeader, followed by num_devices x TraceDeviceHeader), as in traces
+    capacity x slot, starting at slots_offset
+
+Each slot holds a sequence word followed by a sample record laid out like the sample records of
+traces (without the record type). The publisher overwrites the oldest slot without waiting for
+readers, the sequence of the slot of record i is 2 * (i + 1) once written and odd while being
+written, so readers detect records overwritten under them. Readers map the object read-only,
+reading a sample takes no system call
+*/
+
+namespace power_meter
+{
+#define POWER_METER_SHM_MAGIC "PMSHM"
+#define POWER_METER_SHM_VERSION 1
+#define POWER_METER_SHM_DEFAULT_NAME "/power_meter"
+
+    enum SHM_STATE : uint32_t
+    {
+        SHM_RUNNING = 1,
+        SHM_STOPPED = 2
+    };
+
+    struct ShmHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t num_sources;
+        // Offset in bytes of the slots, and size of the whole object
+        uint64_t slots_offset;
+        uint64_t size;
+        // Number of slots, a power of 2, and 64 bit words per slot including its sequence
+        uint64_t capacity;
+        uint64_t slot_words;
+        // 0 if the interval is variable (adaptive sampling)
+        uint32_t sampling_interval_us;
+        // Process id of the publisher
+        int32_t pid;
+        // SHM_STATE, set to SHM_STOPPED when the publisher stops
+        std::atomic<uint32_t> state;
+        uint32_t reserved;
+        // Number of records published so far, record i is in slot i % capacity
+        std::atomic<uint64_t> published;
+    };
+
+    /*
+    Creates the shared memory ring and publishes the sample records of the monitoring loop
+    */
+    class ShmPublisher
+    {
+    public:
+        ~ShmPublisher() { close(); }
+
+        /*
+        Creates (or replaces) the shared memory object name, readable by every user. Returns false
+        if it can't be created
+        */
+        bool open(const std::string &name, const std::vector<SourceInfo> &sources, size_t capacity,
+                  uint32_t sampling_interval_us);
+
+        bool is_open() const { return header != nullptr; }
+
+        /*
+        Publishes a sample record. Never blocks
+        */
+        void publish(const uint64_t *record);
+
+        /*
+        Marks the ring as stopped and removes the shared memory object, clients that mapped it keep
+        their mapping
+        */
+        void close();
+
+    private:
+        std::string name;
+        ShmHeader *header{nullptr};
+        std::atomic<uint64_t> *slots{nullptr};
+        uint64_t mask{0};
+        size_t record_words{0};
+        uint64_t next{0};
+    };
+
+    /*
+    Reads the samples published by a ShmPublisher of another (or the same) process, through a
+    read-only mapping. Readings are copied out of the ring, validated by the slot's sequence
+    */
+    class ShmClient
+    {
+    public:
+        ~ShmClient() { close(); }
+
+        /*
+        Maps the shared memory object name. Returns false if it doesn't exist or is not a
+        compatible ring
+        */
+        bool open(const std::string &name = POWER_METER_SHM_DEFAULT_NAME);
+
+        void close();
+
+        const std::vector<SourceInfo> &sources() const { return source_info; }
+        uint32_t sampling_interval_us() const { return header->sampling_interval_us; }
+        uint64_t capacity() const { return header->capacity; }
+
+        // Number of records published so far
+        uint64_t published() const { return header->published.load(std::memory_order_acquire); }
+
+        // Whether the publisher is still running
+        bool running() const { return header->state.load(std::memory_order_acquire) == SHM_RUNNING; }
+
+        /*
+        Reads record index into readings (one per source). Returns false if it wasn't published
+        yet or has already been overwritten
+        */
+        bool read(uint64_t index, std::vector<SourceReading> &readings);
+
+        /*
+        Reads the latest record. Returns false if none was published yet
+        */
+        bool latest(std::vector<SourceReading> &readings);
+
+    private:
+        void *mapping{nullptr};
+        size_t mapping_size{0};
+        const ShmHeader *header{nullptr};
+        const std::atomic<uint64_t> *slots{nullptr};
+        std::vector<SourceInfo> source_info;
+        std::vector<uint64_t> record;
+    };
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef SYNTHETIC_SOURCE_HH
+#define SYNTHETIC_SOURCE_HH
+
+#include "energy_source.hh"
+
+#include <string>
+
+namespace power_meter
+{
+    // Power draw over time of a simulated device
+    struct PowerProfile
+    {
+        enum Shape
+        {
+            CONSTANT, // base_power
+            SQUARE,   // base_power + amplitude for the first half of each period, base_power - amplitude for the second
+            SINE,     // base_power + amplitude * sin(2 pi t / period)
+            SAWTOOTH  // Rises linearly from base_power - amplitude to base_power + amplitude over each period
+        };
+        Shape shape{CONSTANT};
+        // Power in Watts
+        double base_power{100};
+        double amplitude{0};
+        // Period in seconds
+        double period{1};
+        // Domain reported for the simulated device
+        std::string domain{"Synthetic"};
+
+        /*
+        Returns the energy in Joules consumed between the start of the simulation and t seconds
+        */
+        double energy_at(double t) const;
+    };
+
+    /*
+    Energy source generating counters from the configured power profiles, one device per profile.
+    Counters are quantized to energy_unit and wrap around at 2^counter_bits like hardware counters do
+
+    If time_step_ns is not 0, every reading advances a virtual clock by exactly that step instead of
+    using the system clock, so the sequence of readings is fully deterministic
+    */
+    class SyntheticSource : public EnergySource
+    {
+    public:
+        SyntheticSource(std::vector<PowerProfile> profiles, double energy_unit = 1.0 / (1 << 14),
+                        unsigned int counter_bits = 32, long long time_step_ns = 0,
+                        uint64_t initial_counter = 0);
+
+        const char *name() const override { return "Synthetic"; }
+        int init() override;
+        void read_counters(struct timespec &time, uint64_t *counters) override;
+        // The peak of the device's profile
+        double max_power(unsigned int device) const override;
+
+    private:
+        std::vector<PowerProfile> profiles;
+        double energy_unit;
+        unsigned int counter_bits;
+        long long time_step_ns;
+        uint64_t initial_counter;
+        struct timespec start_time{};
+        unsigned long long num_readings{0};
+    };
+}
+
+#endif
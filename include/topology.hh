@@ -0,0 +1,74 @@
+#ifndef TOPOLOGY_HH
+#define TOPOLOGY_HH
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace topology
+{
+    // Placement of an online logical CPU
+    struct Cpu
+    {
+        int id;
+        int package;
+        int die;
+        int core;
+        // Whether this is the first SMT thread of its core, per-core counters are read on it
+        bool first_thread;
+    };
+
+    // A die of a package, most packages have a single one
+    struct Die
+    {
+        int id;
+        std::vector<int> cpus;
+    };
+
+    // A physical package (socket), which may span several NUMA nodes (SNC, NPS)
+    struct Package
+    {
+        int id;
+        std::vector<Die> dies;
+        std::vector<int> cpus;
+    };
+
+    /*
+    CPU topology of the machine: socket -> die -> core. Packages, dies and CPUs are sorted
+    by id, and the first CPU of each of them is the lowest numbered one
+    */
+    struct Topology
+    {
+        std::vector<Cpu> cpus;
+        std::vector<Package> packages;
+        int numa_nodes{1};
+        // Highest online CPU id + 1
+        int max_cpus{0};
+    };
+
+    /*
+    Root of the sysfs tree the topology is read from, /sys/devices/system by default. Changing
+    it discards the cached topology, e.g. to read a fake tree
+    */
+    extern std::filesystem::path sysfs_root;
+    void set_sysfs_root(std::string root);
+
+    /*
+    Returns the topology of the machine, discovered on the first call and cached. The reference
+    stays valid until reset() or set_sysfs_root() is called
+    */
+    const Topology &get_topology();
+
+    /*
+    Discards the cached topology, the next call to get_topology() discovers it again
+    */
+    void reset();
+
+    /*
+    Parses a sysfs CPU or node list, e.g. "0-3,8,10-11", into the ids it contains.
+    Malformed entries are ignored
+    */
+    std::vector<int> parse_cpulist(const std::string &list);
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef TRACE_ANALYSIS_HH
+#define TRACE_ANALYSIS_HH
+
+#include "trace_format.hh"
+
+#include <stdint.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/*
+Analysis of binary traces after a run, in the power_meter_analysis library
+
+Traces are mapped in memory and read in place: the reductions gather the counters of a chunk of
+samples at a time into buffers that stay in the L1 cache, and reduce them with vectorized loops.
+Time ranges are in ns on the CLOCK_MONOTONIC clock of the samples, [0, UINT64_MAX) covers a
+whole trace
+
+The power of an interval is the energy consumed between two consecutive samples over the time
+between their source's timestamps. For sources with per-device timestamps (e.g. NvmlSource) each
+device's energy is taken over the time between its own readings, as in the CSV output, and the
+times of a series are the mean time of its devices' readings. Interpolations within intervals,
+in energy_between and resample, are done per device
+*/
+
+namespace power_meter
+{
+    // Devices of a source whose energy is added up, e.g. the packages of the CPU
+    struct PowerSeries
+    {
+        size_t source{0};
+        std::vector<size_t> devices;
+    };
+
+    /*
+    Read-only view of a plain binary trace mapped in memory. Opening only reads the header and
+    the type of every record, the samples are read from the mapping when used. Compressed traces
+    must be decompressed first (see decompress_trace)
+    */
+    class MappedTrace
+    {
+    public:
+        MappedTrace() = default;
+        ~MappedTrace() { close(); }
+        MappedTrace(const MappedTrace &) = delete;
+        MappedTrace &operator=(const MappedTrace &) = delete;
+
+        /*
+        Maps the trace. Returns false if it can't be mapped or is not a plain trace
+        */
+        bool open(const std::filesystem::path &path);
+        void close();
+
+        const TraceInfo &info() const { return trace_info; }
+        size_t num_samples() const { return samples; }
+        // Length of a sample record in 64 bit words, including its type
+        size_t stride() const { return record_size; }
+        // The markers of the trace, in time order
+        const std::vector<Marker> &markers() const { return marker_list; }
+
+        /*
+        Returns the record of a sample in the mapping, its words are laid out as described in
+        trace_format.hh
+        */
+        const uint64_t *record(size_t sample) const;
+
+        /*
+        Returns the number of sample records following a sample's in the mapping without a
+        marker in between, itself included
+        */
+        size_t contiguous(size_t sample) const;
+
+        // Position of a source's timestamp in a record, followed by its devices' counters
+        size_t source_word(size_t source) const { return source_words[source]; }
+        uint64_t time(size_t source, size_t sample) const { return record(sample)[source_words[source]]; }
+
+        /*
+        Returns the first sample whose reading of the source was taken at or after time_ns,
+        num_samples() if none was
+        */
+        size_t find(uint64_t time_ns, size_t source = 0) const;
+
+        /*
+        Returns the series of the devices of a domain of the source with the given label, e.g.
+        ("cpu", "Package"), every device of the source if domain is empty. The series has no
+        devices if there are none
+        */
+        PowerSeries series(const std::string &label, const std::string &domain = "") const;
+
+    private:
+        // Samples stored one after the other between markers
+        struct Segment
+        {
+            size_t first_sample;
+            const uint64_t *records;
+        };
+
+        int fd{-1};
+        void *mapping{nullptr};
+        size_t mapping_size{0};
+        TraceInfo trace_info;
+        size_t samples{0};
+        size_t record_size{0};
+        std::vector<size_t> source_words;
+        std::vector<Segment> segments;
+        std::vector<Marker> marker_list;
+    };
+
+    struct PowerStats
+    {
+        // Energy in Joules consumed over the intervals and their length in seconds
+        double energy{0};
+        double duration{0};
+        // In Watts
+        double mean_power{0};
+        double peak_power{0};
+        // End of the interval of peak power
+        uint64_t peak_time_ns{0};
+        // Energy-delay product, energy * duration
+        double edp{0};
+        size_t intervals{0};
+    };
+
+    /*
+    Energy, mean and peak power of a series over the intervals between its samples taken within
+    [t0, t1). The energy is added up in counter ticks, so it's exact whatever the length of the
+    range
+    */
+    PowerStats power_stats(const MappedTrace &trace, const PowerSeries &series, uint64_t t0 = 0, uint64_t t1 = UINT64_MAX);
+
+    /*
+    Energy in Joules consumed by a series between t0 and t1, the parts of the intervals cut by
+    t0 and t1 interpolated linearly. For ranges shorter than the sampling interval, e.g. phases
+    */
+    double energy_between(const MappedTrace &trace, const PowerSeries &series, uint64_t t0, uint64_t t1);
+
+    // Power of every interval of a range, time_ns being the end of each interval
+    struct PowerCurve
+    {
+        std::vector<uint64_t> time_ns;
+        std::vector<double> power;
+    };
+
+    void power_curve(const MappedTrace &trace, const PowerSeries &series, PowerCurve &curve, uint64_t t0 = 0,
+                     uint64_t t1 = UINT64_MAX);
+
+    /*
+    Highest power of the intervals that ended within window_ns before the end of each interval
+    of the curve, e.g. the peaks a power cap reacting over window_ns would see. Linear in the
+    length of the curve whatever the window
+    */
+    void sliding_window_max(const PowerCurve &curve, uint64_t window_ns, std::vector<double> &output);
+
+    /*
+    Time spent by a series in each power bin of width (max_power - min_power) / bins, over the
+    intervals of [t0, t1). Intervals below min_power go to the first bin, above max_power to the
+    last one
+    */
+    struct PowerHistogram
+    {
+        double min_power{0};
+        double bin_width{0};
+        std::vector<double> seconds;
+        std::vector<uint64_t> intervals;
+    };
+
+    PowerHistogram power_histogram(const MappedTrace &trace, const PowerSeries &series, double min_power,
+                                   double max_power, size_t bins, uint64_t t0 = 0, uint64_t t1 = UINT64_MAX);
+
+    /*
+    Returns the times from t0 to t1 every step_ns, t1 included if it falls on the grid
+    */
+    std::vector<uint64_t> time_grid(uint64_t t0, uint64_t t1, uint64_t step_ns);
+
+    /*
+    Mean power of a series over each interval of a grid ([grid[k], grid[k + 1]), power gets
+    grid.size() - 1 values), from its energy interpolated linearly between samples. Resampling
+    preserves the energy, so the series of sources sampled at different times (e.g. the CPU and
+    the GPUs) can be added up on a common grid. Intervals outside the trace get 0
+    */
+    void resample(const MappedTrace &trace, const PowerSeries &series, const std::vector<uint64_t> &grid,
+                  std::vector<double> &power);
+
+    // Accumulated measurements of every instance of a phase or region
+    struct PhaseStats
+    {
+        std::string name;
+        size_t calls{0};
+        double duration{0};
+        double energy{0};
+        double mean_power{0};
+    };
+
+    /*
+    Energy and mean power of a series during each phase (begin_phase / end_phase) and region
+    (with set_region_markers) of the trace's markers, with energy_between. Nested instances of a
+    name on the same thread are accounted once, unmatched begins and ends are ignored
+    */
+    std::vector<PhaseStats> phase_stats(const MappedTrace &trace, const PowerSeries &series);
+}
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef TRACE_COMPRESSION_HH
+#define TRACE_COMPRESSION_HH
+
+#include "output_sink.hh"
+
+#include <stdint.h>
+#include <filesystem>
+#include <vector>
+
+/*
+Compressed trace encoding
+
+A compressed trace has the header of a binary trace (see trace_format.hh) with the
+POWER_METER_COMPRESSED_TRACE_MAGIC magic, followed by blocks of records:
+
+    TraceBlockHeader, followed by size bytes of encoded records
+    ...
+    TraceBlockHeader with the index magic, followed by num_records x TraceIndexEntry
+    TraceIndexFooter
+
+Every block is decoded on its own: the encoder starts from zero at each block. A record is its
+type as a varint followed, for samples, by each source's reading:
+
+    zigzag varint of the change of the interval since the previous sample, of the timestamp for
+    the first sample of the block (the timestamps of periodic samples take 1 or 2 bytes)
+    zigzag varint of the change of each device's counter since the previous sample, modulo 2^64
+    zigzag varint of each device's time minus the source's timestamp, with per-device timestamps
+
+and for markers: the zigzag varint of the marker's time minus the previous sample's, its type,
+its thread and the length of its name as varints, and the name. Each block is written to the
+file at once when complete, so a trace cut short (e.g. by a crash) loses its last block at most,
+and the index, which only makes seeking faster
+*/
+
+#define POWER_METER_COMPRESSED_TRACE_MAGIC "PMTRACZ"
+// "PMBK" and "PMIX" in the native byte order
+#define TRACE_BLOCK_MAGIC 0x4b424d50U
+#define TRACE_INDEX_MAGIC 0x58494d50U
+#define TRACE_INDEX_FOOTER_MAGIC "PMINDEX"
+// Records per block when not set
+#define TRACE_BLOCK_RECORDS 4096
+
+namespace power_meter
+{
+    struct TraceBlockHeader
+    {
+        // TRACE_BLOCK_MAGIC, TRACE_INDEX_MAGIC for the index
+        uint32_t magic;
+        // Size in bytes of the encoded records following the header
+        uint32_t size;
+        uint32_t num_records;
+        uint32_t num_samples;
+        // Time of the first and last sample of the block in ns, 0 if it has none
+        uint64_t first_time_ns;
+        uint64_t last_time_ns;
+    };
+
+    struct TraceIndexEntry
+    {
+        // Offset of the block's header in the file
+        uint64_t offset;
+        // Number of samples in the blocks before it
+        uint64_t first_sample;
+        uint64_t first_time_ns;
+        uint64_t last_time_ns;
+    };
+
+    struct TraceIndexFooter
+    {
+        // Offset of the index's block header in the file
+        uint64_t index_offset;
+        char magic[8];
+    };
+
+    inline uint64_t zigzag_encode(int64_t value)
+    {
+        return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    }
+
+    inline int64_t zigzag_decode(uint64_t value)
+    {
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+
+    /*
+    Writes value as a LEB128 varint at output, which must have room for 10 bytes. Returns the
+    position after it
+    */
+    inline unsigned char *put_varint(unsigned char *output, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            *output++ = (unsigned char)(value | 0x80);
+            value >>= 7;
+        }
+        *output++ = (unsigned char)value;
+        return output;
+    }
+
+    /*
+    Reads a varint from input into value. Returns the position after it, nullptr if it doesn't
+    end before end
+    */
+    inline const unsigned char *get_varint(const unsigned char *input, const unsigned char *end, uint64_t &value)
+    {
+        value = 0;
+        for (unsigned int shift = 0; input < end && shift < 64; shift += 7)
+        {
+            unsigned char byte = *input++;
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if (byte < 0x80)
+            {
+                return input;
+            }
+        }
+        return nullptr;
+    }
+
+    /*
+    Encodes the records of a block
+    */
+    class TraceBlockEncoder
+    {
+    public:
+        void begin(const std::vector<SourceInfo> &sources);
+
+        void add_sample(const SourceReading *readings);
+        void add_marker(const Marker &marker);
+
+        /*
+        Returns the header of the block and its encoded records
+        */
+        TraceBlockHeader header() const;
+        const unsigned char *data() const { return buffer.data(); }
+        size_t size() const { return used; }
+        uint32_t records() const { return num_records; }
+
+        /*
+        Empties the block, the next record is encoded from zero
+        */
+        void reset();
+
+    private:
+        // Grows the buffer to hold size more bytes
+        void reserve(size_t size);
+
+        std::vector<unsigned int> source_devices;
+        std::vector<bool> source_device_times;
+        // Largest encoded size of a sample
+        size_t max_sample_size{0};
+        std::vector<unsigned char> buffer;
+        size_t used{0};
+        uint32_t num_records{0};
+        uint32_t num_samples{0};
+        uint64_t first_time_ns{0};
+        uint64_t last_time_ns{0};
+        // Previous timestamp and interval of each source, previous counters of every device
+        std::vector<uint64_t> previous_time;
+        std::vector<int64_t> previous_interval;
+        std::vector<uint64_t> previous_counters;
+    };
+
+    /*
+    Decodes the records of a block
+    */
+    class TraceBlockDecoder
+    {
+    public:
+        void begin(const std::vector<SourceInfo> &sources);
+
+        /*
+        Starts decoding a block, data must stay valid until its records are read
+        */
+        void load(const unsigned char *data, size_t size, uint32_t num_records);
+
+        /*
+        Decodes the next record, a sample into readings (allocated with allocate_readings) or a
+        marker into marker. Returns its type, 0 at the end of the block or if it's corrupt
+        */
+        uint64_t next_record(std::vector<SourceReading> &readings, Marker &marker);
+
+    private:
+        std::vector<SourceInfo> sources;
+        const unsigned char *position{nullptr};
+        const unsigned char *end{nullptr};
+        uint32_t remaining{0};
+        bool first_sample{true};
+        std::vector<uint64_t> previous_time;
+        std::vector<int64_t> previous_interval;
+        std::vector<std::vector<uint64_t>> previous_counters;
+    };
+
+    /*
+    Reads the block index of a compressed trace, from its trailing index or, for a trace cut
+    short, by walking its block headers. Returns false if the file isn't a compressed trace
+    */
+    bool read_trace_index(const std::filesystem::path &path, std::vector<TraceIndexEntry> &index);
+
+    /*
+    Rewrites a binary trace with the other encoding: compress_trace writes a compressed trace
+    from any trace, decompress_trace a plain one. Returns false if the input can't be read or
+    the output created
+    */
+    bool compress_trace(const std::filesystem::path &input, const std::filesystem::path &output,
+                        uint32_t block_records = TRACE_BLOCK_RECORDS);
+    bool decompress_trace(const std::filesystem::path &input, const std::filesystem::path &output);
+}
+
+#endif
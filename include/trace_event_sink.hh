@@ -0,0 +1,113 @@
+#ifndef TRACE_EVENT_SINK_HH
+#define TRACE_EVENT_SINK_HH
+
+#include "output_sink.hh"
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace power_meter
+{
+    /*
+    Counter tracks of the timeline outputs: the power and total energy of each domain of each
+    source ("cpu Package power", "cpu Package energy"), and the power of each device of the
+    domains with several devices ("gpu gpu0 power")
+    */
+    struct CounterTrack
+    {
+        std::string name;
+        size_t source;
+        // Index into the source's domains
+        unsigned int domain;
+        // Device whose power the track holds, -1 for the series of the domain
+        int device;
+        // Whether the track holds the total energy (J) rather than the power (W)
+        bool energy;
+    };
+
+    /*
+    Writes the samples as a Chrome trace-event JSON file, opened by chrome://tracing and
+    ui.perfetto.dev: a counter event per counter track and sample, and the application markers
+    as instants and slices (B/E events) on one track per marking thread. Events are written as
+    they come, the file is valid once the sink ends
+
+    Timestamps are the CLOCK_MONOTONIC time of the samples in microseconds, the clock of
+    perf record -k CLOCK_MONOTONIC, and the events belong to the measuring process
+    */
+    class ChromeTraceSink : public OutputSink
+    {
+    public:
+        explicit ChromeTraceSink(std::filesystem::path path) : path(std::move(path)) {}
+        ~ChromeTraceSink() override { end(); }
+
+        void begin(const std::vector<SourceInfo> &sources) override;
+        void write_sample(const SourceReading *readings) override;
+        void write_marker(const Marker &marker) override;
+        void flush() override;
+        void end() override;
+
+    private:
+        // Writes the thread_name metadata of a marking thread on its first marker
+        void add_thread(uint32_t thread);
+
+        std::filesystem::path path;
+        FILE *file{nullptr};
+        pid_t pid{0};
+        DomainSeries series;
+        std::vector<CounterTrack> tracks;
+        // Whether each marking thread has been named
+        std::vector<bool> threads;
+    };
+
+    /*
+    Writes the samples as a Perfetto trace (the streaming protobuf format of
+    perfetto::protos::Trace), opened by ui.perfetto.dev and trace_processor: a counter track per
+    counter track of the sources and a slice track per marking thread, all under a process track
+    of the measuring process. Every packet is written as it comes, so the trace stays readable
+    up to its last complete packet if the run is interrupted
+
+    Timestamps are CLOCK_MONOTONIC in ns, and the first packet holds a snapshot of the
+    monotonic, realtime and boottime clocks so trace_processor aligns the counters with the
+    other traces of the machine (perf record -k CLOCK_MONOTONIC, traced)
+    */
+    class PerfettoSink : public OutputSink
+    {
+    public:
+        explicit PerfettoSink(std::filesystem::path path) : path(std::move(path)) {}
+        ~PerfettoSink() override { end(); }
+
+        void begin(const std::vector<SourceInfo> &sources) override;
+        void write_sample(const SourceReading *readings) override;
+        void write_marker(const Marker &marker) override;
+        void flush() override;
+        void end() override;
+
+    private:
+        // Writes the packet being built as a field of the Trace message
+        void write_packet();
+        // Starts a packet timestamped at time_ns
+        void begin_packet(uint64_t time_ns);
+        // Describes a child track of the process, a counter track in the given unit or a slice
+        // track if unit is null
+        void write_track_descriptor(uint64_t uuid, const std::string &name, const char *unit);
+        // Returns the track of a marking thread, described on its first marker
+        uint64_t thread_track(uint32_t thread);
+
+        std::filesystem::path path;
+        FILE *file{nullptr};
+        DomainSeries series;
+        std::vector<CounterTrack> tracks;
+        // Tracks of the process, its counters and its marking threads (0 until described)
+        uint64_t process_uuid{0};
+        std::vector<uint64_t> thread_uuids;
+        // Encoding buffers, reused across packets
+        std::string packet;
+        std::string message;
+        std::string nested;
+    };
+}
+
+#endif
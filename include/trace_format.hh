@@ -0,0 +1,263 @@
+#ifndef TRACE_FORMAT_HH
+#define TRACE_FORMAT_HH
+
+#include "output_sink.hh"
+#include "trace_compression.hh"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+/*
+Binary trace format
+
+All values are stored in the machine's native byte order. A trace starts with a fixed header:
+
+    TraceFileHeader
+    num_sources x (TraceSourceHeader, followed by num_devices x TraceDeviceHeader)
+
+followed by fixed-width records. Each record starts with a 64 bit record type. A sample record
+holds, for each source in header order, the CLOCK_MONOTONIC timestamp of its reading in ns followed by the raw
+counter of each of its devices, all as 64 bit values. Sources flagged with TRACE_SOURCE_DEVICE_TIMES
+(version 3) add the timestamp of each device's reading after the counters. Marker records
+(version 4) hold an application marker (see markers.hh) and are interleaved with the samples
+in time order
+
+Traces with the POWER_METER_COMPRESSED_TRACE_MAGIC magic hold the same records delta and varint
+encoded in blocks instead, see trace_compression.hh
+*/
+
+namespace power_meter
+{
+#define POWER_METER_TRACE_MAGIC "PMTRACE"
+#define POWER_METER_TRACE_VERSION 4
+#define POWER_METER_TRACE_NAME_SIZE 32
+
+    enum TRACE_RECORD_TYPE : uint64_t
+    {
+        TRACE_RECORD_SAMPLE = 1,
+        TRACE_RECORD_MARKER = 2
+    };
+
+    enum TRACE_SOURCE_FLAGS : uint32_t
+    {
+        TRACE_SOURCE_DEVICE_TIMES = 1
+    };
+
+    struct TraceFileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        // Size in bytes of the whole header, including source and device headers
+        uint32_t header_size;
+        uint32_t num_sources;
+        // 0 if the interval was variable (adaptive sampling)
+        uint32_t sampling_interval_us;
+        // RAPL energy unit of the machine in Joules
+        double energy_increment;
+        // Machine topology
+        int32_t vendor_id;
+        uint32_t numa_nodes;
+        uint32_t numcores;
+        uint32_t num_gpus;
+    };
+
+    struct TraceSourceHeader
+    {
+        char label[POWER_METER_TRACE_NAME_SIZE];
+        char name[POWER_METER_TRACE_NAME_SIZE];
+        uint32_t num_devices;
+        // TRACE_SOURCE_FLAGS, reserved (0) before version 3
+        uint32_t flags;
+    };
+
+    struct TraceDeviceHeader
+    {
+        char name[POWER_METER_TRACE_NAME_SIZE];
+        double energy_unit;
+        uint64_t counter_max;
+        // Added in version 2, version 1 device headers end before it
+        char domain[POWER_METER_TRACE_NAME_SIZE];
+    };
+
+    /*
+    Conversions between the description of a source and its headers, also used by the shared
+    memory ring. Names longer than POWER_METER_TRACE_NAME_SIZE - 1 are truncated
+    */
+    TraceSourceHeader make_source_header(const SourceInfo &source);
+    TraceDeviceHeader make_device_header(const DeviceInfo &device);
+    SourceInfo parse_source_header(const TraceSourceHeader &header, uint32_t version);
+    DeviceInfo parse_device_header(const TraceDeviceHeader &header);
+
+    /*
+    Writes the whole of data to fd, retrying after short and interrupted writes, also used by the
+    pyramid. Returns false if the file can't be written
+    */
+    bool write_all(int fd, const void *data, size_t size);
+
+    // Contents of a trace's header
+    struct TraceInfo
+    {
+        uint32_t sampling_interval_us{0};
+        double energy_increment{0};
+        int32_t vendor_id{-1};
+        uint32_t numa_nodes{0};
+        uint32_t numcores{0};
+        uint32_t num_gpus{0};
+        std::vector<SourceInfo> sources;
+
+        /*
+        Returns the size in bytes of a sample record, including its record type
+        */
+        size_t sample_record_size() const;
+    };
+
+    class PyramidWriter;
+
+    /*
+    Writes traces, buffering records in memory and writing them to the file in large blocks.
+    Compressed traces are written a whole block of records at a time
+    */
+    class TraceWriter
+    {
+    public:
+        explicit TraceWriter(size_t buffer_size = 1 << 20);
+        ~TraceWriter();
+
+        /*
+        Creates the trace file and writes its header, of a compressed trace with block_records
+        records per block if compressed is set. Returns false if the file can't be created
+        */
+        bool open(const std::filesystem::path &path, const TraceInfo &info, bool compressed = false,
+                  uint32_t block_records = TRACE_BLOCK_RECORDS);
+
+        /*
+        Appends a sample record with one reading per source
+        */
+        void write_sample(const SourceReading *readings);
+
+        /*
+        Appends a marker record
+        */
+        void write_marker(const Marker &marker);
+
+        /*
+        Also builds the summary pyramid of the samples written next, to path (see
+        trace_pyramid.hh). Must be called after open, returns false if it can't be created
+        */
+        bool open_pyramid(const std::filesystem::path &path);
+
+        /*
+        Writes the buffered records to the file, the records of a compressed trace's current
+        block are written once it's complete
+        */
+        void flush();
+
+        /*
+        Writes the remaining records, and the index of a compressed trace. Closes the pyramid
+        */
+        void close();
+
+    private:
+        void append(const void *data, size_t size);
+        // Writes data to the file, reporting the first failure only
+        void write_file(const void *data, size_t size);
+        // Appends the compressed block and writes it to the file
+        void write_block();
+
+        int fd{-1};
+        // Set on the first failed write, the rest of the trace is dropped
+        bool write_failed{false};
+        std::vector<unsigned char> buffer;
+        size_t buffered{0};
+        // Bytes appended since the file was created
+        uint64_t offset{0};
+        std::vector<SourceInfo> sources;
+        std::vector<unsigned int> source_devices;
+        std::vector<bool> source_device_times;
+
+        bool compressed{false};
+        uint32_t block_records{TRACE_BLOCK_RECORDS};
+        TraceBlockEncoder encoder;
+        std::vector<TraceIndexEntry> index;
+        uint64_t samples{0};
+
+        std::unique_ptr<PyramidWriter> pyramid;
+    };
+
+    /*
+    Sequentially reads the header and records of a trace, plain or compressed
+    */
+    class TraceReader
+    {
+    public:
+        ~TraceReader();
+
+        /*
+        Opens the trace and reads its header. Returns false if the file can't be opened or is not a valid trace
+        */
+        bool open(const std::filesystem::path &path);
+
+        const TraceInfo &info() const { return trace_info; }
+
+        /*
+        Reads the next sample into readings, which holds one reading per source, skipping the
+        markers. Returns false at the end of the trace
+        */
+        bool next(std::vector<SourceReading> &readings);
+
+        /*
+        Reads the next record, a sample into readings or a marker into marker. Returns its type,
+        0 at the end of the trace
+        */
+        uint64_t next_record(std::vector<SourceReading> &readings, Marker &marker);
+
+        bool compressed() const { return compressed_trace; }
+
+        /*
+        Compressed traces: continues reading at the block of the entry, see read_trace_index
+        */
+        bool seek(const TraceIndexEntry &entry);
+
+        void close();
+
+    private:
+        // Reads the next block of a compressed trace, returns false at the end of the trace
+        bool load_block();
+
+        FILE *file{nullptr};
+        TraceInfo trace_info;
+        std::vector<uint64_t> record;
+        bool compressed_trace{false};
+        std::vector<unsigned char> block;
+        TraceBlockDecoder decoder;
+    };
+
+    /*
+    Writes every sample to a binary trace, compressed if compressed is set, and its summary
+    pyramid to pyramid_path(path) if pyramid is set
+    */
+    class BinarySink : public OutputSink
+    {
+    public:
+        // info holds the machine description written to the header, its sources are filled in begin()
+        BinarySink(std::filesystem::path path, TraceInfo info, bool compressed = false, bool pyramid = false)
+            : path(std::move(path)), info(std::move(info)), compressed(compressed), pyramid(pyramid) {}
+
+        void begin(const std::vector<SourceInfo> &sources) override;
+        void write_sample(const SourceReading *readings) override;
+        void write_marker(const Marker &marker) override;
+        void end() override;
+
+    private:
+        std::filesystem::path path;
+        TraceInfo info;
+        bool compressed;
+        bool pyramid;
+        TraceWriter writer;
+    };
+}
+
+#endif
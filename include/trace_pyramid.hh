@@ -0,0 +1,229 @@
+#ifndef TRACE_PYRAMID_HH
+#define TRACE_PYRAMID_HH
+
+#include "output_sink.hh"
+#include "trace_format.hh"
+
+#include <stdint.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/*
+Summary pyramid of a trace
+
+A sidecar file next to a binary trace (see pyramid_path) summarizing the power of every domain
+of every source at decreasing resolutions. Level 0 has a bucket per PYRAMID_FANOUT intervals
+between samples, and every level above it a bucket per PYRAMID_FANOUT buckets of the level below.
+A bucket holds the lowest and highest power of its intervals, their energy and their number, so
+the power envelope of any range at any zoom is read from a few buckets of a single level instead
+of the whole trace. The pyramid is built as the samples are written, each level's buckets are
+written to the file in chunks once complete:
+
+    PyramidFileHeader
+    num_series x PyramidSeriesHeader
+    PyramidChunkHeader, followed by num_buckets x PyramidBucket
+    ...
+    PyramidChunkHeader with the index magic, followed by num_buckets x PyramidIndexEntry
+    TraceIndexFooter with the pyramid's footer magic
+
+Every chunk but the last of a level holds chunk_buckets buckets. When the pyramid is closed the
+last, partial bucket of every level is written too. A pyramid cut short (e.g. by a crash) keeps
+its complete chunks, found by walking their headers
+*/
+
+#define POWER_METER_PYRAMID_MAGIC "PMPYRMD"
+#define POWER_METER_PYRAMID_VERSION 1
+// "PMCK" and "PMPX" in the native byte order
+#define PYRAMID_CHUNK_MAGIC 0x4b434d50U
+#define PYRAMID_INDEX_MAGIC 0x58504d50U
+#define PYRAMID_INDEX_FOOTER_MAGIC "PMPYIDX"
+// Buckets of a level per bucket of the level above it
+#define PYRAMID_FANOUT 10
+// 10^16 intervals, years at 1 ms
+#define PYRAMID_MAX_LEVELS 16
+#define PYRAMID_CHUNK_BUCKETS 1024
+
+namespace power_meter
+{
+    struct PyramidFileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t fanout;
+        uint32_t num_series;
+        uint32_t chunk_buckets;
+    };
+
+    // A domain of a source, its devices added up
+    struct PyramidSeriesHeader
+    {
+        char label[POWER_METER_TRACE_NAME_SIZE];
+        char domain[POWER_METER_TRACE_NAME_SIZE];
+        // Position of the source in the trace
+        uint32_t source;
+        uint32_t num_devices;
+    };
+
+    struct PyramidBucket
+    {
+        // Start of the first interval and end of the last one, in ns
+        uint64_t first_time_ns;
+        uint64_t last_time_ns;
+        // In Watts
+        double min_power;
+        double max_power;
+        // In Joules
+        double energy;
+        // Number of intervals between samples
+        uint64_t count;
+    };
+
+    struct PyramidChunkHeader
+    {
+        // PYRAMID_CHUNK_MAGIC, PYRAMID_INDEX_MAGIC for the index
+        uint32_t magic;
+        uint32_t series;
+        uint32_t level;
+        uint32_t num_buckets;
+    };
+
+    struct PyramidIndexEntry
+    {
+        // Offset of the chunk's header in the file
+        uint64_t offset;
+        uint32_t series;
+        uint32_t level;
+        uint32_t num_buckets;
+        uint32_t reserved;
+    };
+
+    /*
+    Returns the path of the pyramid of a trace, the trace's path with .pyramid appended
+    */
+    std::filesystem::path pyramid_path(const std::filesystem::path &trace_path);
+
+    /*
+    Builds the pyramid of the samples of a trace as they are written, see TraceWriter::open_pyramid
+    */
+    class PyramidWriter
+    {
+    public:
+        ~PyramidWriter();
+
+        /*
+        Creates the pyramid file, with a series per domain of each source. Returns false if it
+        can't be created
+        */
+        bool open(const std::filesystem::path &path, const std::vector<SourceInfo> &sources);
+        bool is_open() const { return fd >= 0; }
+
+        void add_sample(const SourceReading *readings);
+
+        /*
+        Writes the partial buckets of every level and the index
+        */
+        void close();
+
+    private:
+        // The bucket being filled in a level of a series, and its complete buckets not written yet
+        struct Level
+        {
+            PyramidBucket current;
+            unsigned int children{0};
+            std::vector<PyramidBucket> chunk;
+        };
+
+        // Adds a complete bucket of a level, and to the bucket of the level above it
+        void add_bucket(size_t series, size_t level, const PyramidBucket &bucket, bool partial);
+        void write_chunk(size_t series, size_t level);
+        void write(const void *data, size_t size);
+
+        int fd{-1};
+        // Set on the first failed write, the rest of the pyramid is dropped
+        bool write_failed{false};
+        uint64_t offset{0};
+        DomainSeries domains;
+        std::vector<uint64_t> previous_time;
+        // Source and domain of each series
+        std::vector<std::pair<size_t, size_t>> series_domains;
+        std::vector<std::vector<Level>> levels;
+        std::vector<PyramidIndexEntry> index;
+    };
+
+    // Power of each of a range's points
+    struct PowerEnvelope
+    {
+        // Start of each point, the points are (t1 - t0) / points long
+        std::vector<uint64_t> time_ns;
+        std::vector<double> min_power;
+        std::vector<double> max_power;
+        // Energy over the time covered by the point's buckets
+        std::vector<double> mean_power;
+        // Intervals between samples of each point, 0 if none ends in it
+        std::vector<uint64_t> count;
+    };
+
+    /*
+    Read-only view of a pyramid mapped in memory
+    */
+    class TracePyramid
+    {
+    public:
+        TracePyramid() = default;
+        ~TracePyramid() { close(); }
+        TracePyramid(const TracePyramid &) = delete;
+        TracePyramid &operator=(const TracePyramid &) = delete;
+
+        /*
+        Maps the pyramid and reads its index. Returns false if it can't be mapped or isn't a pyramid
+        */
+        bool open(const std::filesystem::path &path);
+        void close();
+
+        size_t num_series() const { return series_headers.size(); }
+        const PyramidSeriesHeader &series(size_t series) const { return series_headers[series]; }
+        // Returns the series of a domain of the source with the given label, num_series() if none
+        size_t find_series(const std::string &label, const std::string &domain) const;
+
+        size_t num_levels(size_t series) const { return levels[series].size(); }
+        size_t num_buckets(size_t series, size_t level) const { return levels[series][level].buckets; }
+        // Returns a bucket of a level, in time order
+        const PyramidBucket &bucket(size_t series, size_t level, size_t bucket) const;
+
+        /*
+        Computes the power envelope of a series over points equal parts of [t0, t1), from the
+        coarsest level with buckets shorter than a point, level 0 if there is none. Each bucket
+        goes to the point holding its middle, points within a longer bucket get its power with
+        a count of 0. Reads the buckets within the range only, found by binary search, so it
+        takes O(log(n) + points * PYRAMID_FANOUT) whatever the length of the trace. Returns the
+        level read
+        */
+        size_t envelope(size_t series, uint64_t t0, uint64_t t1, size_t points, PowerEnvelope &output) const;
+
+    private:
+        struct LevelChunks
+        {
+            // Position of the buckets of each chunk in the mapping
+            std::vector<const PyramidBucket *> chunks;
+            size_t buckets{0};
+        };
+
+        // Returns the first bucket of a level ending after time_ns
+        size_t find(size_t series, size_t level, uint64_t time_ns) const;
+
+        void *mapping{nullptr};
+        size_t mapping_size{0};
+        uint32_t chunk_buckets{PYRAMID_CHUNK_BUCKETS};
+        std::vector<PyramidSeriesHeader> series_headers;
+        std::vector<std::vector<LevelChunks>> levels;
+    };
+
+    /*
+    Builds the pyramid of an existing trace, plain or compressed, at pyramid_path(trace_path).
+    Returns false if the trace can't be read or the pyramid created
+    */
+    bool build_pyramid(const std::filesystem::path &trace_path);
+}
+
+#endif
@@ -0,0 +1,144 @@
+#include "adaptive_sampling.hh"
+
+#include <limits.h>
+#include <algorithm>
+#include <cmath>
+
+// Power changes are relative to at least this many Watts, so idle devices don't trigger bursts on noise
+#define MIN_REFERENCE_POWER_W 1.0
+
+long long power_meter::get_max_safe_interval_ns(const std::vector<EnergySource *> &sources,
+                                                const std::vector<std::vector<double>> &observed_peak)
+{
+    double bound = INFINITY;
+    for (size_t s = 0; s < sources.size(); ++s)
+    {
+        const auto &devices = sources[s]->devices();
+        for (unsigned int d = 0; d < devices.size(); ++d)
+        {
+            if (devices[d].counter_max == 0)
+            {
+                continue;
+            }
+            double estimate = sources[s]->max_power(d);
+            double peak = estimate > 0 ? estimate : ASSUMED_PEAK_POWER_W;
+            if (s < observed_peak.size() && d < observed_peak[s].size())
+            {
+                peak = std::max(peak, observed_peak[s][d]);
+            }
+            double wrap_time = (double)devices[d].counter_max * devices[d].energy_unit / peak;
+            bound = std::min(bound, wrap_time / WRAP_SAFETY_FACTOR);
+        }
+    }
+    return bound * 1E9 >= (double)LLONG_MAX ? LLONG_MAX : (long long)(bound * 1E9);
+}
+
+void power_meter::AdaptiveController::begin(const AdaptiveSampling &config, long long background_interval_ns,
+                                            const std::vector<EnergySource *> &sources)
+{
+    this->config = config;
+    this->background_interval_ns = background_interval_ns;
+    this->sources = sources;
+    observed_peak.assign(sources.size(), {});
+    size_t record_words = 0;
+    for (size_t s = 0; s < sources.size(); ++s)
+    {
+        observed_peak[s].assign(sources[s]->num_devices(), 0);
+        record_words += sources[s]->record_words();
+    }
+    previous.assign(record_words, 0);
+    has_previous = false;
+    safe_interval_ns = get_max_safe_interval_ns(sources, observed_peak);
+    window_energy = 0;
+    window_ns = 0;
+    window_power = -1;
+    burst_until_ns = 0;
+    requested_until_ns = 0;
+    std::lock_guard<std::mutex> guard(wake_lock);
+    wake_requested = false;
+}
+
+long long power_meter::AdaptiveController::next_interval(const uint64_t *record, long long now_ns)
+{
+    if (has_previous)
+    {
+        // Energy of this interval, and peak power of each device
+        bool new_peak = false;
+        double energy = 0;
+        size_t offset = 0;
+        for (size_t s = 0; s < sources.size(); ++s)
+        {
+            const auto &devices = sources[s]->devices();
+            // Devices with their own timestamp have their own interval
+            const size_t times = sources[s]->device_times() ? offset + 1 + devices.size() : 0;
+            for (size_t d = 0; d < devices.size(); ++d)
+            {
+                size_t time = times ? times + d : offset;
+                double time_diff = (double)(int64_t)(record[time] - previous[time]) / 1E9;
+                double device_energy = get_device_energy_diff(devices[d], previous[offset + 1 + d], record[offset + 1 + d]);
+                energy += device_energy;
+                if (time_diff > 0 && device_energy / time_diff > observed_peak[s][d])
+                {
+                    observed_peak[s][d] = device_energy / time_diff;
+                    new_peak = true;
+                }
+            }
+            offset += sources[s]->record_words();
+        }
+        if (new_peak)
+        {
+            safe_interval_ns.store(get_max_safe_interval_ns(sources, observed_peak), std::memory_order_relaxed);
+        }
+
+        // Compare the power of consecutive windows of at least change_window
+        window_energy += energy;
+        window_ns += now_ns - previous_ns;
+        if (window_ns >= std::chrono::nanoseconds(config.change_window).count())
+        {
+            double power = window_energy / ((double)window_ns / 1E9);
+            if (window_power >= 0 &&
+                std::fabs(power - window_power) > config.change_threshold * std::max(window_power, MIN_REFERENCE_POWER_W))
+            {
+                burst_until_ns = now_ns + std::chrono::nanoseconds(config.burst_duration).count();
+            }
+            window_power = power;
+            window_energy = 0;
+            window_ns = 0;
+        }
+    }
+    std::copy(record, record + previous.size(), previous.begin());
+    previous_ns = now_ns;
+    has_previous = true;
+
+    long long until = std::max(burst_until_ns, requested_until_ns.load(std::memory_order_relaxed));
+    long long interval = now_ns < until ? std::chrono::nanoseconds(config.burst_interval).count() : background_interval_ns;
+    return std::max<long long>(std::min(interval, max_safe_interval()), 1);
+}
+
+bool power_meter::AdaptiveController::sleep_until(long long deadline_ns)
+{
+    // steady_clock is CLOCK_MONOTONIC
+    std::chrono::steady_clock::time_point deadline{std::chrono::nanoseconds(deadline_ns)};
+    std::unique_lock<std::mutex> guard(wake_lock);
+    bool woken = wake_cv.wait_until(guard, deadline, [&] { return wake_requested; });
+    wake_requested = false;
+    return woken;
+}
+
+void power_meter::AdaptiveController::request_burst(long long until_ns)
+{
+    long long current = requested_until_ns.load(std::memory_order_relaxed);
+    while (until_ns > current && !requested_until_ns.compare_exchange_weak(current, until_ns, std::memory_order_relaxed))
+    {
+    }
+    wake();
+}
+
+void power_meter::AdaptiveController::wake()
+{
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        wake_requested = true;
+    }
+    wake_cv.notify_one();
+}
@@ -0,0 +1,184 @@
+#include "core_energy_source.hh"
+#include "rapl_utils.hh"
+#include "msr_reader.hh"
+#include "topology.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+int power_meter::CoreEnergySource::init()
+{
+    try
+    {
+        if (rapl_utils::vendor_id < 0 && rapl_utils::init() != 0)
+        {
+            return 1;
+        }
+    }
+    catch (const std::filesystem::filesystem_error &e)
+    {
+        // Per-core energy is optional and mustn't take the run down
+        fprintf(stderr, "POWER METER: ERROR: %s\n", e.what());
+        return 1;
+    }
+    if (rapl_utils::vendor_id != rapl_utils::VENDOR_ID::AMD)
+    {
+        fprintf(stderr, "POWER METER: Per-core energy counters are only available on AMD CPUs\n");
+        return 1;
+    }
+    stop_helpers();
+    close_fds();
+    device_info.clear();
+    cpus.clear();
+    for (const auto &cpu : topology::get_topology().cpus)
+    {
+        // SMT siblings share the counter of their core
+        if (!cpu.first_thread)
+        {
+            continue;
+        }
+        // Like the package counter, the core energy counter is 32 bits wide and uses the same unit
+        device_info.push_back({"core" + std::to_string(cpu.id), "Core", rapl_utils::energy_increment, 1ULL << 32});
+        cpus.push_back(cpu.id);
+        // Our own descriptors, the shared table's belong to the package counters
+        auto path = rapl_utils::msr_device_root / std::to_string(cpu.id) / "msr";
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            fprintf(stderr, "POWER METER: ERROR: Could not open %s: %s\n", path.c_str(), strerror(errno));
+            close_fds();
+            return 1;
+        }
+        fds.push_back(fd);
+    }
+    values.assign(fds.size(), 0);
+
+    // Split the cores into one contiguous slice per reading thread
+    size_t num_helpers = requested_helpers;
+    if (num_helpers == 0)
+    {
+        size_t full_slices = (fds.size() + CORES_PER_HELPER - 1) / CORES_PER_HELPER;
+        num_helpers = std::min<size_t>(full_slices > 1 ? full_slices - 1 : 0, MAX_CORE_HELPERS);
+    }
+    num_helpers = std::min(num_helpers, fds.size() == 0 ? 0 : fds.size() - 1);
+    size_t num_slices = num_helpers + 1;
+    slices.clear();
+    for (size_t i = 0; i < num_slices; ++i)
+    {
+        slices.push_back({fds.size() * i / num_slices, fds.size() * (i + 1) / num_slices});
+    }
+
+    // A relaunch starts from scratch, target pointed into the previous run's buffers
+    stopping = false;
+    pending = 0;
+    generation = 0;
+    target = nullptr;
+    for (unsigned int i = 1; i < num_slices; ++i)
+    {
+        helpers.emplace_back(&CoreEnergySource::helper_loop, this, i);
+    }
+    return 0;
+}
+
+void power_meter::CoreEnergySource::shutdown()
+{
+    stop_helpers();
+    close_fds();
+}
+
+void power_meter::CoreEnergySource::close_fds()
+{
+    for (int fd : fds)
+    {
+        ::close(fd);
+    }
+    fds.clear();
+}
+
+void power_meter::CoreEnergySource::stop_helpers()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    start_cv.notify_all();
+    for (auto &helper : helpers)
+    {
+        helper.join();
+    }
+    helpers.clear();
+}
+
+void power_meter::CoreEnergySource::read_slice(size_t begin, size_t end, uint64_t *counters)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        uint64_t value = 0;
+        if (pread(fds[i], &value, sizeof(value), AMD_MSR_CORE_ENERGY_STATUS) == sizeof(value))
+        {
+            values[i] = value & 0xFFFFFFFFULL;
+        }
+        counters[i] = values[i];
+    }
+}
+
+void power_meter::CoreEnergySource::helper_loop(unsigned int slice)
+{
+    // Reading the MSR of the CPU we run on avoids an IPI, pin the helper to the first CPU of its slice
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpus[slices[slice].first], &cpu_set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (error != 0)
+    {
+        fprintf(stderr, "POWER METER: WARNING: Could not pin a per-core reader to core %d: %s\n",
+                cpus[slices[slice].first], strerror(error));
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    // Only readings requested after the helper started are its own
+    unsigned long long seen = generation;
+    while (true)
+    {
+        start_cv.wait(guard, [&] { return stopping || generation != seen; });
+        if (stopping)
+        {
+            return;
+        }
+        seen = generation;
+        uint64_t *counters = target;
+        guard.unlock();
+        read_slice(slices[slice].first, slices[slice].second, counters);
+        guard.lock();
+        if (--pending == 0)
+        {
+            done_cv.notify_one();
+        }
+    }
+}
+
+void power_meter::CoreEnergySource::read_counters(struct timespec &time, uint64_t *counters)
+{
+    if (!helpers.empty())
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            target = counters;
+            pending = (unsigned int)helpers.size();
+            ++generation;
+        }
+        start_cv.notify_all();
+    }
+    read_slice(slices.empty() ? 0 : slices[0].first, slices.empty() ? 0 : slices[0].second, counters);
+    if (!helpers.empty())
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        done_cv.wait(guard, [&] { return pending == 0; });
+    }
+    clock_gettime(CLOCK_MONOTONIC, &time);
+}
@@ -0,0 +1,171 @@
+#include "energy_source.hh"
+
+#include <algorithm>
+
+void power_meter::EnergySource::read(SourceReading &reading)
+{
+    if (!reading.counters)
+    {
+        reading.counters = std::make_unique<uint64_t[]>(num_devices());
+    }
+    read_counters(reading.time, reading.counters.get());
+    if (const uint64_t *times = device_times())
+    {
+        if (!reading.device_times)
+        {
+            reading.device_times = std::make_unique<uint64_t[]>(num_devices());
+        }
+        std::copy(times, times + num_devices(), reading.device_times.get());
+    }
+}
+
+void power_meter::DeviceCounters::init(const std::vector<DeviceInfo> &devices)
+{
+    counter_max.resize(devices.size());
+    energy_unit.resize(devices.size());
+    for (size_t i = 0; i < devices.size(); ++i)
+    {
+        counter_max[i] = devices[i].counter_max;
+        energy_unit[i] = devices[i].energy_unit;
+    }
+    last_counter.assign(devices.size(), 0);
+    interval_ticks.assign(devices.size(), 0);
+    total_ticks.assign(devices.size(), 0);
+    device_energy.assign(devices.size(), 0);
+    device_power.assign(devices.size(), 0);
+    last_device_time.assign(devices.size(), 0);
+    device_interval.assign(devices.size(), 0);
+    started = false;
+}
+
+bool power_meter::DeviceCounters::update_ticks(const uint64_t *counters)
+{
+    const size_t num_devices = size();
+    if (!started)
+    {
+        std::copy(counters, counters + num_devices, last_counter.begin());
+        started = true;
+        return false;
+    }
+    const uint64_t *max = counter_max.data();
+    uint64_t *last = last_counter.data();
+    uint64_t *ticks = interval_ticks.data();
+    uint64_t *total = total_ticks.data();
+    for (size_t i = 0; i < num_devices; ++i)
+    {
+        // Same as get_device_tick_diff without branches: adding the modulus to the difference
+        // modulo 2^64 corrects a wraparound, counters that never wrap have a modulus of 0
+        uint64_t current = counters[i];
+        ticks[i] = current - last[i] + (current < last[i] ? max[i] : 0);
+        last[i] = current;
+        total[i] += ticks[i];
+    }
+    return true;
+}
+
+void power_meter::DeviceCounters::update(const uint64_t *counters, double time_diff)
+{
+    if (!update_ticks(counters))
+    {
+        return;
+    }
+    const size_t num_devices = size();
+    const uint64_t *ticks = interval_ticks.data();
+    // Converted in a separate pass, so the integer pass above vectorizes on targets without
+    // vector 64 bit integer to double conversions
+    const double inverse_time = time_diff > 0 ? 1 / time_diff : 0;
+    const double *unit = energy_unit.data();
+    double *energy = device_energy.data();
+    double *power = device_power.data();
+    for (size_t i = 0; i < num_devices; ++i)
+    {
+        energy[i] = (double)ticks[i] * unit[i];
+        power[i] = energy[i] * inverse_time;
+    }
+}
+
+void power_meter::DeviceCounters::update(const uint64_t *counters, const double *time_diff)
+{
+    if (!update_ticks(counters))
+    {
+        return;
+    }
+    const uint64_t *ticks = interval_ticks.data();
+    const double *unit = energy_unit.data();
+    double *energy = device_energy.data();
+    double *power = device_power.data();
+    for (size_t i = 0; i < size(); ++i)
+    {
+        energy[i] = (double)ticks[i] * unit[i];
+        // A device without a new reading keeps the power of its last interval
+        power[i] = time_diff[i] > 0 ? energy[i] / time_diff[i] : power[i];
+    }
+}
+
+void power_meter::DeviceCounters::update(const uint64_t *counters, const uint64_t *device_times)
+{
+    for (size_t i = 0; i < size(); ++i)
+    {
+        // Signed, a device time going backwards gives a negative interval which keeps its power
+        device_interval[i] = (double)(int64_t)(device_times[i] - last_device_time[i]) / 1E9;
+        last_device_time[i] = device_times[i];
+    }
+    update(counters, device_interval.data());
+}
+
+double power_meter::get_energy_diff(const EnergySource &source, const uint64_t *previous_counters,
+                                    const uint64_t *current_counters)
+{
+    return get_energy_diff(source.devices(), previous_counters, current_counters);
+}
+
+double power_meter::get_energy_diff(const std::vector<DeviceInfo> &devices, const uint64_t *previous_counters,
+                                    const uint64_t *current_counters)
+{
+    double energy_diff = 0;
+    for (size_t i = 0; i < devices.size(); ++i)
+    {
+        energy_diff += get_device_energy_diff(devices[i], previous_counters[i], current_counters[i]);
+    }
+    return energy_diff;
+}
+
+double power_meter::get_time_diff(const struct timespec &previous, const struct timespec &current)
+{
+    return (double)(current.tv_sec - previous.tv_sec) +
+           ((double)(current.tv_nsec - previous.tv_nsec) / 1E9);
+}
+
+void power_meter::update_energy_data(EnergyData &output_data, const EnergySource &source,
+                                     const SourceReading &previous_data, const SourceReading &current_data)
+{
+    update_energy_data(output_data, source.devices(), previous_data, current_data);
+}
+
+void power_meter::update_energy_data(EnergyData &output_data, const std::vector<DeviceInfo> &devices,
+                                     const SourceReading &previous_data, const SourceReading &current_data)
+{
+    double time_diff = get_time_diff(previous_data.time, current_data.time);
+    double energy_diff = get_energy_diff(devices, previous_data.counters.get(), current_data.counters.get());
+    output_data.power = time_diff > 0 ? energy_diff / time_diff : 0;
+    output_data.energy = energy_diff;
+    output_data.total_energy += energy_diff;
+}
+
+void power_meter::copy_reading(SourceReading &destination, const SourceReading &source, unsigned int num_devices)
+{
+    if (!destination.counters)
+    {
+        destination.counters = std::make_unique<uint64_t[]>(num_devices);
+    }
+    destination.time = source.time;
+    std::copy(source.counters.get(), source.counters.get() + num_devices, destination.counters.get());
+    if (source.device_times)
+    {
+        if (!destination.device_times)
+        {
+            destination.device_times = std::make_unique<uint64_t[]>(num_devices);
+        }
+        std::copy(source.device_times.get(), source.device_times.get() + num_devices, destination.device_times.get());
+    }
+}
@@ -0,0 +1,185 @@
+#include "live_stats.hh"
+
+#include <stdio.h>
+#include <algorithm>
+
+// Powers are kept in the histograms in mW
+static uint64_t to_histogram(double power)
+{
+    return power > 0 ? (uint64_t)(power * 1E3) : 0;
+}
+
+void power_meter::LiveStats::Window::add(const Entry &entry)
+{
+    entries.push_back(entry);
+    energy += entry.energy;
+    covered_ns += entry.interval_ns;
+    histogram.add(to_histogram(entry.power));
+    while (!min_queue.empty() && min_queue.back().power >= entry.power)
+    {
+        min_queue.pop_back();
+    }
+    min_queue.push_back(entry);
+    while (!max_queue.empty() && max_queue.back().power <= entry.power)
+    {
+        max_queue.pop_back();
+    }
+    max_queue.push_back(entry);
+}
+
+void power_meter::LiveStats::Window::expire(long long now_ns)
+{
+    while (!entries.empty() && entries.front().time_ns <= now_ns - length_ns)
+    {
+        const Entry &entry = entries.front();
+        energy -= entry.energy;
+        covered_ns -= entry.interval_ns;
+        histogram.remove(to_histogram(entry.power));
+        // Entries are unique by time, the queues only hold entries still in the window
+        if (min_queue.front().time_ns == entry.time_ns)
+        {
+            min_queue.pop_front();
+        }
+        if (max_queue.front().time_ns == entry.time_ns)
+        {
+            max_queue.pop_front();
+        }
+        entries.pop_front();
+    }
+    // Running sums of an emptied window start over exactly
+    if (entries.empty())
+    {
+        energy = 0;
+    }
+}
+
+void power_meter::LiveStats::begin(const std::vector<EnergySource *> &sources,
+                                   const std::vector<std::chrono::milliseconds> &windows)
+{
+    // A window would expire the sample just added to it, leaving it without a minimum or maximum
+    std::vector<long long> lengths;
+    for (const auto &window : windows)
+    {
+        if (window.count() <= 0)
+        {
+            fprintf(stderr, "POWER METER: WARNING: Ignoring a live window of %lld ms\n", (long long)window.count());
+        }
+        else if (lengths.size() < MAX_LIVE_WINDOWS)
+        {
+            lengths.push_back(std::chrono::nanoseconds(window).count());
+        }
+    }
+
+    this->sources.clear();
+    for (size_t i = 0; i < std::min<size_t>(sources.size(), MAX_LIVE_SOURCES); ++i)
+    {
+        Source source;
+        source.source = sources[i];
+        source.record_words = sources[i]->record_words();
+        source.counters.init(sources[i]->devices());
+        for (long long length : lengths)
+        {
+            source.windows.emplace_back();
+            source.windows.back().length_ns = length;
+        }
+        this->sources.push_back(std::move(source));
+    }
+    // Snapshots of the previous run are no longer valid
+    for (auto &snapshot : published)
+    {
+        snapshot.store(LiveSnapshot{});
+    }
+    percentiles_ns = 0;
+}
+
+void power_meter::LiveStats::update(const uint64_t *record, long long now_ns)
+{
+    bool refresh_percentiles = now_ns - percentiles_ns >= LIVE_PERCENTILE_PERIOD_MS * 1000000LL;
+    if (refresh_percentiles)
+    {
+        percentiles_ns = now_ns;
+    }
+
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        auto &source = sources[i];
+        const size_t num_devices = source.counters.size();
+        const long long time_ns = (long long)record[0];
+        const uint64_t *counters = record + 1;
+        const uint64_t *device_times = source.source->device_times() ? record + 1 + num_devices : nullptr;
+        record += source.record_words;
+
+        const bool first = !source.started;
+        source.started = true;
+        long long interval_ns = time_ns - source.previous_ns;
+        source.previous_ns = time_ns;
+        if (device_times)
+        {
+            // Each device over its own interval, like the CSV output
+            source.counters.update(counters, device_times);
+        }
+        else
+        {
+            source.counters.update(counters, (double)interval_ns / 1E9);
+        }
+        if (first)
+        {
+            continue;
+        }
+
+        auto &snapshot = source.current;
+        const double *energy = source.counters.energy();
+        const double *power = source.counters.power();
+        EnergyData latest;
+        for (size_t device = 0; device < num_devices; ++device)
+        {
+            latest.energy += energy[device];
+            latest.power += power[device];
+            latest.total_energy += source.counters.total_energy(device);
+        }
+        if (!device_times)
+        {
+            latest.power = interval_ns > 0 ? latest.energy / ((double)interval_ns / 1E9) : 0;
+        }
+        ++snapshot.samples;
+        snapshot.time_ns = time_ns;
+        snapshot.latest = latest;
+
+        Entry entry{time_ns, interval_ns, latest.energy, latest.power};
+        snapshot.num_windows = (unsigned int)source.windows.size();
+        for (size_t j = 0; j < source.windows.size(); ++j)
+        {
+            auto &window = source.windows[j];
+            window.add(entry);
+            window.expire(time_ns);
+            if (refresh_percentiles)
+            {
+                window.p95_power = (double)window.histogram.percentile(0.95) / 1E3;
+                window.p99_power = (double)window.histogram.percentile(0.99) / 1E3;
+            }
+
+            auto &stats = snapshot.windows[j];
+            stats.length = (double)window.length_ns / 1E9;
+            stats.covered = (double)window.covered_ns / 1E9;
+            stats.samples = window.entries.size();
+            stats.mean_power = window.covered_ns > 0 ? window.energy / stats.covered : 0;
+            stats.min_power = window.min_queue.front().power;
+            stats.max_power = window.max_queue.front().power;
+            stats.p95_power = window.p95_power;
+            stats.p99_power = window.p99_power;
+            stats.energy = window.energy;
+        }
+        published[i].store(snapshot);
+    }
+}
+
+bool power_meter::LiveStats::snapshot(unsigned int source, LiveSnapshot &snapshot) const
+{
+    LiveSnapshot copy;
+    if (source >= MAX_LIVE_SOURCES || !published[source].load(copy) || copy.samples == 0)
+    {
+        return false;
+    }
+    snapshot = copy;
+    return true;
+}
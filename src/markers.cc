@@ -0,0 +1,110 @@
+#include "markers.hh"
+
+#include <string.h>
+#include <time.h>
+
+namespace power_meter
+{
+    MarkerQueue marker_queue{MARKER_QUEUE_CAPACITY};
+
+    // Numbers handed to the threads issuing markers
+    static std::atomic<uint32_t> next_thread{0};
+}
+
+power_meter::MarkerQueue::MarkerQueue(size_t capacity)
+{
+    size_t num_slots = 1;
+    while (num_slots < capacity)
+    {
+        num_slots <<= 1;
+    }
+    mask = num_slots - 1;
+    slots = std::make_unique<Slot[]>(num_slots);
+    for (size_t i = 0; i < num_slots; ++i)
+    {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool power_meter::MarkerQueue::push(const Marker &marker)
+{
+    size_t position = enqueue_position.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Slot &slot = slots[position & mask];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence == position)
+        {
+            if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                slot.marker = marker;
+                slot.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (sequence < position)
+        {
+            // The consumer hasn't freed the slot of the previous round
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            position = enqueue_position.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+const power_meter::Marker *power_meter::MarkerQueue::front()
+{
+    Slot &slot = slots[dequeue_position & mask];
+    if (slot.sequence.load(std::memory_order_acquire) != dequeue_position + 1)
+    {
+        return nullptr;
+    }
+    return &slot.marker;
+}
+
+void power_meter::MarkerQueue::pop()
+{
+    slots[dequeue_position & mask].sequence.store(dequeue_position + mask + 1, std::memory_order_release);
+    ++dequeue_position;
+}
+
+void power_meter::MarkerQueue::clear()
+{
+    while (front())
+    {
+        pop();
+    }
+}
+
+void power_meter::push_marker(MARKER_TYPE type, const char *name)
+{
+    // Numbered on the thread's first marker, no system call
+    thread_local uint32_t thread = next_thread.fetch_add(1, std::memory_order_relaxed);
+    Marker marker;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    marker.time_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    marker.type = type;
+    marker.thread = thread;
+    strncpy(marker.name, name, MARKER_NAME_SIZE - 1);
+    marker.name[MARKER_NAME_SIZE - 1] = '\0';
+    marker_queue.push(marker);
+}
+
+void power_meter::mark(const char *name)
+{
+    push_marker(MARKER_POINT, name);
+}
+
+void power_meter::begin_phase(const char *name)
+{
+    push_marker(MARKER_PHASE_BEGIN, name);
+}
+
+void power_meter::end_phase(const char *name)
+{
+    push_marker(MARKER_PHASE_END, name);
+}
@@ -0,0 +1,139 @@
+#include "meter.hh"
+#include "power_meter.hh"
+
+#include <algorithm>
+
+bool power_meter::Meter::start()
+{
+    return !bound && attach_meter(this);
+}
+
+void power_meter::Meter::stop()
+{
+    if (bound)
+    {
+        detach_meter(this);
+    }
+}
+
+void power_meter::Meter::bind(const std::vector<SourceInfo> &engine_sources)
+{
+    selected.clear();
+    selections.clear();
+    for (size_t i = 0; i < engine_sources.size(); ++i)
+    {
+        const auto &source = engine_sources[i];
+        if (!source_labels.empty() &&
+            std::find(source_labels.begin(), source_labels.end(), source.label) == source_labels.end())
+        {
+            continue;
+        }
+        SourceInfo info{source.label, source.name, {}, source.device_times};
+        Selection selection{i, {}};
+        for (size_t device = 0; device < source.devices.size(); ++device)
+        {
+            if (domains.empty() || std::find(domains.begin(), domains.end(), source.devices[device].domain) != domains.end())
+            {
+                info.devices.push_back(source.devices[device]);
+                selection.devices.push_back(device);
+            }
+        }
+        if (info.devices.empty())
+        {
+            continue;
+        }
+        // Sources kept whole are copied in one go
+        if (info.devices.size() == source.devices.size())
+        {
+            selection.devices.clear();
+        }
+        selected.push_back(std::move(info));
+        selections.push_back(std::move(selection));
+    }
+    allocate_readings(selected, readings);
+    next_ns = 0;
+    pending_flush = false;
+    for (auto &sink : sinks)
+    {
+        sink->begin(selected);
+    }
+    bound = true;
+}
+
+void power_meter::Meter::write_sample(const std::vector<SourceReading> &engine_readings, long long time_ns,
+                                      long long engine_interval_ns)
+{
+    // The sample closest to each due time is taken, the engine's ticks may not line up with ours
+    if (next_ns != 0 && time_ns < next_ns - engine_interval_ns / 2)
+    {
+        return;
+    }
+    const long long interval_ns = (long long)sampling_interval.count() * 1000;
+    next_ns = next_ns == 0 ? time_ns + interval_ns : next_ns + interval_ns;
+    // Skip the due times missed while the engine sampled slower than us
+    if (next_ns <= time_ns)
+    {
+        next_ns = time_ns + interval_ns;
+    }
+
+    for (size_t i = 0; i < selections.size(); ++i)
+    {
+        const auto &selection = selections[i];
+        const auto &reading = engine_readings[selection.source];
+        auto &copy = readings[i];
+        copy.time = reading.time;
+        if (selection.devices.empty())
+        {
+            const size_t num_devices = selected[i].devices.size();
+            std::copy(reading.counters.get(), reading.counters.get() + num_devices, copy.counters.get());
+            if (selected[i].device_times)
+            {
+                std::copy(reading.device_times.get(), reading.device_times.get() + num_devices, copy.device_times.get());
+            }
+            continue;
+        }
+        for (size_t device = 0; device < selection.devices.size(); ++device)
+        {
+            copy.counters[device] = reading.counters[selection.devices[device]];
+            if (selected[i].device_times)
+            {
+                copy.device_times[device] = reading.device_times[selection.devices[device]];
+            }
+        }
+    }
+    for (auto &sink : sinks)
+    {
+        sink->write_sample(readings.data());
+    }
+    pending_flush = true;
+}
+
+void power_meter::Meter::write_marker(const Marker &marker)
+{
+    for (auto &sink : sinks)
+    {
+        sink->write_marker(marker);
+    }
+    pending_flush = true;
+}
+
+void power_meter::Meter::flush()
+{
+    if (pending_flush)
+    {
+        for (auto &sink : sinks)
+        {
+            sink->flush();
+        }
+        pending_flush = false;
+    }
+}
+
+void power_meter::Meter::unbind()
+{
+    for (auto &sink : sinks)
+    {
+        sink->end();
+    }
+    bound = false;
+}
@@ -1,22 +1,39 @@
 #include "msr_reader.hh"
 
-#include <filesystem>
+#include <fcntl.h>
 #include <system_error>
-
-#define BUFFER_SIZE 32
+#include <vector>
 
 using namespace rapl_utils;
 
+// Global variable definitions
+namespace rapl_utils
+{
+  std::filesystem::path msr_device_root{"/dev/cpu"};
+  // Cached descriptors, indexed by core. -1 when the core's device isn't open
+  std::vector<int> msr_fds;
+}
+
+static std::filesystem::path msr_path(int core)
+{
+  return msr_device_root / std::to_string(core) / "msr";
+}
+
+void rapl_utils::set_msr_device_root(std::string dir)
+{
+  close_msr_fds();
+  msr_device_root = dir;
+}
+
 FILE *rapl_utils::open_msr(int core)
 {
-  char filename[BUFFER_SIZE];
-  snprintf(filename, BUFFER_SIZE, "/dev/cpu/%d/msr", core);
-  FILE *file = fopen(filename, "rb");
+  auto filename = msr_path(core);
+  FILE *file = fopen(filename.c_str(), "rb");
 
   if (!file)
   {
     throw std::filesystem::filesystem_error(
-        "Could not open MSR file, needs root access", filename, 
+        "Could not open MSR file, needs root access", filename,
         std::make_error_code(std::errc::permission_denied));
   }
 
@@ -33,16 +50,63 @@ unsigned long long rapl_utils::read_msr(FILE *file, unsigned int address)
   return data;
 }
 
-void rapl_utils::read_msr_fields(int core, const unsigned int msr_address,
+int rapl_utils::open_msr_fd(int core)
+{
+  if ((int)msr_fds.size() <= core)
+  {
+    msr_fds.resize(core + 1, -1);
+  }
+  if (msr_fds[core] >= 0)
+  {
+    return msr_fds[core];
+  }
+
+  auto filename = msr_path(core);
+  int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+  {
+    throw std::filesystem::filesystem_error(
+        "Could not open MSR file, needs root access", filename,
+        std::make_error_code(std::errc::permission_denied));
+  }
+
+  msr_fds[core] = fd;
+  return fd;
+}
+
+void rapl_utils::close_msr_fds()
+{
+  for (int fd : msr_fds)
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+  }
+  msr_fds.clear();
+}
+
+bool rapl_utils::read_msr_raw(int core, unsigned int address, unsigned long long *data)
+{
+  int fd = (core < (int)msr_fds.size() && msr_fds[core] >= 0) ? msr_fds[core] : open_msr_fd(core);
+  return pread(fd, data, sizeof(*data), address) == sizeof(*data);
+}
+
+bool rapl_utils::read_msr_fields(int core, const unsigned int msr_address,
                                  const unsigned int msr_numfields,
                                  const unsigned int *msr_offsets,
                                  const unsigned int *msr_sizes,
                                  unsigned long long *msr_values)
 {
   unsigned long long field = 0;
+  unsigned long long data = 0;
 
-  FILE *file = open_msr(core);
-  unsigned long long data = read_msr(file, msr_address);
+  // Leave the previous values in place rather than parsing a register we didn't read
+  if (!read_msr_raw(core, msr_address, &data))
+  {
+    return false;
+  }
 
   // Parse the fields and store their values
   for (unsigned int i = 0; i < msr_numfields; i++)
@@ -52,8 +116,7 @@ void rapl_utils::read_msr_fields(int core, const unsigned int msr_address,
     field = field & get_mask(msr_sizes[i]);
     msr_values[i] = field;
   }
-
-  fclose(file);
+  return true;
 }
 
 unsigned long long rapl_utils::get_mask(unsigned int size)
@@ -65,4 +128,4 @@ unsigned long long rapl_utils::get_mask(unsigned int size)
     mask += 1;
   }
   return mask;
-}
\ No newline at end of file
+}
@@ -0,0 +1,140 @@
+#include "nvml_source.hh"
+#include "nvml_utils.hh"
+
+#include <algorithm>
+#include <string>
+
+static uint64_t monotonic_ns()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+}
+
+int power_meter::NvmlSource::init()
+{
+    stop_pollers();
+    device_info.clear();
+    times.clear();
+    // Without a working driver there are no GPUs to measure, which is not an error
+    initialized = nvml_utils::start();
+    if (!initialized)
+    {
+        // load() already reported a missing library
+        if (nvml_utils::load())
+        {
+            fprintf(stderr, "POWER METER: Could not initialize NVML, GPUs will not be measured\n");
+        }
+        return 0;
+    }
+    nvml_utils::init();
+    for (unsigned int i = 0; i < nvml_utils::num_GPUs; ++i)
+    {
+        // NVML reports energy in mili Joules on a 64 bit counter
+        device_info.push_back({"gpu" + std::to_string(i), "GPU", 1E-3, 0});
+    }
+    published = std::make_unique<PublishedReading[]>(num_devices());
+    times.assign(num_devices(), 0);
+
+    // Read every GPU once, so the first reading of the monitoring loop is valid
+    poll_slice(0, num_devices());
+
+    // Split the GPUs into one contiguous slice per poller
+    size_t num_pollers = requested_pollers == 0 ? MAX_NVML_POLLERS : requested_pollers;
+    num_pollers = std::min<size_t>(num_pollers, num_devices());
+    slices.clear();
+    for (size_t i = 0; i < num_pollers; ++i)
+    {
+        slices.push_back({num_devices() * i / num_pollers, num_devices() * (i + 1) / num_pollers});
+    }
+
+    stopping = false;
+    for (unsigned int i = 0; i < num_pollers; ++i)
+    {
+        pollers.emplace_back(&NvmlSource::poller_loop, this, i);
+    }
+    return 0;
+}
+
+void power_meter::NvmlSource::shutdown()
+{
+    stop_pollers();
+    if (initialized)
+    {
+        nvml_utils::api.shutdown();
+        initialized = false;
+    }
+}
+
+void power_meter::NvmlSource::stop_pollers()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    poll_cv.notify_all();
+    for (auto &poller : pollers)
+    {
+        poller.join();
+    }
+    pollers.clear();
+}
+
+void power_meter::NvmlSource::poll_slice(size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        uint64_t before = monotonic_ns();
+        unsigned long long energy;
+        // A failed reading keeps the previous one, the counter never goes back
+        if (!nvml_utils::read_gpu_energy_counter((unsigned int)i, energy))
+        {
+            continue;
+        }
+        // The driver samples the counter somewhere during the call, take the middle
+        uint64_t time = before + (monotonic_ns() - before) / 2;
+        published[i].reading.store({energy, time});
+    }
+}
+
+void power_meter::NvmlSource::poller_loop(unsigned int slice)
+{
+    unsigned long long seen = 0;
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+        poll_cv.wait(guard, [&] { return stopping || generation != seen; });
+        if (stopping)
+        {
+            return;
+        }
+        // Requests made while polling are served by the next round
+        seen = generation;
+        guard.unlock();
+        poll_slice(slices[slice].first, slices[slice].second);
+        guard.lock();
+    }
+}
+
+void power_meter::NvmlSource::read_counters(struct timespec &time, uint64_t *counters)
+{
+    for (unsigned int i = 0; i < num_devices(); ++i)
+    {
+        // Only retries while the poller is in the middle of publishing. A GPU that was never
+        // read successfully stays at 0
+        GpuReading reading{0, 0};
+        published[i].reading.load(reading);
+        counters[i] = reading.counter;
+        times[i] = reading.time_ns;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    if (!pollers.empty())
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            ++generation;
+        }
+        poll_cv.notify_all();
+    }
+}
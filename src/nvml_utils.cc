@@ -1,55 +1,133 @@
 #include "nvml_utils.hh"
 
+#include <dlfcn.h>
+#include <stdlib.h>
 #include <cstdio>
+#include <mutex>
 #include <time.h>
 
+// Library loaded when POWER_METER_NVML_LIBRARY isn't set in the environment
+#ifndef POWER_METER_NVML_LIBRARY
+#define POWER_METER_NVML_LIBRARY "libnvidia-ml.so.1"
+#endif
+
 // Global variable definitions
 namespace nvml_utils
 {
     unsigned int num_GPUs{0};
     std::unique_ptr<nvmlDevice_t[]> device_handles;
+    NvmlApi api;
+}
+
+namespace
+{
+    std::once_flag load_flag;
+    bool loaded{false};
+}
+
+template <typename Function>
+static bool resolve(void *library, const char *symbol, Function &function)
+{
+    function = reinterpret_cast<Function>(dlsym(library, symbol));
+    return function != nullptr;
+}
+
+static void load_library()
+{
+#ifdef POWER_METER_NO_NVML
+    printf("POWER METER: Built without NVML support, GPUs will not be measured\n");
+#else
+    const char *path = getenv("POWER_METER_NVML_LIBRARY");
+    path = path && *path ? path : POWER_METER_NVML_LIBRARY;
+    // Never unloaded, the driver keeps threads of its own
+    void *library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!library)
+    {
+        printf("POWER METER: NVML not found (%s), GPUs will not be measured\n", dlerror());
+        return;
+    }
+    using nvml_utils::api;
+    loaded = resolve(library, "nvmlInit_v2", api.init) &&
+             resolve(library, "nvmlShutdown", api.shutdown) &&
+             resolve(library, "nvmlDeviceGetCount_v2", api.device_get_count) &&
+             resolve(library, "nvmlDeviceGetHandleByIndex_v2", api.device_get_handle_by_index) &&
+             resolve(library, "nvmlDeviceGetTotalEnergyConsumption", api.device_get_total_energy_consumption);
+    if (!loaded)
+    {
+        fprintf(stderr, "POWER METER: ERROR: %s lacks NVML functions, GPUs will not be measured\n", path);
+        api = nvml_utils::NvmlApi{};
+        dlclose(library);
+    }
+#endif
+}
+
+bool nvml_utils::load()
+{
+    std::call_once(load_flag, load_library);
+    return loaded;
+}
+
+bool nvml_utils::start()
+{
+    return load() && api.init() == NVML_SUCCESS;
 }
 
 void nvml_utils::init()
 {
-    nvmlDeviceGetCount_v2(&num_GPUs);
+    num_GPUs = 0;
+    api.device_get_count(&num_GPUs);
     device_handles = std::make_unique<nvmlDevice_t[]>(num_GPUs);
     for (unsigned int i = 0; i < num_GPUs; ++i)
     {
-        nvmlDeviceGetHandleByIndex_v2(i, &device_handles[i]);
+        api.device_get_handle_by_index(i, &device_handles[i]);
     }
     printf("POWER METER: Number of GPUs detected: %d\n", num_GPUs);
 }
 
-void nvml_utils::update_gpu_energy(EnergyAux &data)
+unsigned long long nvml_utils::get_gpu_energy_counter(unsigned int gpu)
 {
     unsigned long long energy{0};
-    for (unsigned int i = 0; i < num_GPUs; ++i)
+    read_gpu_energy_counter(gpu, energy);
+    return energy;
+}
+
+bool nvml_utils::read_gpu_energy_counter(unsigned int gpu, unsigned long long &energy)
+{
+    unsigned long long value{0};
+    auto nvml_error = api.device_get_total_energy_consumption(device_handles[gpu], &value);
+    if (nvml_error != NVML_SUCCESS)
     {
-        auto nvml_error = nvmlDeviceGetTotalEnergyConsumption(device_handles[i], &energy);
-        if (nvml_error != NVML_SUCCESS)
+        switch (nvml_error)
         {
-            switch (nvml_error)
-            {
-            case NVML_ERROR_UNINITIALIZED:
-                fprintf(stderr, "POWER METER: ERROR: CUDA device uninitialized\n");
-                break;
-            case NVML_ERROR_INVALID_ARGUMENT:
-                fprintf(stderr, "POWER METER: ERROR: Invalid CUDA device\n");
-                break;
-            case NVML_ERROR_NOT_SUPPORTED:
-                fprintf(stderr, "POWER METER: ERROR: CUDA device not supported\n");
-                break;
-            default:
-                fprintf(stderr, "POWER METER: There was an error reading GPU energy consumption\n");
-                break;
-            }
+        case NVML_ERROR_UNINITIALIZED:
+            fprintf(stderr, "POWER METER: ERROR: CUDA device uninitialized\n");
+            break;
+        case NVML_ERROR_INVALID_ARGUMENT:
+            fprintf(stderr, "POWER METER: ERROR: Invalid CUDA device\n");
+            break;
+        case NVML_ERROR_NOT_SUPPORTED:
+            fprintf(stderr, "POWER METER: ERROR: CUDA device not supported\n");
+            break;
+        default:
+            fprintf(stderr, "POWER METER: There was an error reading GPU energy consumption\n");
+            break;
         }
-        // Value returned by NVML is in mili Joules
-        data.energy[i] = (float)energy / 1E3;
+        return false;
+    }
+    energy = value;
+    return true;
+}
+
+void nvml_utils::update_gpu_energy(EnergyAux &data)
+{
+    data.counter.resize(num_GPUs);
+    for (unsigned int i = 0; i < num_GPUs; ++i)
+    {
+        // Kept in mili Joules as returned by NVML, converted when the results are computed
+        data.counter[i] = get_gpu_energy_counter(i);
     }
     // Update the timestamp
-    clock_gettime(CLOCK_REALTIME, &data.time);
+    clock_gettime(CLOCK_MONOTONIC, &data.time);
 }
 
 void nvml_utils::update_energy_data(EnergyData &output_data, const EnergyAux &previous_data, const EnergyAux &current_data)
@@ -57,9 +135,14 @@ void nvml_utils::update_energy_data(EnergyData &output_data, const EnergyAux &pr
     double time_diff =
         (double)(current_data.time.tv_sec - previous_data.time.tv_sec) +
         ((double)(current_data.time.tv_nsec - previous_data.time.tv_nsec) / 1E9);
-    // TODO: Implement this for a variable number of GPUs in the machine
-    auto energy_diff = current_data.energy[0] - previous_data.energy[0];
-    output_data.power = (float)(energy_diff / time_diff);
-    output_data.energy = energy_diff;
-    output_data.total_energy += energy_diff;
+    // NVML's counter is 64 bits wide, it doesn't wrap around
+    unsigned long long energy_mj = 0;
+    for (size_t i = 0; i < current_data.counter.size(); ++i)
+    {
+        energy_mj += current_data.counter[i] - previous_data.counter[i];
+    }
+    output_data.energy = (double)energy_mj / 1E3;
+    output_data.power = output_data.energy / time_diff;
+    output_data.total_mj += energy_mj;
+    output_data.total_energy = (double)output_data.total_mj / 1E3;
 }
\ No newline at end of file
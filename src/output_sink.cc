@@ -0,0 +1,323 @@
+#include "output_sink.hh"
+
+#include <algorithm>
+
+void power_meter::allocate_readings(const std::vector<SourceInfo> &sources, std::vector<SourceReading> &readings)
+{
+    readings.resize(sources.size());
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        readings[i].counters = std::make_unique<uint64_t[]>(sources[i].devices.size());
+        if (sources[i].device_times)
+        {
+            readings[i].device_times = std::make_unique<uint64_t[]>(sources[i].devices.size());
+        }
+    }
+}
+
+void power_meter::unpack_record(const uint64_t *record, const std::vector<SourceInfo> &sources,
+                                std::vector<SourceReading> &readings)
+{
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        size_t num_devices = sources[i].devices.size();
+        readings[i].time.tv_sec = (time_t)(record[0] / 1000000000ULL);
+        readings[i].time.tv_nsec = (long)(record[0] % 1000000000ULL);
+        std::copy(record + 1, record + 1 + num_devices, readings[i].counters.get());
+        record += 1 + num_devices;
+        if (sources[i].device_times)
+        {
+            std::copy(record, record + num_devices, readings[i].device_times.get());
+            record += num_devices;
+        }
+    }
+}
+
+/*
+Groups the devices of a source by domain, in order of first appearance. Sets the group of each
+device and returns the domains
+*/
+static std::vector<std::string> group_domains(const power_meter::SourceInfo &source, std::vector<unsigned int> &groups)
+{
+    std::vector<std::string> domains;
+    groups.clear();
+    for (const auto &device : source.devices)
+    {
+        auto domain = std::find(domains.begin(), domains.end(), device.domain);
+        groups.push_back((unsigned int)(domain - domains.begin()));
+        if (domain == domains.end())
+        {
+            domains.push_back(device.domain);
+        }
+    }
+    return domains;
+}
+
+power_meter::CsvSink::CsvSink(std::vector<std::ostream *> streams, bool interval_column)
+    : interval_column(interval_column)
+{
+    for (auto *stream : streams)
+    {
+        this->streams.push_back({stream});
+    }
+}
+
+void power_meter::CsvSink::begin(const std::vector<SourceInfo> &sources)
+{
+    this->sources = sources;
+    series.begin(sources);
+
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        const std::vector<std::string> &domains = series.domains(i);
+        // Write the header for the output files
+        std::ostream &out = *streams[i].stream;
+        out << "Power, Energy, Total energy";
+        for (size_t group = 1; group < domains.size(); ++group)
+        {
+            const auto &domain = domains[group];
+            out << ", " << domain << " power, " << domain << " energy, " << domain << " total energy";
+        }
+        if (streams[i].columns == DEVICE_COLUMNS)
+        {
+            for (const auto &device : sources[i].devices)
+            {
+                // Device names are only unique within a domain
+                std::string name = domains.size() > 1 ? device.name + " " + device.domain : device.name;
+                out << ", " << name << " power, " << name << " energy";
+            }
+        }
+        else if (streams[i].columns == TOP_DEVICES)
+        {
+            for (unsigned int rank = 1; rank <= std::min<size_t>(streams[i].top_n, sources[i].devices.size()); ++rank)
+            {
+                out << ", Top " << rank << ", Top " << rank << " power";
+            }
+        }
+        if (interval_column)
+        {
+            out << ", Interval";
+        }
+        out << std::endl;
+    }
+}
+
+void power_meter::CsvSink::write_sample(const SourceReading *readings)
+{
+    if (!series.update(readings))
+    {
+        return;
+    }
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        const auto &devices = sources[i].devices;
+        const auto &source_counters = series.devices(i);
+        const double *energy = source_counters.energy();
+        const double *power = source_counters.power();
+        std::ostream &out = *streams[i].stream;
+        const EnergyData *results = series.results(i);
+        // A source without devices still writes its (zero) series
+        size_t num_domains = std::max<size_t>(series.domains(i).size(), 1);
+        for (size_t group = 0; group < num_domains; ++group)
+        {
+            EnergyData result = group < series.domains(i).size() ? results[group] : EnergyData{};
+            out << (group == 0 ? "" : ",") << result.power << "," << result.energy << "," << result.total_energy;
+        }
+
+        if (streams[i].columns == DEVICE_COLUMNS)
+        {
+            for (size_t device = 0; device < devices.size(); ++device)
+            {
+                out << "," << power[device] << "," << energy[device];
+            }
+        }
+        else if (streams[i].columns == TOP_DEVICES)
+        {
+            // Every device shares the interval, ranking by energy ranks by power
+            size_t top_n = std::min<size_t>(streams[i].top_n, devices.size());
+            ranking.resize(devices.size());
+            for (unsigned int device = 0; device < ranking.size(); ++device)
+            {
+                ranking[device] = device;
+            }
+            std::partial_sort(ranking.begin(), ranking.begin() + top_n, ranking.end(),
+                              [&](unsigned int a, unsigned int b) { return energy[a] > energy[b]; });
+            for (size_t rank = 0; rank < top_n; ++rank)
+            {
+                out << "," << devices[ranking[rank]].name << "," << power[ranking[rank]];
+            }
+        }
+        if (interval_column)
+        {
+            out << "," << series.interval(i);
+        }
+        out << '\n';
+    }
+}
+
+void power_meter::CsvSink::flush()
+{
+    for (auto &stream : streams)
+    {
+        stream.stream->flush();
+    }
+}
+
+void power_meter::CsvSink::end()
+{
+    flush();
+}
+
+void power_meter::MarkerSink::begin(const std::vector<SourceInfo> & /*sources*/)
+{
+    samples = 0;
+    *stream << "Time, Row, Event, Name, Thread" << std::endl;
+}
+
+void power_meter::MarkerSink::write_sample(const SourceReading *readings)
+{
+    if (samples++ == 0)
+    {
+        start_ns = (long long)readings[0].time.tv_sec * 1000000000LL + readings[0].time.tv_nsec;
+    }
+}
+
+void power_meter::MarkerSink::write_marker(const Marker &marker)
+{
+    static const char *events[] = {"", "mark", "begin", "end", "region begin", "region end"};
+    // Row n covers the interval between samples n - 1 and n, markers before the first sample
+    // are put at its time
+    double time = samples == 0 ? 0 : (double)((long long)marker.time_ns - start_ns) / 1E9;
+    *stream << time << "," << samples << ","
+            << events[marker.type <= MARKER_REGION_END ? marker.type : 0] << "," << marker.name << ","
+            << marker.thread << '\n';
+}
+
+void power_meter::MarkerSink::flush()
+{
+    stream->flush();
+}
+
+void power_meter::MarkerSink::end()
+{
+    flush();
+}
+
+void power_meter::DomainSeries::begin(const std::vector<SourceInfo> &sources)
+{
+    this->sources = sources;
+    source_domains.assign(sources.size(), {});
+    device_groups.assign(sources.size(), {});
+    previous_time.assign(sources.size(), {});
+    time_diff.assign(sources.size(), 0);
+    counters.assign(sources.size(), {});
+    domain_results.assign(sources.size(), {});
+    first_sample = true;
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        source_domains[i] = group_domains(sources[i], device_groups[i]);
+        domain_results[i].resize(source_domains[i].size());
+        counters[i].init(sources[i].devices);
+    }
+}
+
+bool power_meter::DomainSeries::update(const SourceReading *readings)
+{
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        const auto &devices = sources[i].devices;
+        time_diff[i] = get_time_diff(previous_time[i], readings[i].time);
+        previous_time[i] = readings[i].time;
+        auto &source_counters = counters[i];
+        const uint64_t *device_times = sources[i].device_times ? readings[i].device_times.get() : nullptr;
+        if (device_times)
+        {
+            source_counters.update(readings[i].counters.get(), device_times);
+        }
+        else
+        {
+            source_counters.update(readings[i].counters.get(), time_diff[i]);
+        }
+        if (first_sample)
+        {
+            continue;
+        }
+
+        auto &results = domain_results[i];
+        for (auto &result : results)
+        {
+            result = EnergyData{};
+        }
+        for (size_t device = 0; device < devices.size(); ++device)
+        {
+            auto &result = results[device_groups[i][device]];
+            result.power += source_counters.power()[device];
+            result.energy += source_counters.energy()[device];
+            result.total_energy += source_counters.total_energy(device);
+        }
+        // Devices read together share the interval of the source
+        if (!device_times)
+        {
+            for (auto &result : results)
+            {
+                result.power = time_diff[i] > 0 ? result.energy / time_diff[i] : 0;
+            }
+        }
+    }
+    bool updated = !first_sample;
+    first_sample = false;
+    return updated;
+}
+
+void power_meter::SummarySink::begin(const std::vector<SourceInfo> &sources)
+{
+    series.begin(sources);
+    summary = RunSummary{};
+    first_sample = true;
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        for (const auto &domain : series.domains(i))
+        {
+            summary.domains.push_back({sources[i].label, domain});
+        }
+    }
+}
+
+void power_meter::SummarySink::write_sample(const SourceReading *readings)
+{
+    if (series.num_sources() == 0)
+    {
+        return;
+    }
+    if (first_sample)
+    {
+        start_time = readings[0].time;
+        first_sample = false;
+    }
+    summary.duration = get_time_diff(start_time, readings[0].time);
+    if (!series.update(readings))
+    {
+        return;
+    }
+    size_t first = 0;
+    for (size_t i = 0; i < series.num_sources(); ++i)
+    {
+        const EnergyData *results = series.results(i);
+        for (size_t group = 0; group < series.domains(i).size(); ++group)
+        {
+            auto &domain = summary.domains[first + group];
+            domain.energy = results[group].total_energy;
+            domain.peak_power = std::max(domain.peak_power, results[group].power);
+        }
+        first += series.domains(i).size();
+    }
+}
+
+void power_meter::SummarySink::end()
+{
+    for (auto &domain : summary.domains)
+    {
+        domain.mean_power = summary.duration > 0 ? domain.energy / summary.duration : 0;
+    }
+    output = summary;
+}
@@ -1,56 +1,493 @@
 #include "power_meter.hh"
 #include "rapl_utils.hh"
 #include "nvml_utils.hh"
-#include "msr_reader.hh"
+#include "rapl_source.hh"
+#include "nvml_source.hh"
+#include "core_energy_source.hh"
+#include "powercap_source.hh"
+#include "output_sink.hh"
+#include "trace_format.hh"
+#include "trace_event_sink.hh"
+#include "sample_ring.hh"
+#include "histogram.hh"
+#include "region.hh"
 
-#include <nvml.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
 #include <thread>
 #include <chrono>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+// Time the writer thread waits before draining the ring again when it finds it empty
+#define WRITER_PERIOD_MS 10
+// Capacity of the sample ring of an engine launched by a Meter
+#define DEFAULT_RING_CAPACITY 4096
 
 // Initialize global variables
 namespace power_meter
 {
-    bool do_monitoring{true};
+    std::atomic<bool> do_monitoring{true};
     std::thread monitoring_thread;
+    std::thread writer_thread;
+    int sampler_core{-1};
+    int sampler_priority{0};
+    std::unique_ptr<EnergySource> cpu_source;
+    std::unique_ptr<EnergySource> gpu_source;
+    bool gpu_energy{true};
+    std::unique_ptr<EnergySource> core_source;
+    OUTPUT_FORMAT output_format{CSV};
     std::filesystem::path output_dir{"power_meter_out"};
     std::filesystem::path cpu_out_filename{"cpu"};
     std::filesystem::path gpu_out_filename{"gpu"};
+    std::filesystem::path trace_filename{"trace.pmt"};
+    bool trace_pyramid{false};
+    std::filesystem::path timeline_filename;
+    std::filesystem::path core_out_filename{"cpu_cores"};
+    std::filesystem::path markers_out_filename{"markers"};
+    bool device_columns{true};
+    CSV_COLUMNS core_columns{DEVICE_COLUMNS};
+    unsigned int core_top_n{8};
     std::ofstream cpu_out;
     std::ofstream gpu_out;
+    std::ofstream core_out;
+    std::ofstream markers_out;
+
+    // Sources read by the monitoring loop: CPU, GPU and, if enabled, the per-core counters
+    std::vector<EnergySource *> active_sources;
+    // The same sources as described to the sinks
+    std::vector<SourceInfo> sources;
+    // Sinks added with add_output_sink, for the next run of the default meter
+    std::vector<std::unique_ptr<OutputSink>> user_sinks;
+    // Meter of launch_monitoring_loop, writing to the outputs configured here
+    std::unique_ptr<Meter> default_meter;
+    // Samples taken by the monitoring loop, waiting for the writer thread
+    std::unique_ptr<SampleRing> sample_ring;
+    std::atomic<bool> do_writing{false};
+
+    // Serializes launching and stopping the engine and attaching and detaching meters
+    std::mutex engine_lock;
+    bool engine_running{false};
+    // Interval the monitoring loop samples at, the shortest of the meters'
+    std::atomic<long long> engine_interval_ns{0};
+    // Meters the writer thread hands the samples to, and the number of samples it handed them
+    std::mutex meters_lock;
+    std::vector<Meter *> meters;
+    unsigned long long written_records{0};
+    std::condition_variable drained_cv;
+
+    // Sampling period statistics, only touched by the monitoring thread while it runs
+    LogHistogram period_histogram;
+    JitterStats jitter_stats;
+
+    AdaptiveSampling adaptive_sampling;
+    AdaptiveController adaptive_controller;
+
+    std::vector<std::chrono::milliseconds> live_windows{std::chrono::seconds(1), std::chrono::seconds(10)};
+    LiveStats live_stats;
+
+    std::string shm_name;
+    size_t shm_capacity{4096};
+    ShmPublisher shm_publisher;
+}
+
+static long long monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+Applies the configured affinity and scheduling priority to the calling thread
+*/
+static void place_sampler_thread()
+{
+    using namespace power_meter;
+    if (sampler_core >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(sampler_core, &cpus);
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (error != 0)
+        {
+            fprintf(stderr, "POWER METER: WARNING: Could not pin the monitoring thread to core %d: %s\n",
+                    sampler_core, strerror(error));
+        }
+    }
+    if (sampler_priority > 0)
+    {
+        struct sched_param param{};
+        param.sched_priority = sampler_priority;
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error != 0)
+        {
+            fprintf(stderr, "POWER METER: WARNING: Could not set the monitoring thread's priority to %d: %s\n",
+                    sampler_priority, strerror(error));
+        }
+    }
+}
+
+/*
+Fills a ring record with a reading of every source: for each source its timestamp in ns
+followed by the raw counter of each of its devices, and the time of each device's reading
+for sources with per-device timestamps
+*/
+static void read_sources(uint64_t *record)
+{
+    using namespace power_meter;
+    for (auto *source : active_sources)
+    {
+        struct timespec time;
+        source->read_counters(time, record + 1);
+        record[0] = (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+        if (const uint64_t *times = source->device_times())
+        {
+            std::copy(times, times + source->num_devices(), record + 1 + source->num_devices());
+        }
+        record += source->record_words();
+    }
+}
+
+bool power_meter::launch_monitoring_loop(unsigned int sampling_interval_ms, size_t ring_capacity)
+{
+    return launch_monitoring_loop(std::chrono::milliseconds(sampling_interval_ms), ring_capacity);
+}
+
+/*
+Initializes the CPU source used when none was set: RAPL through the MSRs when they can be read,
+otherwise through powercap, which doesn't need root
+*/
+static int init_default_cpu_source()
+{
+    using namespace power_meter;
+    auto rapl = std::make_unique<RaplSource>();
+    if (rapl->init() == 0)
+    {
+        cpu_source = std::move(rapl);
+        return 0;
+    }
+    printf("POWER METER: Could not use RAPL, using powercap\n");
+    auto powercap = std::make_unique<PowercapSource>();
+    if (powercap->init() != 0)
+    {
+        return 1;
+    }
+    cpu_source = std::move(powercap);
+    return 0;
 }
 
-void power_meter::launch_monitoring_loop(unsigned int sampling_interval_ms)
-{   
-    // Check whether we have access to the MSR files
-    rapl_utils::open_msr(0);
-    // Intel: Initialize internal counters
-    if (rapl_utils::init() != 0)
+/*
+Initializes the sources and launches the monitoring and writer threads, sampling every
+sampling_interval. Called with engine_lock held
+*/
+static bool start_engine(std::chrono::microseconds sampling_interval, size_t ring_capacity)
+{
+    using namespace power_meter;
+    // NVML is only loaded when the GPUs are measured
+    if (!gpu_source && gpu_energy)
+    {
+        gpu_source = std::make_unique<NvmlSource>();
+    }
+
+    // CPU: Initialize internal counters. A RAPL source set by the user fails without access to
+    // the MSR files, by default we fall back to powercap
+    if (cpu_source ? cpu_source->init() != 0 : init_default_cpu_source() != 0)
     {
         fprintf(stderr, "POWER METER: An error was encountered during initialization\n");
-        return;
+        return false;
     }
-    // Open output files
-    std::filesystem::create_directory(output_dir);
-    cpu_out.open(output_dir / cpu_out_filename);
-    gpu_out.open(output_dir / gpu_out_filename);
-
-    // CUDA: Start nvml
-    nvmlInit_v2();
-    // Intel: Initialize number of GPUs and device handles
-    nvml_utils::init();
-    // Launch monitoring on a separate thread
+    // GPU: Initialize number of GPUs and device handles
+    if (gpu_source && gpu_source->init() != 0)
+    {
+        fprintf(stderr, "POWER METER: An error was encountered during initialization\n");
+        cpu_source->shutdown();
+        return false;
+    }
+    active_sources = {cpu_source.get()};
+    sources = {{cpu_out_filename.string(), cpu_source->name(), cpu_source->devices(), cpu_source->device_times() != nullptr}};
+    if (gpu_source)
+    {
+        active_sources.push_back(gpu_source.get());
+        sources.push_back({gpu_out_filename.string(), gpu_source->name(), gpu_source->devices(),
+                           gpu_source->device_times() != nullptr});
+    }
+    // Per-core counters are optional, the loop runs without them if they can't be read
+    if (core_source)
+    {
+        if (core_source->init() == 0)
+        {
+            active_sources.push_back(core_source.get());
+            sources.push_back({core_out_filename.string(), core_source->name(), core_source->devices(),
+                               core_source->device_times() != nullptr});
+        }
+        else
+        {
+            fprintf(stderr, "POWER METER: WARNING: Per-core energy is disabled\n");
+            core_source.reset();
+        }
+    }
+
+    // Past the maximum safe interval a counter could wrap around twice between samples, which
+    // can't be told apart from a single wraparound
+    long long safe_interval = get_max_safe_interval_ns(active_sources);
+    if (adaptive_sampling.enabled)
+    {
+        adaptive_controller.begin(adaptive_sampling, (long long)sampling_interval.count() * 1000, active_sources);
+    }
+    else if ((long long)sampling_interval.count() * 1000 > safe_interval)
+    {
+        fprintf(stderr, "POWER METER: WARNING: Counters may wrap around more than once between samples, "
+                        "the sampling interval should not exceed %lld us\n",
+                safe_interval / 1000);
+    }
+
+    // A timestamp and the counters (and device times) of each source per record
+    size_t record_words = 0;
+    for (auto *source : active_sources)
+    {
+        record_words += source->record_words();
+    }
+    sample_ring = std::make_unique<SampleRing>(ring_capacity, record_words);
+    written_records = 0;
+    // Markers issued while the loop wasn't running
+    marker_queue.clear();
+    live_stats.begin(active_sources, live_windows);
+    if (!shm_name.empty() &&
+        !shm_publisher.open(shm_name, sources, shm_capacity,
+                            adaptive_sampling.enabled ? 0 : (uint32_t)sampling_interval.count()))
+    {
+        fprintf(stderr, "POWER METER: WARNING: Samples are not published to shared memory\n");
+    }
+
+    // Launch the writer and the monitoring on separate threads
+    engine_interval_ns = (long long)sampling_interval.count() * 1000;
+    do_writing = true;
+    writer_thread = std::thread(writer_loop);
     do_monitoring = true;
-    monitoring_thread = std::thread(monitoring_loop, sampling_interval_ms);
+    monitoring_thread = std::thread(static_cast<void (*)(std::chrono::microseconds)>(monitoring_loop), sampling_interval);
+    engine_running = true;
+    return true;
 }
 
-void power_meter::stop_monitoring_loop()
+/*
+Stops the monitoring and writer threads once every sample taken has been written, and releases
+the sources. Called with engine_lock held
+*/
+static void stop_engine()
 {
-    // Stop monitoring thread
+    using namespace power_meter;
+    // Stop monitoring thread, waking it up if it's waiting for an adaptive sample
     do_monitoring = false;
+    if (adaptive_sampling.enabled)
+    {
+        adaptive_controller.wake();
+    }
     monitoring_thread.join();
-    // CUDA: Stop nvml
-    nvmlShutdown();
+    // Let the writer drain the remaining samples
+    do_writing = false;
+    writer_thread.join();
+    engine_running = false;
+    if (sample_ring->dropped_records() != 0)
+    {
+        fprintf(stderr, "POWER METER: WARNING: %llu samples were dropped because the output could not keep up\n",
+                sample_ring->dropped_records());
+    }
+    printf("POWER METER: Sampling period (us): min %.1f, mean %.1f, max %.1f, p99 %.1f over %llu samples, %llu overruns\n",
+           jitter_stats.min_us, jitter_stats.mean_us, jitter_stats.max_us, jitter_stats.p99_us,
+           jitter_stats.samples, jitter_stats.overruns);
+    shm_publisher.close();
+    // Report the energy regions measured while the loop was running, if any
+    print_region_summary();
+    // Release the resources held by the sources (MSR descriptors, NVML, per-core readers)
+    if (core_source)
+    {
+        core_source->shutdown();
+    }
+    cpu_source->shutdown();
+    if (gpu_source)
+    {
+        gpu_source->shutdown();
+    }
+}
+
+/*
+The engine samples at the shortest interval of its meters. Called with meters_lock held
+*/
+static void update_engine_interval()
+{
+    using namespace power_meter;
+    long long interval = LLONG_MAX;
+    for (const Meter *meter : meters)
+    {
+        interval = std::min<long long>(interval, (long long)meter->interval().count() * 1000);
+    }
+    if (interval != LLONG_MAX)
+    {
+        engine_interval_ns = interval;
+    }
+}
+
+/*
+Subscribes a meter to the running engine. Called with engine_lock held
+*/
+static void attach_meter_locked(power_meter::Meter *meter)
+{
+    using namespace power_meter;
+    meter->bind(sources);
+    std::lock_guard<std::mutex> guard(meters_lock);
+    meters.push_back(meter);
+    update_engine_interval();
+}
+
+/*
+Unsubscribes a meter, stopping the engine after its last meter. Returns whether the engine was
+stopped. Called with engine_lock held
+*/
+static bool detach_meter_locked(power_meter::Meter *meter)
+{
+    using namespace power_meter;
+    bool last = meters.size() == 1;
+    if (last)
+    {
+        // The writer drains every sample to the meter before it stops
+        stop_engine();
+    }
+    {
+        std::unique_lock<std::mutex> guard(meters_lock);
+        if (!last)
+        {
+            // Wait for the writer to hand the meter the samples taken until now
+            unsigned long long taken = sample_ring->published_records();
+            drained_cv.wait(guard, [&] { return written_records >= taken; });
+        }
+        meters.erase(std::remove(meters.begin(), meters.end(), meter), meters.end());
+        update_engine_interval();
+    }
+    meter->unbind();
+    return last;
+}
+
+bool power_meter::attach_meter(Meter *meter)
+{
+    std::lock_guard<std::mutex> guard(engine_lock);
+    if (!engine_running && !start_engine(meter->interval(), DEFAULT_RING_CAPACITY))
+    {
+        return false;
+    }
+    attach_meter_locked(meter);
+    return true;
+}
+
+void power_meter::detach_meter(Meter *meter)
+{
+    std::lock_guard<std::mutex> guard(engine_lock);
+    detach_meter_locked(meter);
+}
+
+bool power_meter::launch_monitoring_loop(std::chrono::microseconds sampling_interval, size_t ring_capacity)
+{
+    std::lock_guard<std::mutex> guard(engine_lock);
+    if (default_meter)
+    {
+        fprintf(stderr, "POWER METER: ERROR: The monitoring loop is already running, use a Meter for another session\n");
+        return false;
+    }
+    if (!engine_running && !start_engine(sampling_interval, ring_capacity))
+    {
+        return false;
+    }
+    default_meter = std::make_unique<Meter>(sampling_interval);
+
+    // Open output files
+    if (output_format != NO_OUTPUT)
+    {
+        std::filesystem::create_directory(output_dir);
+    }
+    if (output_format == BINARY || output_format == BINARY_COMPRESSED)
+    {
+        TraceInfo info;
+        info.sampling_interval_us = adaptive_sampling.enabled ? 0 : (uint32_t)sampling_interval.count();
+        info.energy_increment = rapl_utils::energy_increment;
+        info.vendor_id = rapl_utils::vendor_id;
+        info.numa_nodes = (uint32_t)rapl_utils::numa_nodes;
+        info.numcores = (uint32_t)rapl_utils::numcores;
+        info.num_gpus = nvml_utils::num_GPUs;
+        default_meter->add_sink(std::make_unique<BinarySink>(output_dir / trace_filename, info,
+                                                             output_format == BINARY_COMPRESSED, trace_pyramid));
+    }
+    else if (output_format == CHROME_JSON)
+    {
+        auto filename = timeline_filename.empty() ? std::filesystem::path{"trace.json"} : timeline_filename;
+        default_meter->add_sink(std::make_unique<ChromeTraceSink>(output_dir / filename));
+    }
+    else if (output_format == PERFETTO)
+    {
+        auto filename = timeline_filename.empty() ? std::filesystem::path{"trace.perfetto-trace"} : timeline_filename;
+        default_meter->add_sink(std::make_unique<PerfettoSink>(output_dir / filename));
+    }
+    else if (output_format == CSV)
+    {
+        cpu_out.open(output_dir / cpu_out_filename);
+        // The per-device columns would repeat the aggregate series of a single device
+        auto columns = [](const EnergySource &source)
+        { return device_columns && source.num_devices() > 1 ? DEVICE_COLUMNS : DOMAIN_COLUMNS; };
+        std::vector<CsvStream> streams{{&cpu_out, columns(*cpu_source)}};
+        if (gpu_source)
+        {
+            gpu_out.open(output_dir / gpu_out_filename);
+            streams.push_back({&gpu_out, columns(*gpu_source)});
+        }
+        if (core_source)
+        {
+            core_out.open(output_dir / core_out_filename);
+            streams.push_back({&core_out, core_columns, core_top_n});
+        }
+        default_meter->add_sink(std::make_unique<CsvSink>(streams, adaptive_sampling.enabled));
+        markers_out.open(output_dir / markers_out_filename);
+        default_meter->add_sink(std::make_unique<MarkerSink>(&markers_out));
+    }
+    for (auto &sink : user_sinks)
+    {
+        default_meter->add_sink(std::move(sink));
+    }
+    user_sinks.clear();
+    attach_meter_locked(default_meter.get());
+    return true;
+}
+
+void power_meter::stop_monitoring_loop()
+{
+    std::lock_guard<std::mutex> guard(engine_lock);
+    if (!default_meter)
+    {
+        return;
+    }
+    detach_meter_locked(default_meter.get());
+    default_meter.reset();
+    // Close the outputs
+    if (cpu_out.is_open())
+    {
+        cpu_out.close();
+    }
+    if (gpu_out.is_open())
+    {
+        gpu_out.close();
+    }
+    if (core_out.is_open())
+    {
+        core_out.close();
+    }
+    if (markers_out.is_open())
+    {
+        markers_out.close();
+    }
 }
 
 /*
@@ -58,45 +495,284 @@ Power measurement loop, intended to run on a separate thread
 */
 void power_meter::monitoring_loop(unsigned int sampling_interval_ms)
 {
-    // Structs used to take measurements from Intel/AMD's RAPL interface
-    rapl_utils::EnergyAux cpu_pkg_data;
-    rapl_utils::EnergyAux current_cpu_pkg_data;
-    rapl_utils::EnergyData cpu_pkg_results;
-    // Struct used to take measurements from Nvidia NVML
-    nvml_utils::EnergyAux cuda_data;
-    nvml_utils::EnergyAux current_cuda_data;
-    nvml_utils::EnergyData cuda_results;
+    monitoring_loop(std::chrono::milliseconds(sampling_interval_ms));
+}
+
+void power_meter::monitoring_loop(std::chrono::microseconds sampling_interval)
+{
+    place_sampler_thread();
+    const bool adaptive = adaptive_sampling.enabled;
+    long long interval_ns = std::max<long long>(sampling_interval.count(), 1) * 1000;
+
+    period_histogram.clear();
+    jitter_stats = JitterStats{};
+    long long min_period = 0, max_period = 0;
 
     // Get the initial energy readings
-    // CPU: Get the current energy measurement for RAPL's package domain
-    rapl_utils::update_package_energy(cpu_pkg_data);
-    // CUDA
-    nvml_utils::update_gpu_energy(cuda_data);
+    long long deadline = monotonic_ns();
+    const long long first_sample = deadline;
+    long long last_sample = deadline;
+    if (uint64_t *record = sample_ring->claim())
+    {
+        read_sources(record);
+        if (shm_publisher.is_open())
+        {
+            shm_publisher.publish(record);
+        }
+        if (adaptive)
+        {
+            interval_ns = adaptive_controller.next_interval(record, deadline);
+        }
+        sample_ring->publish();
+    }
+
+    while (do_monitoring.load(std::memory_order_relaxed))
+    {
+        // The meters may have changed the interval since the last sample
+        if (!adaptive && engine_interval_ns.load(std::memory_order_relaxed) > 0)
+        {
+            interval_ns = engine_interval_ns.load(std::memory_order_relaxed);
+        }
+        // Sleep until an absolute deadline, the time spent sampling doesn't delay the next sample
+        deadline += interval_ns;
+        if (adaptive)
+        {
+            // A burst requested while waiting for a slow sample starts right away
+            if (adaptive_controller.sleep_until(deadline))
+            {
+                deadline = std::min(deadline, monotonic_ns());
+            }
+        }
+        else
+        {
+            struct timespec wakeup{(time_t)(deadline / 1000000000LL), (long)(deadline % 1000000000LL)};
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, nullptr) == EINTR)
+            {
+            }
+        }
 
-    // Write the header for the output files
-    auto output_header = "Power, Energy, Total energy";
-    cpu_out << output_header << std::endl;
-    gpu_out << output_header << std::endl;
+        long long now = monotonic_ns();
+        long long period = now - last_sample;
+        last_sample = now;
+        period_histogram.add((uint64_t)period);
+        min_period = jitter_stats.samples == 0 ? period : std::min(min_period, period);
+        max_period = std::max(max_period, period);
+        ++jitter_stats.samples;
 
-    while (do_monitoring)
+        // If we fell behind by a whole interval or more, skip the missed deadlines instead of
+        // sampling in a burst to catch up
+        if (now - deadline >= interval_ns)
+        {
+            long long missed = (now - deadline) / interval_ns;
+            jitter_stats.overruns += (unsigned long long)missed;
+            deadline += missed * interval_ns;
+        }
+
+        // Update energy measurements, the writer thread computes energy and power from them.
+        // If the ring is full the sample is dropped, the counters being cumulative the next
+        // sample written accounts for its energy
+        if (uint64_t *record = sample_ring->claim())
+        {
+            read_sources(record);
+            if (shm_publisher.is_open())
+            {
+                shm_publisher.publish(record);
+            }
+            // The next interval depends on the power measured by this sample
+            if (adaptive)
+            {
+                interval_ns = adaptive_controller.next_interval(record, now);
+            }
+            sample_ring->publish();
+        }
+    }
+
+    if (jitter_stats.samples != 0)
+    {
+        jitter_stats.min_us = (double)min_period / 1E3;
+        jitter_stats.max_us = (double)max_period / 1E3;
+        jitter_stats.mean_us = (double)(last_sample - first_sample) / 1E3 / (double)jitter_stats.samples;
+        // The histogram approximates within a bucket, keep the percentile within the observed range
+        jitter_stats.p99_us = (double)std::clamp<long long>((long long)period_histogram.percentile(0.99),
+                                                            min_period, max_period) / 1E3;
+    }
+}
+
+/*
+Hands the markers issued up to time_ns to the meters, before the sample taken at time_ns.
+Called by the writer thread with meters_lock held
+*/
+static void write_markers(uint64_t time_ns)
+{
+    using namespace power_meter;
+    while (const Marker *marker = marker_queue.front())
+    {
+        if (marker->time_ns > time_ns)
+        {
+            break;
+        }
+        for (Meter *meter : meters)
+        {
+            meter->write_marker(*marker);
+        }
+        marker_queue.pop();
+    }
+}
+
+/*
+Output loop, intended to run on a separate thread. Drains the samples taken by the
+monitoring loop in batches and hands them to the meters
+*/
+void power_meter::writer_loop()
+{
+    std::vector<SourceReading> readings;
+    allocate_readings(sources, readings);
+
+    while (true)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(sampling_interval_ms));
-        // CPU: Update energy measurements
-        rapl_utils::update_package_energy(current_cpu_pkg_data);
-        // CPU: Compute energy and average power usage for this interval, update total energy consumption
-        rapl_utils::update_energy_data(cpu_pkg_results, cpu_pkg_data, current_cpu_pkg_data);
-        // CUDA: Update energy measurements
-        nvml_utils::update_gpu_energy(current_cuda_data);
-        // CUDA: Compute energy and average power usage for this interval, update total energy consumption
-        nvml_utils::update_energy_data(cuda_results, cuda_data, current_cuda_data);
+        // Checked before draining, everything published before stopping gets written
+        bool stopping = !do_writing.load(std::memory_order_acquire);
+        size_t batch = sample_ring->available();
+        // Off the sampler, whose loop stays allocation-free
+        for (size_t i = 0; i < batch; ++i)
+        {
+            const uint64_t *record = sample_ring->peek(i);
+            live_stats.update(record, (long long)record[0]);
+        }
+        {
+            std::lock_guard<std::mutex> guard(meters_lock);
+            const long long interval_ns = engine_interval_ns.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < batch; ++i)
+            {
+                const uint64_t *record = sample_ring->peek(i);
+                write_markers(record[0]);
+                unpack_record(record, sources, readings);
+                for (Meter *meter : meters)
+                {
+                    meter->write_sample(readings, (long long)record[0], interval_ns);
+                }
+            }
+            // The markers issued after the last sample go out when the loop stops
+            if (batch == 0 && stopping)
+            {
+                write_markers(UINT64_MAX);
+            }
+            if (batch != 0 || stopping)
+            {
+                for (Meter *meter : meters)
+                {
+                    meter->flush();
+                }
+            }
+            written_records += batch;
+        }
+        sample_ring->release(batch);
+
+        if (batch != 0)
+        {
+            drained_cv.notify_all();
+        }
+        else if (stopping)
+        {
+            break;
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(WRITER_PERIOD_MS));
+        }
+    }
+}
+
+power_meter::JitterStats power_meter::get_jitter_stats()
+{
+    return jitter_stats;
+}
+
+void power_meter::set_sampler_affinity(int core)
+{
+    sampler_core = core;
+}
+
+void power_meter::set_sampler_priority(int priority)
+{
+    sampler_priority = priority;
+}
 
-        // Swap structs for the next iteration
-        std::swap(cpu_pkg_data, current_cpu_pkg_data);
-        std::swap(cuda_data, current_cuda_data);
+unsigned long long power_meter::get_dropped_samples()
+{
+    return sample_ring ? sample_ring->dropped_records() : 0;
+}
+
+void power_meter::set_adaptive_sampling(AdaptiveSampling config)
+{
+    adaptive_sampling = config;
+}
+
+void power_meter::request_burst(std::chrono::milliseconds duration)
+{
+    adaptive_controller.request_burst(monotonic_ns() + std::chrono::nanoseconds(duration).count());
+}
+
+std::chrono::microseconds power_meter::get_max_safe_interval()
+{
+    long long interval = adaptive_sampling.enabled ? adaptive_controller.max_safe_interval()
+                                                   : get_max_safe_interval_ns(active_sources);
+    return std::chrono::microseconds(interval == LLONG_MAX ? LLONG_MAX : interval / 1000);
+}
+
+void power_meter::set_shm_publishing(std::string name, size_t capacity)
+{
+    shm_name = std::move(name);
+    shm_capacity = capacity;
+}
+
+void power_meter::set_cpu_source(std::unique_ptr<EnergySource> source)
+{
+    cpu_source = std::move(source);
+}
+
+void power_meter::set_live_windows(std::vector<std::chrono::milliseconds> windows)
+{
+    live_windows = std::move(windows);
+}
 
-        cpu_out << cpu_pkg_results.power << "," << cpu_pkg_results.energy << "," << cpu_pkg_results.total_energy << std::endl;
-        gpu_out << cuda_results.power << "," << cuda_results.energy << "," << cuda_results.total_energy << std::endl;
+int power_meter::get_live_source(const std::string &label)
+{
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        if (sources[i].label == label)
+        {
+            return (int)i;
+        }
     }
+    return -1;
+}
+
+bool power_meter::get_live_snapshot(int source, LiveSnapshot &snapshot)
+{
+    return source >= 0 && live_stats.snapshot((unsigned int)source, snapshot);
+}
+
+void power_meter::set_gpu_energy(bool enabled)
+{
+    gpu_energy = enabled;
+}
+
+void power_meter::set_gpu_source(std::unique_ptr<EnergySource> source)
+{
+    gpu_source = std::move(source);
+}
+
+void power_meter::enable_core_energy(CSV_COLUMNS columns, unsigned int top_n, unsigned int helper_threads)
+{
+    core_source = std::make_unique<CoreEnergySource>(helper_threads);
+    core_columns = columns;
+    core_top_n = top_n;
+}
+
+void power_meter::set_core_source(std::unique_ptr<EnergySource> source)
+{
+    core_source = std::move(source);
 }
 
 void power_meter::set_output_dir(std::string dir)
@@ -114,3 +790,42 @@ void power_meter::set_gpu_out_filename(std::string filename)
     gpu_out_filename = filename;
 }
 
+void power_meter::set_core_out_filename(std::string filename)
+{
+    core_out_filename = filename;
+}
+
+void power_meter::set_markers_out_filename(std::string filename)
+{
+    markers_out_filename = filename;
+}
+
+void power_meter::set_device_columns(bool enabled)
+{
+    device_columns = enabled;
+}
+
+void power_meter::set_output_format(OUTPUT_FORMAT format)
+{
+    output_format = format;
+}
+
+void power_meter::set_trace_filename(std::string filename)
+{
+    trace_filename = filename;
+}
+
+void power_meter::set_trace_pyramid(bool enabled)
+{
+    trace_pyramid = enabled;
+}
+
+void power_meter::set_timeline_filename(std::string filename)
+{
+    timeline_filename = filename;
+}
+
+void power_meter::add_output_sink(std::unique_ptr<OutputSink> sink)
+{
+    user_sinks.push_back(std::move(sink));
+}
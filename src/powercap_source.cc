@@ -0,0 +1,143 @@
+#include "powercap_source.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+namespace
+{
+    // A powercap zone found under the root
+    struct Zone
+    {
+        std::filesystem::path path;
+        int package;
+        // RAPL_DOMAIN of the zone, NUM_RAPL_DOMAINS for zones of other domains
+        int domain;
+        std::string domain_name;
+    };
+
+    // Powercap zone names of the RAPL domains
+    const char *ZONE_NAMES[] = {"package", "core", "uncore", "dram", "psys"};
+}
+
+/*
+Reads the first line of a sysfs attribute, returns false if it can't be read
+*/
+static bool read_attribute(const std::filesystem::path &path, std::string &value)
+{
+    std::ifstream file(path);
+    return (bool)std::getline(file, value);
+}
+
+int power_meter::PowercapSource::init()
+{
+    shutdown();
+    device_info.clear();
+
+    std::error_code error;
+    std::vector<Zone> zones;
+    for (const auto &entry : std::filesystem::directory_iterator(root, error))
+    {
+        // Zones are intel-rapl:<package> and subzones intel-rapl:<package>:<subzone>, also on AMD.
+        // intel-rapl-mmio zones duplicate the package counters
+        std::string dir = entry.path().filename().string();
+        if (dir.rfind("intel-rapl:", 0) != 0)
+        {
+            continue;
+        }
+        std::string zone_name;
+        if (!read_attribute(entry.path() / "name", zone_name))
+        {
+            continue;
+        }
+        Zone zone{entry.path(), atoi(dir.c_str() + strlen("intel-rapl:")), rapl_utils::NUM_RAPL_DOMAINS, zone_name};
+        // Package zones are named package-<N>
+        std::string domain = zone_name.substr(0, zone_name.find('-'));
+        for (int i = 0; i < rapl_utils::NUM_RAPL_DOMAINS; ++i)
+        {
+            if (domain == ZONE_NAMES[i])
+            {
+                zone.domain = i;
+                zone.domain_name = rapl_utils::RAPL_DOMAIN_NAMES[i];
+            }
+        }
+        // Zones of unknown domains are only kept when every domain is selected
+        if (zone.domain == rapl_utils::NUM_RAPL_DOMAINS ? domains == rapl_utils::ALL_RAPL_DOMAINS
+                                                        : (domains & (1U << zone.domain)) != 0)
+        {
+            zones.push_back(zone);
+        }
+    }
+    if (error)
+    {
+        fprintf(stderr, "POWER METER: Could not list the powercap zones in %s: %s\n", root.c_str(), error.message().c_str());
+        return 1;
+    }
+    if (zones.empty())
+    {
+        fprintf(stderr, "POWER METER: No RAPL zones found in %s\n", root.c_str());
+        return 1;
+    }
+
+    // Same device order as the MSR source, by domain and then by package
+    std::sort(zones.begin(), zones.end(), [](const Zone &a, const Zone &b)
+              { return a.domain != b.domain ? a.domain < b.domain : a.package < b.package; });
+    for (const auto &zone : zones)
+    {
+        std::string max_energy;
+        if (!read_attribute(zone.path / "max_energy_range_uj", max_energy))
+        {
+            fprintf(stderr, "POWER METER: Could not read %s\n", (zone.path / "max_energy_range_uj").c_str());
+            shutdown();
+            return 1;
+        }
+        // energy_uj is only readable by root unless the administrator allows it
+        int fd = open((zone.path / "energy_uj").c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            fprintf(stderr, "POWER METER: Could not open %s: %s\n", (zone.path / "energy_uj").c_str(), strerror(errno));
+            shutdown();
+            return 1;
+        }
+        fds.push_back(fd);
+        device_info.push_back({"package" + std::to_string(zone.package), zone.domain_name, 1E-6,
+                               strtoull(max_energy.c_str(), nullptr, 10) + 1});
+    }
+    values.assign(fds.size(), 0);
+    return 0;
+}
+
+void power_meter::PowercapSource::shutdown()
+{
+    for (int fd : fds)
+    {
+        close(fd);
+    }
+    fds.clear();
+}
+
+void power_meter::PowercapSource::read_counters(struct timespec &time, uint64_t *counters)
+{
+    char buffer[32];
+    for (size_t i = 0; i < fds.size(); ++i)
+    {
+        ssize_t size = pread(fds[i], buffer, sizeof(buffer) - 1, 0);
+        if (size > 0)
+        {
+            buffer[size] = '\0';
+            char *end = buffer;
+            uint64_t value = strtoull(buffer, &end, 10);
+            // Parsing nothing would read as a wraparound of the whole range
+            if (end != buffer)
+            {
+                values[i] = value;
+            }
+        }
+        counters[i] = values[i];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &time);
+}
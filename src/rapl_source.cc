@@ -0,0 +1,70 @@
+#include "rapl_source.hh"
+#include "msr_reader.hh"
+
+#include <string>
+
+int power_meter::RaplSource::init()
+{
+    device_info.clear();
+    reads.clear();
+    try
+    {
+        if (rapl_utils::init() != 0)
+        {
+            return 1;
+        }
+        system_tdp = rapl_utils::vendor_id == rapl_utils::VENDOR_ID::INTEL ? rapl_utils::get_processor_tdp() : 0;
+        package_tdp = system_tdp / rapl_utils::num_packages;
+        for (int domain = 0; domain < rapl_utils::NUM_RAPL_DOMAINS; ++domain)
+        {
+            if (!(domains & (1U << domain)) || !rapl_utils::domain_available[domain])
+            {
+                continue;
+            }
+            // The platform domain has a single counter for the whole system
+            int packages = domain == rapl_utils::PSYS ? 1 : rapl_utils::num_packages;
+            for (int i = 0; i < packages; ++i)
+            {
+                // RAPL energy counters are 32 bits wide
+                device_info.push_back({"package" + std::to_string(i), rapl_utils::RAPL_DOMAIN_NAMES[domain],
+                                       rapl_utils::get_domain_energy_increment(domain), 1ULL << 32});
+                reads.push_back({rapl_utils::open_msr_fd(rapl_utils::first_package_core[i]),
+                                 rapl_utils::get_domain_msr(domain), 0});
+            }
+        }
+    }
+    catch (const std::filesystem::filesystem_error &e)
+    {
+        // Opening the MSR devices throws, e.g. without root access
+        fprintf(stderr, "POWER METER: ERROR: Could not access the MSRs (%s)\n", e.what());
+        device_info.clear();
+        reads.clear();
+        return 1;
+    }
+    return 0;
+}
+
+double power_meter::RaplSource::max_power(unsigned int device) const
+{
+    // Every domain draws at most as much as its package, PSys covers the whole system
+    return device_info[device].domain == rapl_utils::RAPL_DOMAIN_NAMES[rapl_utils::PSYS] ? system_tdp : package_tdp;
+}
+
+void power_meter::RaplSource::shutdown()
+{
+    rapl_utils::close_msr_fds();
+}
+
+void power_meter::RaplSource::read_counters(struct timespec &time, uint64_t *counters)
+{
+    for (size_t i = 0; i < reads.size(); ++i)
+    {
+        uint64_t value = 0;
+        if (pread(reads[i].fd, &value, sizeof(value), reads[i].address) == sizeof(value))
+        {
+            reads[i].value = value & 0xFFFFFFFFULL;
+        }
+        counters[i] = reads[i].value;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &time);
+}
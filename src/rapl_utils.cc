@@ -1,9 +1,12 @@
 #include "rapl_utils.hh"
 #include "msr_reader.hh"
+#include "topology.hh"
 
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include <chrono>
+#include <vector>
 
 using namespace rapl_utils;
 
@@ -17,16 +20,22 @@ namespace rapl_utils
   unsigned long long AMD_MSR_PKG_ENERGY_STATUS_VALUES[AMD_MSR_PKG_ENERGY_STATUS_NUMFIELDS];
   unsigned long long INTEL_MSR_PP0_ENERGY_STATUS_VALUES[INTEL_MSR_PP0_ENERGY_STATUS_NUMFIELDS];
   unsigned long long AMD_MSR_CORE_ENERGY_STATUS_VALUES[AMD_MSR_CORE_ENERGY_STATUS_NUMFIELDS];
+  unsigned long long INTEL_MSR_PP1_ENERGY_STATUS_VALUES[INTEL_MSR_PP1_ENERGY_STATUS_NUMFIELDS];
+  unsigned long long INTEL_MSR_DRAM_ENERGY_STATUS_VALUES[INTEL_MSR_DRAM_ENERGY_STATUS_NUMFIELDS];
+  unsigned long long INTEL_MSR_PLATFORM_ENERGY_STATUS_VALUES[INTEL_MSR_PLATFORM_ENERGY_STATUS_NUMFIELDS];
   unsigned long long INTEL_MSR_PKG_POWER_INFO_VALUES[INTEL_MSR_PKG_POWER_INFO_NUMFIELDS];
 
   // Energy measurement variables
   float power_increment{0};
   float energy_increment{0};
   float time_increment{0};
+  float dram_energy_increment{0};
   float energy_counter_max{0};
+  bool domain_available[NUM_RAPL_DOMAINS]{};
 
   int numa_nodes{0};
-  std::unique_ptr<int[]> first_node_core;
+  int num_packages{0};
+  std::unique_ptr<int[]> first_package_core;
   int numcores{0};
   int vendor_id{-1};
 }
@@ -36,12 +45,41 @@ namespace rapl_utils
 //////////////////////////////////////////////////////////////////////
 
 /*
-Inititialize the increment variables. Detect if the machine has several NUMA
-nodes and processors, in case it does, it will initialize the variables for each
-one (In case the CPUs are different).
+Returns true on Intel server parts, whose DRAM domain ignores the energy unit in
+MSR_RAPL_POWER_UNIT. Same list of models as Linux's intel_rapl driver
+*/
+static bool has_fixed_dram_energy_unit()
+{
+  unsigned int eax, ebx, ecx, edx;
+  __asm__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+  unsigned int family = (eax >> 8) & 0xF;
+  unsigned int model = ((eax >> 4) & 0xF) | (((eax >> 16) & 0xF) << 4);
+  if (family != 6)
+  {
+    return false;
+  }
+  switch (model)
+  {
+  case 0x3F: // Haswell-X
+  case 0x4F: // Broadwell-X
+  case 0x56: // Broadwell-D
+  case 0x55: // Skylake-X, Cascade Lake, Cooper Lake
+  case 0x57: // Knights Landing
+  case 0x85: // Knights Mill
+  case 0x6A: // Ice Lake-X
+  case 0x6C: // Ice Lake-D
+  case 0x8F: // Sapphire Rapids
+  case 0xCF: // Emerald Rapids
+    return true;
+  default:
+    return false;
+  }
+}
 
-This function assumes there is a NUMA node per CPU, and a maximum of 8 CPUs per
-motherboard
+/*
+Inititialize the increment variables. Detect if the machine has several packages
+(sockets) or dies with their own RAPL counters from the CPU topology, in case it
+does, it will initialize the variables for each one (In case the CPUs are different).
 
 This function assumes that there may be different CPU models in each socket, but
 that both CPUs will have the same reporting precissions for RAPL values. This is
@@ -76,44 +114,46 @@ int rapl_utils::init()
     return 1;
   }
 
-  // Get the number of NUMA nodes. This file contains a list of node IDs
-  // separated by "-". The length in characters of the file will be 2 for 1 node
-  // (0 + \n), and increase by 2 for each succesive node
-  FILE *nodes = fopen("/sys/devices/system/node/online", "r");
-  char *nodelist = fgets((char *)malloc(16 * sizeof(char)), 16, nodes);
-  fclose(nodes);
-  numa_nodes = (int)strlen(nodelist) / 2;
-  free(nodelist);
-
-  // Allocate space for the variables of each node
-  first_node_core = std::make_unique<int[]>(numa_nodes);
-
-  // Read the values for each node
-  for (int i = 0; i < numa_nodes; i++)
+  // RAPL's counters are per package, or per die on Intel parts with several dies per
+  // package, no matter how many NUMA nodes a package is split into (SNC, NPS). Read them
+  // once on the first core of each package
+  const auto &cpu_topology = topology::get_topology();
+  if (cpu_topology.cpus.empty())
   {
-    char filename[64];
-    snprintf(filename, 64, "/sys/devices/system/node/node%d/cpulist", i);
-    FILE *cpulist = fopen(filename, "r");
-    // Reads the file and gets the first token (The id of the first core in the
-    // NUMA node)
-    first_node_core[i] = atoi(
-        strtok(fgets((char *)malloc(16 * sizeof(char)), 16, cpulist), "-"));
-    fclose(cpulist);
+    fprintf(stderr, "POWER METER: ERROR: Could not read the CPU topology from %s\n", topology::sysfs_root.c_str());
+    return 1;
+  }
+  numa_nodes = cpu_topology.numa_nodes;
+  numcores = cpu_topology.max_cpus;
+  std::vector<int> package_cores;
+  for (const auto &package : cpu_topology.packages)
+  {
+    if (vendor_id == VENDOR_ID::INTEL && package.dies.size() > 1)
+    {
+      for (const auto &die : package.dies)
+      {
+        package_cores.push_back(die.cpus.front());
+      }
+    }
+    else
+    {
+      package_cores.push_back(package.cpus.front());
+    }
   }
+  num_packages = (int)package_cores.size();
+  first_package_core = std::make_unique<int[]>(num_packages);
+  std::copy(package_cores.begin(), package_cores.end(), first_package_core.get());
 
-  // Get the total number of cores, gets the number of the last online
-  // core (should be all cores in the system), and adds 1
-  FILE *onlinecores = fopen("/sys/devices/system/cpu/online", "r");
-  numcores =
-      atoi(strrchr(fgets((char *)malloc(16 * sizeof(char)), 16, onlinecores),
-                   '-') +
-           1) +
-      1;
-  fclose(onlinecores);
+  // Open the MSR devices we will be reading from once, the descriptors are kept
+  // open until close_msr_fds() is called
+  for (int i = 0; i < num_packages; i++)
+  {
+    open_msr_fd(first_package_core[i]);
+  }
 
   if (vendor_id == VENDOR_ID::INTEL)
   {
-    read_INTEL_MSR_RAPL_POWER_UNIT(0, INTEL_MSR_RAPL_POWER_UNIT_VALUES);
+    read_INTEL_MSR_RAPL_POWER_UNIT(first_package_core[0], INTEL_MSR_RAPL_POWER_UNIT_VALUES);
     power_increment =
         1 / (float)(1 << (unsigned int)INTEL_MSR_RAPL_POWER_UNIT_VALUES[0]);
     energy_increment =
@@ -123,7 +163,7 @@ int rapl_utils::init()
   }
   else if (vendor_id == VENDOR_ID::AMD)
   {
-    read_AMD_MSR_RAPL_POWER_UNIT(0, AMD_MSR_RAPL_POWER_UNIT_VALUES);
+    read_AMD_MSR_RAPL_POWER_UNIT(first_package_core[0], AMD_MSR_RAPL_POWER_UNIT_VALUES);
     power_increment =
         1 / (float)(1 << (unsigned int)AMD_MSR_RAPL_POWER_UNIT_VALUES[0]);
     energy_increment =
@@ -135,119 +175,189 @@ int rapl_utils::init()
   // The maximum value of the energy counter is 2^32, stored here in joules
   energy_counter_max = ((long)1U << 32) * energy_increment;
 
-  printf("POWER METER: Number of NUMA nodes detected: %d\n", numa_nodes);
+  dram_energy_increment = energy_increment;
+  if (vendor_id == VENDOR_ID::INTEL && has_fixed_dram_energy_unit())
+  {
+    dram_energy_increment = 1 / (float)(1 << INTEL_DRAM_FIXED_ENERGY_UNIT_BITS);
+  }
+
+  // Probe which domains this machine implements. Unsupported registers either fail to
+  // read or always read 0
+  for (int domain = 0; domain < NUM_RAPL_DOMAINS; domain++)
+  {
+    unsigned long long value = 0;
+    unsigned int address = get_domain_msr(domain);
+    domain_available[domain] = address != 0 &&
+                               read_msr_raw(first_package_core[0], address, &value) &&
+                               (value & get_mask(32)) != 0;
+    if (domain_available[domain])
+    {
+      printf("POWER METER: RAPL domain available: %s\n", RAPL_DOMAIN_NAMES[domain]);
+    }
+  }
+
+  printf("POWER METER: Number of NUMA nodes detected: %d, RAPL packages: %d\n", numa_nodes, num_packages);
 
   return 0;
 }
 
-float rapl_utils::get_node_energy(int node, int domain)
+unsigned int rapl_utils::get_domain_msr(int domain)
+{
+  switch (domain)
+  {
+  case PACKAGE:
+    return vendor_id == VENDOR_ID::INTEL ? INTEL_MSR_PKG_ENERGY_STATUS : AMD_MSR_PKG_ENERGY_STATUS;
+  case CORES:
+    // AMD's core energy counter is per core, it is not a node-level domain
+    return vendor_id == VENDOR_ID::INTEL ? INTEL_MSR_PP0_ENERGY_STATUS : 0;
+  case UNCORE:
+    return vendor_id == VENDOR_ID::INTEL ? INTEL_MSR_PP1_ENERGY_STATUS : 0;
+  case DRAM:
+    return vendor_id == VENDOR_ID::INTEL ? INTEL_MSR_DRAM_ENERGY_STATUS : 0;
+  case PSYS:
+    return vendor_id == VENDOR_ID::INTEL ? INTEL_MSR_PLATFORM_ENERGY_STATUS : 0;
+  default:
+    return 0;
+  }
+}
+
+float rapl_utils::get_domain_energy_increment(int domain)
+{
+  return domain == DRAM ? dram_energy_increment : energy_increment;
+}
+
+unsigned long long rapl_utils::get_node_counter(int node, int domain)
 {
   switch (domain)
   {
   // Package
-  case 0:
+  case PACKAGE:
     if (vendor_id == VENDOR_ID::INTEL)
     {
-      read_INTEL_MSR_PKG_ENERGY_STATUS(first_node_core[node], INTEL_MSR_PKG_ENERGY_STATUS_VALUES);
-      return (float)INTEL_MSR_PKG_ENERGY_STATUS_VALUES[0] * energy_increment;
+      read_INTEL_MSR_PKG_ENERGY_STATUS(first_package_core[node], INTEL_MSR_PKG_ENERGY_STATUS_VALUES);
+      return INTEL_MSR_PKG_ENERGY_STATUS_VALUES[0];
     }
     else
     {
-      read_AMD_MSR_PKG_ENERGY_STATUS(first_node_core[node], AMD_MSR_PKG_ENERGY_STATUS_VALUES);
-      return (float)AMD_MSR_PKG_ENERGY_STATUS_VALUES[0] * energy_increment;
+      read_AMD_MSR_PKG_ENERGY_STATUS(first_package_core[node], AMD_MSR_PKG_ENERGY_STATUS_VALUES);
+      return AMD_MSR_PKG_ENERGY_STATUS_VALUES[0];
     }
     break;
   // Cores
-  case 1:
+  case CORES:
     if (vendor_id == VENDOR_ID::INTEL)
     {
-      read_INTEL_MSR_PP0_ENERGY_STATUS(first_node_core[node], INTEL_MSR_PP0_ENERGY_STATUS_VALUES);
-      return (float)INTEL_MSR_PP0_ENERGY_STATUS_VALUES[0] * energy_increment;
+      read_INTEL_MSR_PP0_ENERGY_STATUS(first_package_core[node], INTEL_MSR_PP0_ENERGY_STATUS_VALUES);
+      return INTEL_MSR_PP0_ENERGY_STATUS_VALUES[0];
     }
     else
     {
-      read_AMD_MSR_CORE_ENERGY_STATUS(first_node_core[node], AMD_MSR_CORE_ENERGY_STATUS_VALUES);
-      return (float)AMD_MSR_CORE_ENERGY_STATUS_VALUES[0] * energy_increment;
+      read_AMD_MSR_CORE_ENERGY_STATUS(first_package_core[node], AMD_MSR_CORE_ENERGY_STATUS_VALUES);
+      return AMD_MSR_CORE_ENERGY_STATUS_VALUES[0];
     }
     break;
   // Uncore
-  case 2:
-    fprintf(stderr, "Reading from RAPL's Uncore domain not yet implemented");
+  case UNCORE:
+    if (vendor_id == VENDOR_ID::INTEL)
+    {
+      read_INTEL_MSR_PP1_ENERGY_STATUS(first_package_core[node], INTEL_MSR_PP1_ENERGY_STATUS_VALUES);
+      return INTEL_MSR_PP1_ENERGY_STATUS_VALUES[0];
+    }
+    fprintf(stderr, "POWER METER: RAPL's Uncore domain is not available on AMD CPUs\n");
     return 0;
     break;
   // DRAM
-  case 3:
-    fprintf(stderr, "Reading from RAPL's DRAM domain not yet implemented");
+  case DRAM:
+    if (vendor_id == VENDOR_ID::INTEL)
+    {
+      read_INTEL_MSR_DRAM_ENERGY_STATUS(first_package_core[node], INTEL_MSR_DRAM_ENERGY_STATUS_VALUES);
+      return INTEL_MSR_DRAM_ENERGY_STATUS_VALUES[0];
+    }
+    fprintf(stderr, "POWER METER: RAPL's DRAM domain is not available on AMD CPUs\n");
+    return 0;
+    break;
+  // Platform
+  case PSYS:
+    if (vendor_id == VENDOR_ID::INTEL)
+    {
+      read_INTEL_MSR_PLATFORM_ENERGY_STATUS(first_package_core[node], INTEL_MSR_PLATFORM_ENERGY_STATUS_VALUES);
+      return INTEL_MSR_PLATFORM_ENERGY_STATUS_VALUES[0];
+    }
+    fprintf(stderr, "POWER METER: RAPL's PSys domain is not available on AMD CPUs\n");
     return 0;
     break;
   default:
-    fprintf(stderr, "Bad RAPL domain (%d). Supported domains are 0-3", domain);
+    fprintf(stderr, "Bad RAPL domain (%d). Supported domains are 0-4", domain);
     return 0;
     break;
   }
 }
 
+double rapl_utils::get_node_energy(int node, int domain)
+{
+  return (double)get_node_counter(node, domain) * get_domain_energy_increment(domain);
+}
+
 void rapl_utils::update_aux_data(EnergyAux &data, int domain)
 {
-  for (int i = 0; i < numa_nodes; i++)
+  data.counter.resize(num_packages);
+  for (int i = 0; i < num_packages; i++)
   {
-    data.energy[i] = get_node_energy(i, domain);
+    data.counter[i] = (uint32_t)get_node_counter(i, domain);
   }
-  clock_gettime(CLOCK_REALTIME, &data.time);
+  data.energy_unit = get_domain_energy_increment(domain);
+  clock_gettime(CLOCK_MONOTONIC, &data.time);
 }
 
 void rapl_utils::update_package_energy(EnergyAux &data) { update_aux_data(data, 0); }
 
 void rapl_utils::update_cores_energy(EnergyAux &data) { update_aux_data(data, 1); }
 
-float rapl_utils::get_energy_diff(const float *current_energy, const float *previous_energy)
+unsigned long long rapl_utils::get_counter_diff(const uint32_t *current_counter, const uint32_t *previous_counter)
 {
-  float energy_diff = 0;
-  for (int i = 0; i < numa_nodes; i++)
+  unsigned long long ticks = 0;
+  for (int i = 0; i < num_packages; i++)
   {
-    float node_energy_diff = (float)(current_energy[i] - previous_energy[i]);
     /*
-    If the energy counter has wrapped around for this node, we need to add the
-    value before wrapping around to the diff. This is 2^32 per Intel's
-    specification
+    Unsigned 32 bit arithmetic wraps modulo 2^32, so if the energy counter has
+    wrapped around for this package the difference already accounts for it
     */
-    if (node_energy_diff < 0)
-    {
-      node_energy_diff += energy_counter_max;
-    }
-    energy_diff += node_energy_diff;
+    ticks += (uint32_t)(current_counter[i] - previous_counter[i]);
   }
-  return energy_diff;
+  return ticks;
 }
 
-float rapl_utils::get_power(const EnergyAux &previous_data, const EnergyAux &current_data)
+double rapl_utils::get_energy_diff(const EnergyAux &current_data, const EnergyAux &previous_data)
+{
+  return (double)get_counter_diff(current_data.counter.data(), previous_data.counter.data()) * current_data.energy_unit;
+}
+
+double rapl_utils::get_power(const EnergyAux &previous_data, const EnergyAux &current_data)
 {
   double time_diff =
       (double)(current_data.time.tv_sec - previous_data.time.tv_sec) +
       ((double)(current_data.time.tv_nsec - previous_data.time.tv_nsec) / 1E9);
-  float energy_diff = get_energy_diff(current_data.energy, previous_data.energy);
 
   // Power = Energy delta in Joules / Time delta in seconds
-  float power = (float)(energy_diff / time_diff);
-
-  return power;
+  return get_energy_diff(current_data, previous_data) / time_diff;
 }
 
 void rapl_utils::update_energy_data(EnergyData &output_data, const EnergyAux &previous_data, const EnergyAux &current_data)
 {
   // Store average power consumption for this interval
   output_data.power = get_power(previous_data, current_data);
-  // Get energy delta taking into account the counter wraparound
-  float energy_diff = get_energy_diff(current_data.energy, previous_data.energy);
+  // Get the ticks elapsed taking into account the counter wraparound
+  unsigned long long ticks = get_counter_diff(current_data.counter.data(), previous_data.counter.data());
   // Store energy consumed during this interval
-  output_data.energy = energy_diff;
-  // Update the total energy consumed by this node
-  output_data.total_energy += energy_diff;
+  output_data.energy = (double)ticks * current_data.energy_unit;
+  // Update the total energy consumed by this node, converted from the exact tick count
+  output_data.total_ticks += ticks;
+  output_data.total_energy = (double)output_data.total_ticks * current_data.energy_unit;
 }
 
 float rapl_utils::get_processor_tdp()
 {
-  if (!vendor_id == VENDOR_ID::INTEL)
+  if (vendor_id != VENDOR_ID::INTEL)
   {
     fprintf(stderr, "POWER METER: ERROR: get_processor_tdp() only works with Intel CPUs\n");
     return 0;
@@ -255,9 +365,9 @@ float rapl_utils::get_processor_tdp()
 
   float total_tdp = 0;
 
-  for (int i = 0; i < numa_nodes; i++)
+  for (int i = 0; i < num_packages; i++)
   {
-    read_INTEL_MSR_PKG_POWER_INFO(first_node_core[i], INTEL_MSR_PKG_POWER_INFO_VALUES);
+    read_INTEL_MSR_PKG_POWER_INFO(first_package_core[i], INTEL_MSR_PKG_POWER_INFO_VALUES);
     total_tdp += (float)INTEL_MSR_PKG_POWER_INFO_VALUES[0];
   }
 
@@ -292,6 +402,30 @@ void rapl_utils::read_INTEL_MSR_PP0_ENERGY_STATUS(int core, unsigned long long *
       output);
 }
 
+void rapl_utils::read_INTEL_MSR_PP1_ENERGY_STATUS(int core, unsigned long long *output)
+{
+  read_msr_fields(
+      core, INTEL_MSR_PP1_ENERGY_STATUS, INTEL_MSR_PP1_ENERGY_STATUS_NUMFIELDS,
+      INTEL_MSR_PP1_ENERGY_STATUS_OFFSETS, INTEL_MSR_PP1_ENERGY_STATUS_SIZES,
+      output);
+}
+
+void rapl_utils::read_INTEL_MSR_DRAM_ENERGY_STATUS(int core, unsigned long long *output)
+{
+  read_msr_fields(
+      core, INTEL_MSR_DRAM_ENERGY_STATUS, INTEL_MSR_DRAM_ENERGY_STATUS_NUMFIELDS,
+      INTEL_MSR_DRAM_ENERGY_STATUS_OFFSETS, INTEL_MSR_DRAM_ENERGY_STATUS_SIZES,
+      output);
+}
+
+void rapl_utils::read_INTEL_MSR_PLATFORM_ENERGY_STATUS(int core, unsigned long long *output)
+{
+  read_msr_fields(
+      core, INTEL_MSR_PLATFORM_ENERGY_STATUS, INTEL_MSR_PLATFORM_ENERGY_STATUS_NUMFIELDS,
+      INTEL_MSR_PLATFORM_ENERGY_STATUS_OFFSETS, INTEL_MSR_PLATFORM_ENERGY_STATUS_SIZES,
+      output);
+}
+
 void rapl_utils::read_INTEL_MSR_PKG_POWER_INFO(int core, unsigned long long *output)
 {
   read_msr_fields(
@@ -0,0 +1,272 @@
+#include "region.hh"
+#include "rapl_utils.hh"
+#include "nvml_utils.hh"
+#include "msr_reader.hh"
+#include "markers.hh"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace
+{
+    struct RegionCounters
+    {
+        unsigned long long calls{0};
+        long long time{0};
+        // Energy in RAPL ticks and in mili Joules, converted to Joules for the summary
+        unsigned long long cpu_ticks{0};
+        unsigned long long gpu_mj{0};
+
+        void add(const RegionCounters &other)
+        {
+            calls += other.calls;
+            time += other.time;
+            cpu_ticks += other.cpu_ticks;
+            gpu_mj += other.gpu_mj;
+        }
+    };
+
+    // Regions measured by a thread, along with the counters of its active regions
+    struct ThreadTable
+    {
+        ThreadTable();
+        ~ThreadTable();
+
+        // Only contended while the summary is being merged
+        std::mutex lock;
+        std::unordered_map<const char *, RegionCounters> regions;
+        // Counters taken on entry of the active regions, innermost last
+        std::vector<uint64_t> snapshots;
+        // Last value the thread read from each package's counter, kept when a read fails
+        std::vector<uint64_t> package_counters;
+    };
+
+    std::mutex registry_lock;
+    std::vector<ThreadTable *> live_tables;
+    // Measurements of the threads that have already exited
+    std::map<std::string, RegionCounters> retired_regions;
+
+    std::once_flag init_flag;
+    // One descriptor per package, opened once in init_regions
+    std::vector<int> package_fds;
+    std::atomic<bool> region_markers{false};
+    unsigned int package_msr{0};
+    double cpu_energy_unit{0};
+    unsigned int num_gpus{0};
+    // Number of counters in a snapshot, packages first and GPUs after them
+    size_t snapshot_size{0};
+
+    thread_local ThreadTable thread_table;
+
+    ThreadTable::ThreadTable()
+    {
+        std::lock_guard<std::mutex> guard(registry_lock);
+        live_tables.push_back(this);
+    }
+
+    ThreadTable::~ThreadTable()
+    {
+        std::lock_guard<std::mutex> guard(registry_lock);
+        for (const auto &region : regions)
+        {
+            retired_regions[region.first].add(region.second);
+        }
+        live_tables.erase(std::find(live_tables.begin(), live_tables.end(), this));
+    }
+
+    long long monotonic_ns()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+    }
+
+    void take_snapshot(uint64_t *counters)
+    {
+        auto &last = thread_table.package_counters;
+        last.resize(package_fds.size(), 0);
+        for (size_t i = 0; i < package_fds.size(); ++i)
+        {
+            uint64_t value = 0;
+            if (pread(package_fds[i], &value, sizeof(value), package_msr) == sizeof(value))
+            {
+                // RAPL energy counters are the low 32 bits of the register
+                last[i] = value & 0xFFFFFFFFULL;
+            }
+            counters[i] = last[i];
+        }
+        for (unsigned int i = 0; i < num_gpus; ++i)
+        {
+            counters[package_fds.size() + i] = nvml_utils::get_gpu_energy_counter(i);
+        }
+    }
+
+    void init_counters(bool with_gpus)
+    {
+        try
+        {
+            if (rapl_utils::vendor_id < 0 && rapl_utils::init() != 0)
+            {
+                throw std::runtime_error("RAPL initialization failed");
+            }
+            package_msr = rapl_utils::vendor_id == rapl_utils::VENDOR_ID::INTEL ? INTEL_MSR_PKG_ENERGY_STATUS
+                                                                                 : AMD_MSR_PKG_ENERGY_STATUS;
+            cpu_energy_unit = rapl_utils::energy_increment;
+            for (int i = 0; i < rapl_utils::num_packages; ++i)
+            {
+                auto path = rapl_utils::msr_device_root / std::to_string(rapl_utils::first_package_core[i]) / "msr";
+                int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0)
+                {
+                    throw std::runtime_error("could not open " + path.string());
+                }
+                package_fds.push_back(fd);
+            }
+        }
+        catch (const std::exception &error)
+        {
+            fprintf(stderr, "POWER METER: WARNING: Regions will only measure time, CPU counters not accessible (%s)\n",
+                    error.what());
+            for (int fd : package_fds)
+            {
+                close(fd);
+            }
+            package_fds.clear();
+        }
+
+        if (with_gpus)
+        {
+            if (!nvml_utils::device_handles && nvml_utils::start())
+            {
+                nvml_utils::init();
+            }
+            num_gpus = nvml_utils::num_GPUs;
+        }
+        snapshot_size = package_fds.size() + num_gpus;
+    }
+}
+
+void power_meter::set_region_markers(bool enabled)
+{
+    region_markers = enabled;
+}
+
+int power_meter::init_regions(bool with_gpus)
+{
+    std::call_once(init_flag, init_counters, with_gpus);
+    return package_fds.empty() ? 1 : 0;
+}
+
+power_meter::Region::Region(const char *name) : name(name)
+{
+    std::call_once(init_flag, init_counters, false);
+    auto &snapshots = thread_table.snapshots;
+    snapshot = snapshots.size();
+    snapshots.resize(snapshot + snapshot_size);
+    take_snapshot(snapshots.data() + snapshot);
+    start_time = monotonic_ns();
+    if (region_markers.load(std::memory_order_relaxed))
+    {
+        push_marker(MARKER_REGION_BEGIN, name);
+    }
+}
+
+power_meter::Region::~Region()
+{
+    if (region_markers.load(std::memory_order_relaxed))
+    {
+        push_marker(MARKER_REGION_END, name);
+    }
+    long long end_time = monotonic_ns();
+    auto &table = thread_table;
+    // The counters on exit go right after the ones taken on entry
+    table.snapshots.resize(snapshot + 2 * snapshot_size);
+    const uint64_t *start_counters = table.snapshots.data() + snapshot;
+    uint64_t *end_counters = table.snapshots.data() + snapshot + snapshot_size;
+    take_snapshot(end_counters);
+
+    RegionCounters measurement;
+    measurement.calls = 1;
+    measurement.time = end_time - start_time;
+    size_t packages = package_fds.size();
+    for (size_t i = 0; i < packages; ++i)
+    {
+        // Unsigned arithmetic modulo 2^32 corrects a counter wraparound
+        measurement.cpu_ticks += (end_counters[i] - start_counters[i]) & 0xFFFFFFFFULL;
+    }
+    for (size_t i = packages; i < snapshot_size; ++i)
+    {
+        // NVML reports mili Joules
+        measurement.gpu_mj += end_counters[i] - start_counters[i];
+    }
+    table.snapshots.resize(snapshot);
+
+    std::lock_guard<std::mutex> guard(table.lock);
+    table.regions[name].add(measurement);
+}
+
+std::vector<power_meter::RegionSummary> power_meter::get_region_summary()
+{
+    std::map<std::string, RegionCounters> merged;
+    {
+        std::lock_guard<std::mutex> guard(registry_lock);
+        merged = retired_regions;
+        for (auto *table : live_tables)
+        {
+            std::lock_guard<std::mutex> table_guard(table->lock);
+            for (const auto &region : table->regions)
+            {
+                merged[region.first].add(region.second);
+            }
+        }
+    }
+
+    std::vector<RegionSummary> summary;
+    for (const auto &region : merged)
+    {
+        RegionSummary entry;
+        entry.name = region.first;
+        entry.calls = region.second.calls;
+        entry.time = (double)region.second.time / 1E9;
+        entry.cpu_energy = (double)region.second.cpu_ticks * cpu_energy_unit;
+        entry.gpu_energy = (double)region.second.gpu_mj / 1E3;
+        entry.mean_power = entry.time > 0 ? (entry.cpu_energy + entry.gpu_energy) / entry.time : 0;
+        summary.push_back(entry);
+    }
+    return summary;
+}
+
+void power_meter::print_region_summary(FILE *output)
+{
+    auto summary = get_region_summary();
+    if (summary.empty())
+    {
+        return;
+    }
+    fprintf(output, "POWER METER: %-24s %12s %12s %14s %14s %12s\n",
+            "Region", "Calls", "Time (s)", "CPU energy (J)", "GPU energy (J)", "Power (W)");
+    for (const auto &region : summary)
+    {
+        fprintf(output, "POWER METER: %-24s %12llu %12.6f %14.6f %14.6f %12.3f\n",
+                region.name.c_str(), region.calls, region.time, region.cpu_energy, region.gpu_energy,
+                region.mean_power);
+    }
+}
+
+void power_meter::reset_regions()
+{
+    std::lock_guard<std::mutex> guard(registry_lock);
+    retired_regions.clear();
+    for (auto *table : live_tables)
+    {
+        std::lock_guard<std::mutex> table_guard(table->lock);
+        table->regions.clear();
+    }
+}
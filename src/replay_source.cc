@@ -0,0 +1,172 @@
+#include "replay_source.hh"
+#include "trace_format.hh"
+
+#include <string.h>
+#include <fstream>
+#include <sstream>
+
+power_meter::ReplaySource::ReplaySource(std::filesystem::path trace_path, double speed, unsigned int source_index)
+    : trace_path(std::move(trace_path)), speed(speed), source_index(source_index)
+{
+}
+
+int power_meter::ReplaySource::init()
+{
+    std::ifstream trace(trace_path, std::ios::binary);
+    if (!trace)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not open replay trace %s\n", trace_path.c_str());
+        return 1;
+    }
+    char magic[sizeof(POWER_METER_TRACE_MAGIC)]{};
+    trace.read(magic, sizeof(magic));
+    trace.close();
+
+    device_info.clear();
+    timestamps.clear();
+    trace_counters.clear();
+
+    int error = memcmp(magic, POWER_METER_TRACE_MAGIC, sizeof(magic)) == 0 ? load_binary_trace() : load_text_trace();
+    if (error != 0)
+    {
+        return error;
+    }
+
+    if (timestamps.empty())
+    {
+        fprintf(stderr, "POWER METER: ERROR: Replay trace %s contains no readings\n", trace_path.c_str());
+        return 1;
+    }
+
+    cursor = 0;
+    num_readings = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    return 0;
+}
+
+int power_meter::ReplaySource::load_binary_trace()
+{
+    TraceReader reader;
+    if (!reader.open(trace_path))
+    {
+        return 1;
+    }
+    if (source_index >= reader.info().sources.size())
+    {
+        fprintf(stderr, "POWER METER: ERROR: Replay trace %s has no source %u\n", trace_path.c_str(), source_index);
+        return 1;
+    }
+    device_info = reader.info().sources[source_index].devices;
+
+    std::vector<SourceReading> readings;
+    while (reader.next(readings))
+    {
+        const auto &reading = readings[source_index];
+        timestamps.push_back((long long)reading.time.tv_sec * 1000000000LL + reading.time.tv_nsec);
+        trace_counters.insert(trace_counters.end(), reading.counters.get(), reading.counters.get() + num_devices());
+    }
+    return 0;
+}
+
+int power_meter::ReplaySource::load_text_trace()
+{
+    std::ifstream trace(trace_path);
+    std::string line;
+    while (std::getline(trace, line))
+    {
+        if (line.empty())
+        {
+            continue;
+        }
+        std::istringstream fields(line);
+        if (line[0] == '#')
+        {
+            std::string hash, keyword;
+            DeviceInfo device;
+            fields >> hash >> keyword;
+            if (keyword == "device" && fields >> device.name >> device.energy_unit >> device.counter_max)
+            {
+                if (!(fields >> device.domain))
+                {
+                    device.domain = "Replay";
+                }
+                device_info.push_back(device);
+            }
+            continue;
+        }
+
+        long long timestamp;
+        fields >> timestamp;
+        for (unsigned int i = 0; i < num_devices(); ++i)
+        {
+            uint64_t counter{0};
+            fields >> counter;
+            trace_counters.push_back(counter);
+        }
+        if (!fields)
+        {
+            fprintf(stderr, "POWER METER: ERROR: Malformed line in replay trace: %s\n", line.c_str());
+            return 1;
+        }
+        timestamps.push_back(timestamp);
+    }
+    return 0;
+}
+
+bool power_meter::ReplaySource::finished() const
+{
+    return cursor + 1 >= timestamps.size();
+}
+
+void power_meter::ReplaySource::read_counters(struct timespec &time, uint64_t *counters)
+{
+    const unsigned int n = num_devices();
+    long long playback_ns;
+
+    if (speed == 0)
+    {
+        cursor = std::min<size_t>(num_readings, timestamps.size() - 1);
+        playback_ns = timestamps[cursor];
+    }
+    else
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        playback_ns = timestamps[0] + (long long)(get_time_diff(start_time, now) * speed * 1E9);
+        while (cursor + 1 < timestamps.size() && timestamps[cursor + 1] <= playback_ns)
+        {
+            ++cursor;
+        }
+    }
+    ++num_readings;
+
+    const uint64_t *current = &trace_counters[cursor * n];
+    if (finished() || playback_ns <= timestamps[cursor])
+    {
+        std::copy(current, current + n, counters);
+    }
+    else
+    {
+        // Interpolate between this reading and the next one
+        const uint64_t *next = &trace_counters[(cursor + 1) * n];
+        double fraction = (double)(playback_ns - timestamps[cursor]) /
+                          (double)(timestamps[cursor + 1] - timestamps[cursor]);
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            uint64_t ticks = next[i] - current[i];
+            if (next[i] < current[i] && device_info[i].counter_max != 0)
+            {
+                ticks = device_info[i].counter_max - current[i] + next[i];
+            }
+            uint64_t counter = current[i] + (uint64_t)(fraction * (double)ticks);
+            if (device_info[i].counter_max != 0)
+            {
+                counter %= device_info[i].counter_max;
+            }
+            counters[i] = counter;
+        }
+    }
+
+    time.tv_sec = playback_ns / 1000000000LL;
+    time.tv_nsec = playback_ns % 1000000000LL;
+}
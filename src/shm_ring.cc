@@ -0,0 +1,246 @@
+#include "shm_ring.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <new>
+
+// Slots start on a cache line
+#define SHM_SLOTS_ALIGNMENT 64
+
+//////////////////////////////////////////////////////////////////////
+//						        PUBLISHER
+//////////////////////////////////////////////////////////////////////
+
+bool power_meter::ShmPublisher::open(const std::string &name, const std::vector<SourceInfo> &sources,
+                                     size_t capacity, uint32_t sampling_interval_us)
+{
+    close();
+    size_t num_slots = 1;
+    while (num_slots < capacity)
+    {
+        num_slots <<= 1;
+    }
+    record_words = 0;
+    size_t descriptors_size = 0;
+    for (const auto &source : sources)
+    {
+        record_words += power_meter::record_words(source);
+        descriptors_size += sizeof(TraceSourceHeader) + source.devices.size() * sizeof(TraceDeviceHeader);
+    }
+    size_t slot_words = 1 + record_words;
+    size_t slots_offset = (sizeof(ShmHeader) + descriptors_size + SHM_SLOTS_ALIGNMENT - 1) /
+                          SHM_SLOTS_ALIGNMENT * SHM_SLOTS_ALIGNMENT;
+    size_t size = slots_offset + num_slots * slot_words * sizeof(uint64_t);
+
+    // Replace the object of a publisher that didn't stop cleanly, clients still mapping it keep the old one
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not create shared memory %s: %s\n", name.c_str(), strerror(errno));
+        return false;
+    }
+    // The umask may have restricted the permissions, clients of every user must be able to read
+    fchmod(fd, 0644);
+    void *mapping = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0)
+    {
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not map shared memory %s: %s\n", name.c_str(), strerror(errno));
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    // The object is zero filled, the slots' sequences start at 0 (never written)
+    auto *bytes = static_cast<unsigned char *>(mapping);
+    header = new (mapping) ShmHeader{};
+    memcpy(header->magic, POWER_METER_SHM_MAGIC, sizeof(POWER_METER_SHM_MAGIC));
+    header->version = POWER_METER_SHM_VERSION;
+    header->num_sources = (uint32_t)sources.size();
+    header->slots_offset = slots_offset;
+    header->size = size;
+    header->capacity = num_slots;
+    header->slot_words = slot_words;
+    header->sampling_interval_us = sampling_interval_us;
+    header->pid = (int32_t)getpid();
+    unsigned char *descriptor = bytes + sizeof(ShmHeader);
+    for (const auto &source : sources)
+    {
+        TraceSourceHeader source_header = make_source_header(source);
+        memcpy(descriptor, &source_header, sizeof(source_header));
+        descriptor += sizeof(source_header);
+        for (const auto &device : source.devices)
+        {
+            TraceDeviceHeader device_header = make_device_header(device);
+            memcpy(descriptor, &device_header, sizeof(device_header));
+            descriptor += sizeof(device_header);
+        }
+    }
+    slots = new (bytes + slots_offset) std::atomic<uint64_t>[num_slots * slot_words];
+    mask = header->capacity - 1;
+    next = 0;
+    this->name = name;
+    // Published last, clients check the state before anything else
+    header->state.store(SHM_RUNNING, std::memory_order_release);
+    return true;
+}
+
+void power_meter::ShmPublisher::publish(const uint64_t *record)
+{
+    std::atomic<uint64_t> *slot = slots + (next & mask) * header->slot_words;
+    uint64_t sequence = 2 * (next + 1);
+    slot[0].store(sequence - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < record_words; ++i)
+    {
+        slot[1 + i].store(record[i], std::memory_order_relaxed);
+    }
+    slot[0].store(sequence, std::memory_order_release);
+    header->published.store(++next, std::memory_order_release);
+}
+
+void power_meter::ShmPublisher::close()
+{
+    if (!header)
+    {
+        return;
+    }
+    header->state.store(SHM_STOPPED, std::memory_order_release);
+    munmap(header, header->size);
+    shm_unlink(name.c_str());
+    header = nullptr;
+    slots = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////
+//						         CLIENT
+//////////////////////////////////////////////////////////////////////
+
+bool power_meter::ShmClient::open(const std::string &name)
+{
+    close();
+    int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not open shared memory %s: %s\n", name.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(ShmHeader))
+    {
+        fprintf(stderr, "POWER METER: ERROR: %s is not a power meter ring\n", name.c_str());
+        ::close(fd);
+        return false;
+    }
+    mapping_size = (size_t)status.st_size;
+    mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not map shared memory %s: %s\n", name.c_str(), strerror(errno));
+        mapping = nullptr;
+        return false;
+    }
+
+    header = static_cast<const ShmHeader *>(mapping);
+    if (header->state.load(std::memory_order_acquire) == 0 ||
+        memcmp(header->magic, POWER_METER_SHM_MAGIC, sizeof(POWER_METER_SHM_MAGIC)) != 0 ||
+        header->size > mapping_size)
+    {
+        fprintf(stderr, "POWER METER: ERROR: %s is not a power meter ring\n", name.c_str());
+        close();
+        return false;
+    }
+    if (header->version != POWER_METER_SHM_VERSION)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Unsupported shared memory ring version %u\n", header->version);
+        close();
+        return false;
+    }
+
+    const auto *bytes = static_cast<const unsigned char *>(mapping);
+    const unsigned char *descriptor = bytes + sizeof(ShmHeader);
+    source_info.clear();
+    for (uint32_t i = 0; i < header->num_sources; ++i)
+    {
+        TraceSourceHeader source_header;
+        memcpy(&source_header, descriptor, sizeof(source_header));
+        descriptor += sizeof(source_header);
+        SourceInfo source = parse_source_header(source_header, POWER_METER_TRACE_VERSION);
+        for (uint32_t j = 0; j < source_header.num_devices; ++j)
+        {
+            TraceDeviceHeader device_header;
+            memcpy(&device_header, descriptor, sizeof(device_header));
+            descriptor += sizeof(device_header);
+            source.devices.push_back(parse_device_header(device_header));
+        }
+        source_info.push_back(std::move(source));
+    }
+    slots = reinterpret_cast<const std::atomic<uint64_t> *>(bytes + header->slots_offset);
+    record.resize(header->slot_words - 1);
+    return true;
+}
+
+void power_meter::ShmClient::close()
+{
+    if (mapping)
+    {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+        header = nullptr;
+        slots = nullptr;
+    }
+}
+
+bool power_meter::ShmClient::read(uint64_t index, std::vector<SourceReading> &readings)
+{
+    const std::atomic<uint64_t> *slot = slots + (index & (header->capacity - 1)) * header->slot_words;
+    const uint64_t sequence = 2 * (index + 1);
+    if (slot[0].load(std::memory_order_acquire) != sequence)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < record.size(); ++i)
+    {
+        record[i] = slot[1 + i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // Overwritten while we were copying it
+    if (slot[0].load(std::memory_order_relaxed) != sequence)
+    {
+        return false;
+    }
+    if (readings.size() != source_info.size())
+    {
+        allocate_readings(source_info, readings);
+    }
+    unpack_record(record.data(), source_info, readings);
+    return true;
+}
+
+bool power_meter::ShmClient::latest(std::vector<SourceReading> &readings)
+{
+    // Only fails if the publisher lapped the whole ring meanwhile, try again with the new latest
+    for (int attempt = 0; attempt < 4; ++attempt)
+    {
+        uint64_t count = published();
+        if (count == 0)
+        {
+            return false;
+        }
+        if (read(count - 1, readings))
+        {
+            return true;
+        }
+    }
+    return false;
+}
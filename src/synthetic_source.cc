@@ -0,0 +1,75 @@
+#include "synthetic_source.hh"
+
+#include <cmath>
+#include <string>
+
+double power_meter::PowerProfile::energy_at(double t) const
+{
+    double phase = std::fmod(t, period);
+    switch (shape)
+    {
+    case SQUARE:
+        // Whole periods add up to base_power * period
+        return base_power * t + amplitude * (phase < period / 2 ? phase : period - phase);
+    case SINE:
+        return base_power * t + amplitude * period / (2 * M_PI) * (1 - std::cos(2 * M_PI * t / period));
+    case SAWTOOTH:
+        return base_power * t - amplitude * phase + amplitude * phase * phase / period;
+    case CONSTANT:
+    default:
+        return base_power * t;
+    }
+}
+
+power_meter::SyntheticSource::SyntheticSource(std::vector<PowerProfile> profiles, double energy_unit,
+                                              unsigned int counter_bits, long long time_step_ns,
+                                              uint64_t initial_counter)
+    : profiles(std::move(profiles)), energy_unit(energy_unit), counter_bits(counter_bits),
+      time_step_ns(time_step_ns), initial_counter(initial_counter)
+{
+}
+
+int power_meter::SyntheticSource::init()
+{
+    uint64_t counter_max = counter_bits >= 64 ? 0 : 1ULL << counter_bits;
+    device_info.clear();
+    for (size_t i = 0; i < profiles.size(); ++i)
+    {
+        device_info.push_back({"synthetic" + std::to_string(i), profiles[i].domain, energy_unit, counter_max});
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    num_readings = 0;
+    return 0;
+}
+
+void power_meter::SyntheticSource::read_counters(struct timespec &time, uint64_t *counters)
+{
+    if (time_step_ns != 0)
+    {
+        long long elapsed_ns = time_step_ns * (long long)num_readings;
+        time.tv_sec = start_time.tv_sec + (start_time.tv_nsec + elapsed_ns) / 1000000000LL;
+        time.tv_nsec = (start_time.tv_nsec + elapsed_ns) % 1000000000LL;
+    }
+    else
+    {
+        clock_gettime(CLOCK_MONOTONIC, &time);
+    }
+    ++num_readings;
+
+    double t = get_time_diff(start_time, time);
+    for (size_t i = 0; i < profiles.size(); ++i)
+    {
+        // Unsigned arithmetic wraps at 2^64, the mask handles narrower counters
+        uint64_t ticks = initial_counter + (uint64_t)(profiles[i].energy_at(t) / energy_unit);
+        if (device_info[i].counter_max != 0)
+        {
+            ticks &= device_info[i].counter_max - 1;
+        }
+        counters[i] = ticks;
+    }
+}
+
+double power_meter::SyntheticSource::max_power(unsigned int device) const
+{
+    return profiles[device].base_power + std::abs(profiles[device].amplitude);
+}
@@ -0,0 +1,171 @@
+#include "topology.hh"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+namespace topology
+{
+    std::filesystem::path sysfs_root{"/sys/devices/system"};
+}
+
+namespace
+{
+    std::mutex topology_lock;
+    std::unique_ptr<topology::Topology> cached_topology;
+}
+
+/*
+Reads the first line of a sysfs attribute, returns false if it can't be read
+*/
+static bool read_attribute(const std::filesystem::path &path, std::string &value)
+{
+    std::ifstream file(path);
+    return (bool)std::getline(file, value);
+}
+
+static int read_int_attribute(const std::filesystem::path &path, int fallback)
+{
+    std::string value;
+    if (!read_attribute(path, value))
+    {
+        return fallback;
+    }
+    char *end;
+    long number = strtol(value.c_str(), &end, 10);
+    return end == value.c_str() ? fallback : (int)number;
+}
+
+std::vector<int> topology::parse_cpulist(const std::string &list)
+{
+    std::vector<int> ids;
+    std::stringstream entries(list);
+    std::string entry;
+    while (std::getline(entries, entry, ','))
+    {
+        const char *text = entry.c_str();
+        char *end;
+        long first = strtol(text, &end, 10);
+        if (end == text)
+        {
+            continue;
+        }
+        long last = first;
+        if (*end == '-')
+        {
+            const char *range_end = end + 1;
+            last = strtol(range_end, &end, 10);
+            if (end == range_end || last < first)
+            {
+                continue;
+            }
+        }
+        for (long id = first; id <= last; ++id)
+        {
+            ids.push_back((int)id);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+/*
+Lists the online CPUs. Without the online list (e.g. in some containers), every cpu<N>
+directory is assumed to be online
+*/
+static std::vector<int> online_cpus(const std::filesystem::path &cpu_root)
+{
+    std::string online;
+    if (read_attribute(cpu_root / "online", online))
+    {
+        return topology::parse_cpulist(online);
+    }
+    std::vector<int> cpus;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(cpu_root, error))
+    {
+        std::string name = entry.path().filename().string();
+        if (name.size() > 3 && name.compare(0, 3, "cpu") == 0 &&
+            std::all_of(name.begin() + 3, name.end(), [](char c) { return c >= '0' && c <= '9'; }))
+        {
+            cpus.push_back(atoi(name.c_str() + 3));
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    return cpus;
+}
+
+static std::unique_ptr<topology::Topology> discover_topology()
+{
+    auto result = std::make_unique<topology::Topology>();
+    const auto cpu_root = topology::sysfs_root / "cpu";
+
+    // Packages by id, each with its dies by id
+    std::map<int, std::map<int, std::vector<int>>> packages;
+    for (int id : online_cpus(cpu_root))
+    {
+        const auto cpu_topology = cpu_root / ("cpu" + std::to_string(id)) / "topology";
+        // Missing attributes (old kernels, virtual machines) place the CPU in package 0, die 0
+        topology::Cpu cpu;
+        cpu.id = id;
+        cpu.package = read_int_attribute(cpu_topology / "physical_package_id", 0);
+        cpu.die = read_int_attribute(cpu_topology / "die_id", 0);
+        cpu.core = read_int_attribute(cpu_topology / "core_id", id);
+        std::string siblings;
+        std::vector<int> sibling_ids;
+        if (read_attribute(cpu_topology / "thread_siblings_list", siblings))
+        {
+            sibling_ids = topology::parse_cpulist(siblings);
+        }
+        cpu.first_thread = sibling_ids.empty() || sibling_ids.front() == id;
+        result->cpus.push_back(cpu);
+        packages[cpu.package][cpu.die].push_back(id);
+    }
+
+    for (const auto &package : packages)
+    {
+        topology::Package entry{package.first, {}, {}};
+        for (const auto &die : package.second)
+        {
+            entry.dies.push_back({die.first, die.second});
+            entry.cpus.insert(entry.cpus.end(), die.second.begin(), die.second.end());
+        }
+        std::sort(entry.cpus.begin(), entry.cpus.end());
+        result->packages.push_back(entry);
+    }
+
+    std::string nodes;
+    if (read_attribute(topology::sysfs_root / "node" / "online", nodes))
+    {
+        result->numa_nodes = std::max<int>((int)topology::parse_cpulist(nodes).size(), 1);
+    }
+    result->max_cpus = result->cpus.empty() ? 0 : result->cpus.back().id + 1;
+    return result;
+}
+
+const topology::Topology &topology::get_topology()
+{
+    std::lock_guard<std::mutex> guard(topology_lock);
+    if (!cached_topology)
+    {
+        cached_topology = discover_topology();
+    }
+    return *cached_topology;
+}
+
+void topology::reset()
+{
+    std::lock_guard<std::mutex> guard(topology_lock);
+    cached_topology.reset();
+}
+
+void topology::set_sysfs_root(std::string root)
+{
+    sysfs_root = root;
+    reset();
+}
@@ -0,0 +1,748 @@
+#include "trace_analysis.hh"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+
+// Intervals reduced at once, the buffers of a chunk stay in the L1 cache
+#define ANALYSIS_CHUNK 1024
+
+using namespace power_meter;
+
+//////////////////////////////////////////////////////////////////////
+//						       MAPPED TRACE
+//////////////////////////////////////////////////////////////////////
+
+bool power_meter::MappedTrace::open(const std::filesystem::path &path)
+{
+    close();
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not open trace file %s\n", path.c_str());
+        close();
+        return false;
+    }
+    mapping_size = (size_t)file_stat.st_size;
+    mapping = mapping_size >= sizeof(TraceFileHeader) ? mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not map trace file %s\n", path.c_str());
+        mapping = nullptr;
+        close();
+        return false;
+    }
+    madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+
+    const unsigned char *data = (const unsigned char *)mapping;
+    TraceFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, POWER_METER_COMPRESSED_TRACE_MAGIC, sizeof(POWER_METER_COMPRESSED_TRACE_MAGIC)) == 0)
+    {
+        fprintf(stderr, "POWER METER: ERROR: %s is compressed, decompress it with power_meter_convert --decompress\n", path.c_str());
+        close();
+        return false;
+    }
+    if (memcmp(header.magic, POWER_METER_TRACE_MAGIC, sizeof(POWER_METER_TRACE_MAGIC)) != 0 ||
+        header.version < 1 || header.version > POWER_METER_TRACE_VERSION || header.header_size > mapping_size)
+    {
+        fprintf(stderr, "POWER METER: ERROR: %s is not a supported power meter trace\n", path.c_str());
+        close();
+        return false;
+    }
+
+    trace_info = TraceInfo{};
+    trace_info.sampling_interval_us = header.sampling_interval_us;
+    trace_info.energy_increment = header.energy_increment;
+    trace_info.vendor_id = header.vendor_id;
+    trace_info.numa_nodes = header.numa_nodes;
+    trace_info.numcores = header.numcores;
+    trace_info.num_gpus = header.num_gpus;
+    // Version 1 device headers have no domain
+    size_t device_header_size = header.version == 1 ? offsetof(TraceDeviceHeader, domain) : sizeof(TraceDeviceHeader);
+    size_t position = sizeof(header);
+    source_words.clear();
+    size_t word = 1;
+    for (uint32_t i = 0; i < header.num_sources; ++i)
+    {
+        TraceSourceHeader source_header;
+        if (position + sizeof(source_header) > header.header_size)
+        {
+            close();
+            return false;
+        }
+        memcpy(&source_header, data + position, sizeof(source_header));
+        position += sizeof(source_header);
+        SourceInfo source = parse_source_header(source_header, header.version);
+        for (uint32_t j = 0; j < source_header.num_devices; ++j)
+        {
+            TraceDeviceHeader device_header{};
+            if (position + device_header_size > header.header_size)
+            {
+                close();
+                return false;
+            }
+            memcpy(&device_header, data + position, device_header_size);
+            position += device_header_size;
+            source.devices.push_back(parse_device_header(device_header));
+        }
+        source_words.push_back(word);
+        word += record_words(source);
+        trace_info.sources.push_back(std::move(source));
+    }
+    record_size = word;
+
+    // Only the type of each record is read, the samples stay in the mapping
+    const size_t sample_bytes = record_size * sizeof(uint64_t);
+    position = header.header_size;
+    bool in_segment = false;
+    while (position + sizeof(uint64_t) <= mapping_size)
+    {
+        uint64_t type = *(const uint64_t *)(data + position);
+        if (type == TRACE_RECORD_SAMPLE && position + sample_bytes <= mapping_size)
+        {
+            if (!in_segment)
+            {
+                segments.push_back({samples, (const uint64_t *)(data + position)});
+                in_segment = true;
+            }
+            ++samples;
+            position += sample_bytes;
+        }
+        else if (type == TRACE_RECORD_MARKER && position + sizeof(uint64_t) + sizeof(Marker) <= mapping_size)
+        {
+            Marker marker;
+            memcpy(&marker, data + position + sizeof(uint64_t), sizeof(marker));
+            marker_list.push_back(marker);
+            in_segment = false;
+            position += sizeof(uint64_t) + sizeof(Marker);
+        }
+        else
+        {
+            // A truncated last record, or not a record
+            break;
+        }
+    }
+    return true;
+}
+
+void power_meter::MappedTrace::close()
+{
+    if (mapping)
+    {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    mapping_size = 0;
+    samples = 0;
+    segments.clear();
+    marker_list.clear();
+}
+
+const uint64_t *power_meter::MappedTrace::record(size_t sample) const
+{
+    // Last segment starting at or before the sample, markers are rare so there are few
+    auto segment = std::upper_bound(segments.begin(), segments.end(), sample,
+                                    [](size_t value, const Segment &s)
+                                    { return value < s.first_sample; }) -
+                   1;
+    return segment->records + (sample - segment->first_sample) * record_size;
+}
+
+size_t power_meter::MappedTrace::contiguous(size_t sample) const
+{
+    auto next = std::upper_bound(segments.begin(), segments.end(), sample,
+                                 [](size_t value, const Segment &s)
+                                 { return value < s.first_sample; });
+    return (next == segments.end() ? samples : next->first_sample) - sample;
+}
+
+size_t power_meter::MappedTrace::find(uint64_t time_ns, size_t source) const
+{
+    size_t low = 0, high = samples;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (time(source, middle) < time_ns)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+PowerSeries power_meter::MappedTrace::series(const std::string &label, const std::string &domain) const
+{
+    PowerSeries series;
+    for (size_t i = 0; i < trace_info.sources.size(); ++i)
+    {
+        if (trace_info.sources[i].label != label)
+        {
+            continue;
+        }
+        series.source = i;
+        const auto &devices = trace_info.sources[i].devices;
+        for (size_t device = 0; device < devices.size(); ++device)
+        {
+            if (domain.empty() || devices[device].domain == domain)
+            {
+                series.devices.push_back(device);
+            }
+        }
+        break;
+    }
+    return series;
+}
+
+//////////////////////////////////////////////////////////////////////
+//						         CHUNKS
+//////////////////////////////////////////////////////////////////////
+
+// Intervals of a chunk: their length, the energy consumed, its power and the time they ended at
+struct Chunk
+{
+    size_t size;
+    double seconds[ANALYSIS_CHUNK];
+    double energy[ANALYSIS_CHUNK];
+    double power[ANALYSIS_CHUNK];
+    uint64_t end_time[ANALYSIS_CHUNK];
+    // Ticks of each device of the series over the chunk
+    std::vector<uint64_t> ticks;
+};
+
+/*
+Copies a word of count consecutive samples, one per record, to output
+*/
+static void gather(const MappedTrace &trace, size_t first, size_t count, size_t word, uint64_t *output)
+{
+    const size_t stride = trace.stride();
+    while (count > 0)
+    {
+        size_t run = std::min(count, trace.contiguous(first));
+        const uint64_t *input = trace.record(first) + word;
+        for (size_t k = 0; k < run; ++k)
+        {
+            output[k] = input[k * stride];
+        }
+        output += run;
+        first += run;
+        count -= run;
+    }
+}
+
+// Whether the devices of a series are read at their own times
+static bool has_device_times(const MappedTrace &trace, const PowerSeries &series)
+{
+    return trace.info().sources[series.source].device_times && !series.devices.empty();
+}
+
+// Position of the time of a device's reading in a record
+static size_t device_time_word(const MappedTrace &trace, const PowerSeries &series, size_t device)
+{
+    return trace.source_word(series.source) + 1 + trace.info().sources[series.source].devices.size() + device;
+}
+
+/*
+Time of a sample of a series: its source's timestamp, or the mean time of the readings of its
+devices for sources with per-device timestamps
+*/
+static uint64_t series_time(const MappedTrace &trace, const PowerSeries &series, size_t sample)
+{
+    if (!has_device_times(trace, series))
+    {
+        return trace.time(series.source, sample);
+    }
+    const uint64_t *record = trace.record(sample);
+    const uint64_t base = record[device_time_word(trace, series, series.devices[0])];
+    int64_t offset = 0;
+    for (size_t device : series.devices)
+    {
+        offset += (int64_t)(record[device_time_word(trace, series, device)] - base);
+    }
+    return base + (uint64_t)(offset / (int64_t)series.devices.size());
+}
+
+// Returns the first sample of a series at or after time_ns, see MappedTrace::find
+static size_t series_find(const MappedTrace &trace, const PowerSeries &series, uint64_t time_ns)
+{
+    if (!has_device_times(trace, series))
+    {
+        return trace.find(time_ns, series.source);
+    }
+    size_t low = 0, high = trace.num_samples();
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (series_time(trace, series, middle) < time_ns)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/*
+Splits a series of devices with their own timestamps into a series per device, whose intervals
+are exactly their readings'. Interpolations within intervals are done per device
+*/
+static std::vector<PowerSeries> device_series(const MappedTrace &trace, const PowerSeries &series)
+{
+    if (!has_device_times(trace, series) || series.devices.size() == 1)
+    {
+        return {series};
+    }
+    std::vector<PowerSeries> split;
+    for (size_t device : series.devices)
+    {
+        split.push_back({series.source, {device}});
+    }
+    return split;
+}
+
+/*
+Calls process(chunk) on consecutive chunks of the intervals between samples first and last. The
+power of an interval is the energy over the time between its samples, for sources with per-device
+timestamps the sum of each device's energy over the time between its own readings (as DomainSeries
+computes it), the intervals then spanning the series' times (see series_time)
+*/
+template <typename Process>
+static void for_each_chunk(const MappedTrace &trace, const PowerSeries &series, size_t first, size_t last, Process process)
+{
+    const auto &source = trace.info().sources[series.source];
+    const size_t source_word = trace.source_word(series.source);
+    const bool device_times = has_device_times(trace, series);
+    const int64_t num_devices = (int64_t)series.devices.size();
+    Chunk chunk;
+    chunk.ticks.resize(series.devices.size());
+    uint64_t times[ANALYSIS_CHUNK + 1];
+    uint64_t counters[ANALYSIS_CHUNK + 1];
+    uint64_t ticks[ANALYSIS_CHUNK];
+    // Per-device timestamps: those of the device read, of the first device of the series, and
+    // the sum of the other devices' offsets from it
+    uint64_t reading_times[ANALYSIS_CHUNK + 1];
+    uint64_t base_times[ANALYSIS_CHUNK + 1];
+    int64_t offsets[ANALYSIS_CHUNK + 1];
+    for (size_t start = first; start < last; start += chunk.size)
+    {
+        const size_t n = std::min((size_t)ANALYSIS_CHUNK, last - start);
+        chunk.size = n;
+#pragma omp simd
+        for (size_t k = 0; k < n; ++k)
+        {
+            chunk.energy[k] = 0;
+            chunk.power[k] = 0;
+        }
+        if (device_times)
+        {
+            gather(trace, start, n + 1, device_time_word(trace, series, series.devices[0]), base_times);
+            std::fill(offsets, offsets + n + 1, 0);
+        }
+        for (size_t i = 0; i < series.devices.size(); ++i)
+        {
+            const size_t device = series.devices[i];
+            gather(trace, start, n + 1, source_word + 1 + device, counters);
+            // Same correction of the wraparounds as DeviceCounters
+            const uint64_t counter_max = source.devices[device].counter_max;
+            const double unit = source.devices[device].energy_unit;
+            uint64_t total = 0;
+#pragma omp simd reduction(+ : total)
+            for (size_t k = 0; k < n; ++k)
+            {
+                ticks[k] = counters[k + 1] - counters[k] + (counters[k + 1] < counters[k] ? counter_max : 0);
+                total += ticks[k];
+            }
+            // Converted in a separate pass, as the integer pass vectorizes on targets without
+            // vector 64 bit integer to double conversions
+#pragma omp simd
+            for (size_t k = 0; k < n; ++k)
+            {
+                chunk.energy[k] += (double)ticks[k] * unit;
+            }
+            chunk.ticks[i] = total;
+            if (!device_times)
+            {
+                continue;
+            }
+            gather(trace, start, n + 1, device_time_word(trace, series, device), reading_times);
+#pragma omp simd
+            for (size_t k = 0; k < n + 1; ++k)
+            {
+                offsets[k] += (int64_t)(reading_times[k] - base_times[k]);
+            }
+#pragma omp simd
+            for (size_t k = 0; k < n; ++k)
+            {
+                double seconds = (double)(int64_t)(reading_times[k + 1] - reading_times[k]) * 1E-9;
+                chunk.power[k] += seconds > 0 ? (double)ticks[k] * unit / seconds : 0;
+            }
+        }
+
+        if (device_times)
+        {
+#pragma omp simd
+            for (size_t k = 0; k < n + 1; ++k)
+            {
+                times[k] = base_times[k] + (uint64_t)(offsets[k] / num_devices);
+            }
+        }
+        else
+        {
+            gather(trace, start, n + 1, source_word, times);
+        }
+#pragma omp simd
+        for (size_t k = 0; k < n; ++k)
+        {
+            chunk.seconds[k] = (double)(int64_t)(times[k + 1] - times[k]) * 1E-9;
+            chunk.end_time[k] = times[k + 1];
+        }
+        if (!device_times)
+        {
+#pragma omp simd
+            for (size_t k = 0; k < n; ++k)
+            {
+                chunk.power[k] = chunk.seconds[k] > 0 ? chunk.energy[k] / chunk.seconds[k] : 0;
+            }
+        }
+        process(chunk);
+    }
+}
+
+// Energy in Joules of the ticks of each device of a series
+static double ticks_energy(const MappedTrace &trace, const PowerSeries &series, const std::vector<uint64_t> &ticks)
+{
+    const auto &devices = trace.info().sources[series.source].devices;
+    double energy = 0;
+    for (size_t i = 0; i < series.devices.size(); ++i)
+    {
+        energy += (double)ticks[i] * devices[series.devices[i]].energy_unit;
+    }
+    return energy;
+}
+
+//////////////////////////////////////////////////////////////////////
+//						       REDUCTIONS
+//////////////////////////////////////////////////////////////////////
+
+PowerStats power_meter::power_stats(const MappedTrace &trace, const PowerSeries &series, uint64_t t0, uint64_t t1)
+{
+    PowerStats stats;
+    size_t first = series_find(trace, series, t0);
+    size_t last = series_find(trace, series, t1);
+    if (last < first + 2)
+    {
+        return stats;
+    }
+    --last;
+    std::vector<uint64_t> ticks(series.devices.size(), 0);
+    for_each_chunk(trace, series, first, last, [&](const Chunk &chunk)
+                   {
+        double peak = 0;
+#pragma omp simd reduction(max : peak)
+        for (size_t k = 0; k < chunk.size; ++k)
+        {
+            peak = std::max(peak, chunk.power[k]);
+        }
+        // Only chunks holding a new peak are searched for its time
+        if (peak > stats.peak_power || stats.intervals == 0)
+        {
+            size_t k = (size_t)(std::find(chunk.power, chunk.power + chunk.size, peak) - chunk.power);
+            stats.peak_power = peak;
+            stats.peak_time_ns = chunk.end_time[k];
+        }
+        for (size_t i = 0; i < ticks.size(); ++i)
+        {
+            ticks[i] += chunk.ticks[i];
+        }
+        stats.intervals += chunk.size; });
+
+    stats.energy = ticks_energy(trace, series, ticks);
+    stats.duration = (double)(int64_t)(series_time(trace, series, last) - series_time(trace, series, first)) * 1E-9;
+    stats.mean_power = stats.duration > 0 ? stats.energy / stats.duration : 0;
+    stats.edp = stats.energy * stats.duration;
+    return stats;
+}
+
+/*
+Energy consumed between samples first and last, in counter ticks so the sum is exact
+*/
+static double sample_energy(const MappedTrace &trace, const PowerSeries &series, size_t first, size_t last)
+{
+    std::vector<uint64_t> ticks(series.devices.size(), 0);
+    for_each_chunk(trace, series, first, last, [&](const Chunk &chunk)
+                   {
+        for (size_t i = 0; i < ticks.size(); ++i)
+        {
+            ticks[i] += chunk.ticks[i];
+        } });
+    return ticks_energy(trace, series, ticks);
+}
+
+/*
+Part of the energy of the interval ending at sample end consumed between from and to
+*/
+static double partial_energy(const MappedTrace &trace, const PowerSeries &series, size_t end, uint64_t from, uint64_t to)
+{
+    uint64_t start_time = series_time(trace, series, end - 1);
+    uint64_t end_time = series_time(trace, series, end);
+    if (end_time <= start_time)
+    {
+        return 0;
+    }
+    return sample_energy(trace, series, end - 1, end) * (double)(to - from) / (double)(end_time - start_time);
+}
+
+/*
+energy_between for a series whose devices share the times of its intervals
+*/
+static double interval_energy_between(const MappedTrace &trace, const PowerSeries &series, uint64_t t0, uint64_t t1)
+{
+    const size_t samples = trace.num_samples();
+    // First samples at or after t0 and t1
+    size_t first = series_find(trace, series, t0);
+    size_t last = series_find(trace, series, t1);
+    if (first == last)
+    {
+        // Within a single interval, or outside the trace
+        return first == 0 || first == samples ? 0 : partial_energy(trace, series, first, t0, t1);
+    }
+    double energy = sample_energy(trace, series, first, last - 1);
+    if (first > 0)
+    {
+        energy += partial_energy(trace, series, first, t0, series_time(trace, series, first));
+    }
+    if (last < samples)
+    {
+        energy += partial_energy(trace, series, last, series_time(trace, series, last - 1), t1);
+    }
+    return energy;
+}
+
+double power_meter::energy_between(const MappedTrace &trace, const PowerSeries &series, uint64_t t0, uint64_t t1)
+{
+    if (trace.num_samples() < 2 || t1 <= t0)
+    {
+        return 0;
+    }
+    double energy = 0;
+    for (const auto &device : device_series(trace, series))
+    {
+        energy += interval_energy_between(trace, device, t0, t1);
+    }
+    return energy;
+}
+
+void power_meter::power_curve(const MappedTrace &trace, const PowerSeries &series, PowerCurve &curve, uint64_t t0, uint64_t t1)
+{
+    curve.time_ns.clear();
+    curve.power.clear();
+    size_t first = series_find(trace, series, t0);
+    size_t last = series_find(trace, series, t1);
+    if (last < first + 2)
+    {
+        return;
+    }
+    --last;
+    curve.time_ns.resize(last - first);
+    curve.power.resize(last - first);
+    size_t position = 0;
+    for_each_chunk(trace, series, first, last, [&](const Chunk &chunk)
+                   {
+        std::copy(chunk.power, chunk.power + chunk.size, curve.power.begin() + position);
+        std::copy(chunk.end_time, chunk.end_time + chunk.size, curve.time_ns.begin() + position);
+        position += chunk.size; });
+}
+
+void power_meter::sliding_window_max(const PowerCurve &curve, uint64_t window_ns, std::vector<double> &output)
+{
+    output.resize(curve.power.size());
+    // Intervals of the window in decreasing order of power, each one evicts the lower ones
+    // before it, so every interval enters and leaves the deque once
+    std::deque<size_t> window;
+    for (size_t k = 0; k < curve.power.size(); ++k)
+    {
+        while (!window.empty() && curve.power[window.back()] <= curve.power[k])
+        {
+            window.pop_back();
+        }
+        window.push_back(k);
+        while (curve.time_ns[k] - curve.time_ns[window.front()] >= window_ns && window.front() != k)
+        {
+            window.pop_front();
+        }
+        output[k] = curve.power[window.front()];
+    }
+}
+
+PowerHistogram power_meter::power_histogram(const MappedTrace &trace, const PowerSeries &series, double min_power,
+                                            double max_power, size_t bins, uint64_t t0, uint64_t t1)
+{
+    PowerHistogram histogram;
+    bins = std::max(bins, (size_t)1);
+    histogram.min_power = min_power;
+    histogram.bin_width = max_power > min_power ? (max_power - min_power) / (double)bins : 1;
+    histogram.seconds.assign(bins, 0);
+    histogram.intervals.assign(bins, 0);
+    size_t first = series_find(trace, series, t0);
+    size_t last = series_find(trace, series, t1);
+    if (last < first + 2)
+    {
+        return histogram;
+    }
+    const double inverse_width = 1 / histogram.bin_width;
+    const double last_bin = (double)(bins - 1);
+    uint32_t bin[ANALYSIS_CHUNK];
+    for_each_chunk(trace, series, first, last - 1, [&](const Chunk &chunk)
+                   {
+        // The bins are computed in a vectorized pass, only the increments are scalar
+#pragma omp simd
+        for (size_t k = 0; k < chunk.size; ++k)
+        {
+            double position = (chunk.power[k] - min_power) * inverse_width;
+            bin[k] = (uint32_t)std::min(std::max(position, 0.0), last_bin);
+        }
+        for (size_t k = 0; k < chunk.size; ++k)
+        {
+            histogram.seconds[bin[k]] += chunk.seconds[k];
+            ++histogram.intervals[bin[k]];
+        } });
+    return histogram;
+}
+
+std::vector<uint64_t> power_meter::time_grid(uint64_t t0, uint64_t t1, uint64_t step_ns)
+{
+    std::vector<uint64_t> grid;
+    for (uint64_t time = t0; step_ns > 0 && time <= t1; time += step_ns)
+    {
+        grid.push_back(time);
+        if (t1 - time < step_ns)
+        {
+            break;
+        }
+    }
+    return grid;
+}
+
+/*
+Adds the energy consumed by a series whose devices share the times of its intervals from its
+first sample to each point of the grid to energy, constant outside the trace
+*/
+static void cumulative_energy(const MappedTrace &trace, const PowerSeries &series, const std::vector<uint64_t> &grid,
+                              std::vector<double> &energy)
+{
+    size_t point = 0;
+    const uint64_t first_time = series_time(trace, series, 0);
+    while (point < grid.size() && grid[point] <= first_time)
+    {
+        ++point;
+    }
+    double total = 0;
+    for_each_chunk(trace, series, 0, trace.num_samples() - 1, [&](const Chunk &chunk)
+                   {
+        for (size_t k = 0; k < chunk.size && point < grid.size(); ++k)
+        {
+            // Points within the interval ending at end_time[k]
+            while (point < grid.size() && grid[point] <= chunk.end_time[k])
+            {
+                double fraction = chunk.seconds[k] > 0 ? 1 - (double)(chunk.end_time[k] - grid[point]) * 1E-9 / chunk.seconds[k] : 1;
+                energy[point++] += total + chunk.energy[k] * fraction;
+            }
+            total += chunk.energy[k];
+        } });
+    for (; point < grid.size(); ++point)
+    {
+        energy[point] += total;
+    }
+}
+
+void power_meter::resample(const MappedTrace &trace, const PowerSeries &series, const std::vector<uint64_t> &grid,
+                           std::vector<double> &power)
+{
+    power.assign(grid.size() > 1 ? grid.size() - 1 : 0, 0);
+    if (grid.size() < 2 || trace.num_samples() < 2)
+    {
+        return;
+    }
+    std::vector<double> energy(grid.size(), 0);
+    for (const auto &device : device_series(trace, series))
+    {
+        cumulative_energy(trace, device, grid, energy);
+    }
+
+    double *output = power.data();
+    const double *cumulative = energy.data();
+    const uint64_t *times = grid.data();
+#pragma omp simd
+    for (size_t k = 0; k < power.size(); ++k)
+    {
+        double seconds = (double)(times[k + 1] - times[k]) * 1E-9;
+        output[k] = seconds > 0 ? (cumulative[k + 1] - cumulative[k]) / seconds : 0;
+    }
+}
+
+std::vector<PhaseStats> power_meter::phase_stats(const MappedTrace &trace, const PowerSeries &series)
+{
+    // Open phases of each thread, with their start time
+    std::map<uint32_t, std::vector<std::pair<std::string, uint64_t>>> open;
+    std::map<std::string, PhaseStats> phases;
+    for (const auto &marker : trace.markers())
+    {
+        std::string name(marker.name, strnlen(marker.name, MARKER_NAME_SIZE));
+        auto &stack = open[marker.thread];
+        if (marker.type == MARKER_PHASE_BEGIN || marker.type == MARKER_REGION_BEGIN)
+        {
+            stack.emplace_back(name, marker.time_ns);
+            continue;
+        }
+        if (marker.type != MARKER_PHASE_END && marker.type != MARKER_REGION_END)
+        {
+            continue;
+        }
+        auto begin = std::find_if(stack.rbegin(), stack.rend(), [&](const std::pair<std::string, uint64_t> &phase)
+                                  { return phase.first == name; });
+        if (begin == stack.rend())
+        {
+            continue;
+        }
+        uint64_t start = begin->second;
+        stack.erase(std::next(begin).base());
+        // A recursive instance is part of the outer one
+        if (std::any_of(stack.begin(), stack.end(), [&](const std::pair<std::string, uint64_t> &phase)
+                        { return phase.first == name; }))
+        {
+            continue;
+        }
+        auto &phase = phases[name];
+        phase.name = name;
+        ++phase.calls;
+        phase.duration += (double)(marker.time_ns - start) * 1E-9;
+        phase.energy += energy_between(trace, series, start, marker.time_ns);
+    }
+
+    std::vector<PhaseStats> result;
+    for (auto &entry : phases)
+    {
+        entry.second.mean_power = entry.second.duration > 0 ? entry.second.energy / entry.second.duration : 0;
+        result.push_back(entry.second);
+    }
+    return result;
+}
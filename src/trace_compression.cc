@@ -0,0 +1,355 @@
+#include "trace_compression.hh"
+#include "trace_format.hh"
+
+#include <string.h>
+#include <algorithm>
+
+// Longest varint of a 64 bit value
+#define MAX_VARINT_SIZE 10
+
+using namespace power_meter;
+
+static uint64_t to_ns(const struct timespec &time)
+{
+    return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+}
+
+//////////////////////////////////////////////////////////////////////
+//						         ENCODER
+//////////////////////////////////////////////////////////////////////
+
+void power_meter::TraceBlockEncoder::begin(const std::vector<SourceInfo> &sources)
+{
+    source_devices.clear();
+    source_device_times.clear();
+    size_t devices = 0;
+    max_sample_size = MAX_VARINT_SIZE;
+    for (const auto &source : sources)
+    {
+        source_devices.push_back((unsigned int)source.devices.size());
+        source_device_times.push_back(source.device_times);
+        devices += source.devices.size();
+        max_sample_size += record_words(source) * MAX_VARINT_SIZE;
+    }
+    previous_time.assign(sources.size(), 0);
+    previous_interval.assign(sources.size(), 0);
+    previous_counters.assign(devices, 0);
+    reset();
+}
+
+void power_meter::TraceBlockEncoder::reserve(size_t size)
+{
+    if (used + size > buffer.size())
+    {
+        buffer.resize(std::max(buffer.size() * 2, used + size));
+    }
+}
+
+void power_meter::TraceBlockEncoder::add_sample(const SourceReading *readings)
+{
+    reserve(max_sample_size);
+    unsigned char *output = buffer.data() + used;
+    output = put_varint(output, TRACE_RECORD_SAMPLE);
+    uint64_t *previous = previous_counters.data();
+    for (size_t i = 0; i < source_devices.size(); ++i)
+    {
+        uint64_t time_ns = to_ns(readings[i].time);
+        // The first sample of the block holds its time, the next ones the change of the interval
+        int64_t interval = num_samples == 0 ? 0 : (int64_t)(time_ns - previous_time[i]);
+        output = put_varint(output, zigzag_encode(num_samples == 0 ? (int64_t)time_ns : interval - previous_interval[i]));
+        previous_time[i] = time_ns;
+        previous_interval[i] = interval;
+
+        const uint64_t *counters = readings[i].counters.get();
+        const unsigned int num_devices = source_devices[i];
+        for (unsigned int device = 0; device < num_devices; ++device)
+        {
+            output = put_varint(output, zigzag_encode((int64_t)(counters[device] - previous[device])));
+            previous[device] = counters[device];
+        }
+        previous += num_devices;
+        if (source_device_times[i])
+        {
+            const uint64_t *device_times = readings[i].device_times.get();
+            for (unsigned int device = 0; device < num_devices; ++device)
+            {
+                output = put_varint(output, zigzag_encode((int64_t)(device_times[device] - time_ns)));
+            }
+        }
+    }
+    used = (size_t)(output - buffer.data());
+
+    if (!source_devices.empty())
+    {
+        last_time_ns = to_ns(readings[0].time);
+        if (num_samples == 0)
+        {
+            first_time_ns = last_time_ns;
+        }
+    }
+    ++num_samples;
+    ++num_records;
+}
+
+void power_meter::TraceBlockEncoder::add_marker(const Marker &marker)
+{
+    size_t name_size = strnlen(marker.name, MARKER_NAME_SIZE);
+    reserve(4 * MAX_VARINT_SIZE + name_size);
+    unsigned char *output = buffer.data() + used;
+    output = put_varint(output, TRACE_RECORD_MARKER);
+    uint64_t base = previous_time.empty() ? 0 : previous_time[0];
+    output = put_varint(output, zigzag_encode((int64_t)(marker.time_ns - base)));
+    output = put_varint(output, marker.type);
+    output = put_varint(output, marker.thread);
+    output = put_varint(output, name_size);
+    memcpy(output, marker.name, name_size);
+    used = (size_t)(output + name_size - buffer.data());
+    ++num_records;
+}
+
+TraceBlockHeader power_meter::TraceBlockEncoder::header() const
+{
+    return {TRACE_BLOCK_MAGIC, (uint32_t)used, num_records, num_samples, first_time_ns, last_time_ns};
+}
+
+void power_meter::TraceBlockEncoder::reset()
+{
+    used = 0;
+    num_records = 0;
+    num_samples = 0;
+    first_time_ns = 0;
+    last_time_ns = 0;
+    std::fill(previous_time.begin(), previous_time.end(), 0);
+    std::fill(previous_interval.begin(), previous_interval.end(), 0);
+    std::fill(previous_counters.begin(), previous_counters.end(), 0);
+}
+
+//////////////////////////////////////////////////////////////////////
+//						         DECODER
+//////////////////////////////////////////////////////////////////////
+
+void power_meter::TraceBlockDecoder::begin(const std::vector<SourceInfo> &sources)
+{
+    this->sources = sources;
+    previous_time.assign(sources.size(), 0);
+    previous_interval.assign(sources.size(), 0);
+    previous_counters.assign(sources.size(), {});
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        previous_counters[i].resize(sources[i].devices.size());
+    }
+    load(nullptr, 0, 0);
+}
+
+void power_meter::TraceBlockDecoder::load(const unsigned char *data, size_t size, uint32_t num_records)
+{
+    position = data;
+    end = data + size;
+    remaining = num_records;
+    first_sample = true;
+    std::fill(previous_time.begin(), previous_time.end(), 0);
+    std::fill(previous_interval.begin(), previous_interval.end(), 0);
+    for (auto &counters : previous_counters)
+    {
+        std::fill(counters.begin(), counters.end(), 0);
+    }
+}
+
+uint64_t power_meter::TraceBlockDecoder::next_record(std::vector<SourceReading> &readings, Marker &marker)
+{
+    if (remaining == 0)
+    {
+        return 0;
+    }
+    --remaining;
+    uint64_t type, value;
+    const unsigned char *input = get_varint(position, end, type);
+    if (input && type == TRACE_RECORD_MARKER)
+    {
+        uint64_t time, marker_type, thread, name_size;
+        input = get_varint(input, end, time);
+        input = input ? get_varint(input, end, marker_type) : nullptr;
+        input = input ? get_varint(input, end, thread) : nullptr;
+        input = input ? get_varint(input, end, name_size) : nullptr;
+        if (!input || name_size >= MARKER_NAME_SIZE || name_size > (size_t)(end - input))
+        {
+            fprintf(stderr, "POWER METER: ERROR: Corrupt marker in compressed trace block\n");
+            remaining = 0;
+            return 0;
+        }
+        uint64_t base = previous_time.empty() ? 0 : previous_time[0];
+        marker.time_ns = base + (uint64_t)zigzag_decode(time);
+        marker.type = (uint32_t)marker_type;
+        marker.thread = (uint32_t)thread;
+        memcpy(marker.name, input, name_size);
+        memset(marker.name + name_size, 0, MARKER_NAME_SIZE - name_size);
+        position = input + name_size;
+        return TRACE_RECORD_MARKER;
+    }
+    if (!input || type != TRACE_RECORD_SAMPLE)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Corrupt record in compressed trace block\n");
+        remaining = 0;
+        return 0;
+    }
+
+    if (readings.size() != sources.size())
+    {
+        allocate_readings(sources, readings);
+    }
+    for (size_t i = 0; i < sources.size() && input; ++i)
+    {
+        input = get_varint(input, end, value);
+        if (!input)
+        {
+            break;
+        }
+        uint64_t time_ns;
+        if (first_sample)
+        {
+            time_ns = (uint64_t)zigzag_decode(value);
+            previous_interval[i] = 0;
+        }
+        else
+        {
+            previous_interval[i] += zigzag_decode(value);
+            time_ns = previous_time[i] + (uint64_t)previous_interval[i];
+        }
+        previous_time[i] = time_ns;
+        readings[i].time.tv_sec = (time_t)(time_ns / 1000000000ULL);
+        readings[i].time.tv_nsec = (long)(time_ns % 1000000000ULL);
+
+        uint64_t *counters = readings[i].counters.get();
+        uint64_t *previous = previous_counters[i].data();
+        const size_t num_devices = sources[i].devices.size();
+        for (size_t device = 0; device < num_devices && input; ++device)
+        {
+            input = get_varint(input, end, value);
+            previous[device] += (uint64_t)zigzag_decode(value);
+            counters[device] = previous[device];
+        }
+        if (sources[i].device_times)
+        {
+            uint64_t *device_times = readings[i].device_times.get();
+            for (size_t device = 0; device < num_devices && input; ++device)
+            {
+                input = get_varint(input, end, value);
+                device_times[device] = time_ns + (uint64_t)zigzag_decode(value);
+            }
+        }
+    }
+    if (!input)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Corrupt sample in compressed trace block\n");
+        remaining = 0;
+        return 0;
+    }
+    position = input;
+    first_sample = false;
+    return TRACE_RECORD_SAMPLE;
+}
+
+//////////////////////////////////////////////////////////////////////
+//						          INDEX
+//////////////////////////////////////////////////////////////////////
+
+bool power_meter::read_trace_index(const std::filesystem::path &path, std::vector<TraceIndexEntry> &index)
+{
+    index.clear();
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not open trace file %s\n", path.c_str());
+        return false;
+    }
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, POWER_METER_COMPRESSED_TRACE_MAGIC, sizeof(POWER_METER_COMPRESSED_TRACE_MAGIC)) != 0)
+    {
+        fprintf(stderr, "POWER METER: ERROR: %s is not a compressed power meter trace\n", path.c_str());
+        fclose(file);
+        return false;
+    }
+    fseeko(file, 0, SEEK_END);
+    off_t file_size = ftello(file);
+
+    // Written when the trace was closed
+    TraceIndexFooter footer;
+    TraceBlockHeader block;
+    if (file_size >= (off_t)(header.header_size + sizeof(footer)) &&
+        fseeko(file, file_size - (off_t)sizeof(footer), SEEK_SET) == 0 &&
+        fread(&footer, sizeof(footer), 1, file) == 1 &&
+        memcmp(footer.magic, TRACE_INDEX_FOOTER_MAGIC, sizeof(TRACE_INDEX_FOOTER_MAGIC)) == 0 &&
+        fseeko(file, (off_t)footer.index_offset, SEEK_SET) == 0 &&
+        fread(&block, sizeof(block), 1, file) == 1 && block.magic == TRACE_INDEX_MAGIC)
+    {
+        index.resize(block.num_records);
+        if (fread(index.data(), sizeof(TraceIndexEntry), index.size(), file) == index.size())
+        {
+            fclose(file);
+            return true;
+        }
+        index.clear();
+    }
+
+    // Cut short, every complete block is kept
+    off_t offset = header.header_size;
+    uint64_t samples = 0;
+    while (fseeko(file, offset, SEEK_SET) == 0 && fread(&block, sizeof(block), 1, file) == 1 &&
+           block.magic == TRACE_BLOCK_MAGIC && offset + (off_t)(sizeof(block) + block.size) <= file_size)
+    {
+        index.push_back({(uint64_t)offset, samples, block.first_time_ns, block.last_time_ns});
+        samples += block.num_samples;
+        offset += (off_t)(sizeof(block) + block.size);
+    }
+    fclose(file);
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+//						        CONVERSION
+//////////////////////////////////////////////////////////////////////
+
+/*
+Copies every record of the trace at input to a trace at output, compressed or not
+*/
+static bool rewrite_trace(const std::filesystem::path &input, const std::filesystem::path &output, bool compressed,
+                          uint32_t block_records)
+{
+    TraceReader reader;
+    if (!reader.open(input))
+    {
+        return false;
+    }
+    TraceWriter writer;
+    if (!writer.open(output, reader.info(), compressed, block_records))
+    {
+        return false;
+    }
+    std::vector<SourceReading> readings;
+    Marker marker;
+    while (uint64_t type = reader.next_record(readings, marker))
+    {
+        if (type == TRACE_RECORD_MARKER)
+        {
+            writer.write_marker(marker);
+        }
+        else
+        {
+            writer.write_sample(readings.data());
+        }
+    }
+    writer.close();
+    return true;
+}
+
+bool power_meter::compress_trace(const std::filesystem::path &input, const std::filesystem::path &output,
+                                 uint32_t block_records)
+{
+    return rewrite_trace(input, output, true, block_records);
+}
+
+bool power_meter::decompress_trace(const std::filesystem::path &input, const std::filesystem::path &output)
+{
+    return rewrite_trace(input, output, false, 0);
+}
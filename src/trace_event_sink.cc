@@ -0,0 +1,454 @@
+#include "trace_event_sink.hh"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+
+// Fields of the perfetto::protos messages written by PerfettoSink
+#define PERFETTO_TRACE_PACKET 1
+#define PERFETTO_PACKET_TIMESTAMP 8
+#define PERFETTO_PACKET_CLOCK_ID 58
+#define PERFETTO_PACKET_SEQUENCE_ID 10
+#define PERFETTO_PACKET_SEQUENCE_FLAGS 13
+#define PERFETTO_PACKET_CLOCK_SNAPSHOT 6
+#define PERFETTO_PACKET_TRACK_EVENT 11
+#define PERFETTO_PACKET_TRACK_DESCRIPTOR 60
+#define PERFETTO_SNAPSHOT_CLOCKS 1
+#define PERFETTO_CLOCK_ID 1
+#define PERFETTO_CLOCK_TIMESTAMP 2
+#define PERFETTO_DESCRIPTOR_UUID 1
+#define PERFETTO_DESCRIPTOR_NAME 2
+#define PERFETTO_DESCRIPTOR_PROCESS 3
+#define PERFETTO_DESCRIPTOR_PARENT_UUID 5
+#define PERFETTO_DESCRIPTOR_COUNTER 8
+#define PERFETTO_PROCESS_PID 1
+#define PERFETTO_PROCESS_NAME 6
+#define PERFETTO_COUNTER_UNIT_NAME 6
+#define PERFETTO_EVENT_TYPE 9
+#define PERFETTO_EVENT_TRACK_UUID 11
+#define PERFETTO_EVENT_CATEGORIES 22
+#define PERFETTO_EVENT_NAME 23
+#define PERFETTO_EVENT_DOUBLE_COUNTER_VALUE 44
+
+// BuiltinClock values
+#define PERFETTO_CLOCK_REALTIME 1
+#define PERFETTO_CLOCK_MONOTONIC 3
+#define PERFETTO_CLOCK_BOOTTIME 6
+// TracePacket::SequenceFlags::SEQ_INCREMENTAL_STATE_CLEARED
+#define PERFETTO_SEQ_INCREMENTAL_STATE_CLEARED 1
+// Written packets all belong to one sequence
+#define PERFETTO_SEQUENCE_ID 1
+
+// TrackEvent::Type values
+enum PERFETTO_EVENT
+{
+    PERFETTO_SLICE_BEGIN = 1,
+    PERFETTO_SLICE_END = 2,
+    PERFETTO_INSTANT = 3,
+    PERFETTO_COUNTER = 4
+};
+
+// Protobuf wire types
+enum WIRE_TYPE
+{
+    WIRE_VARINT = 0,
+    WIRE_FIXED64 = 1,
+    WIRE_LENGTH_DELIMITED = 2
+};
+
+static uint64_t timespec_ns(const struct timespec &time)
+{
+    return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+}
+
+static uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec time;
+    clock_gettime(clock, &time);
+    return timespec_ns(time);
+}
+
+static void counter_tracks(const power_meter::DomainSeries &series, const std::vector<power_meter::SourceInfo> &sources,
+                           std::vector<power_meter::CounterTrack> &tracks)
+{
+    tracks.clear();
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        const auto &domains = series.domains(i);
+        const auto &groups = series.device_domains(i);
+        for (unsigned int domain = 0; domain < domains.size(); ++domain)
+        {
+            std::string prefix = sources[i].label + " " + domains[domain];
+            tracks.push_back({prefix + " power", i, domain, -1, false});
+            tracks.push_back({prefix + " energy", i, domain, -1, true});
+            if (std::count(groups.begin(), groups.end(), domain) < 2)
+            {
+                continue;
+            }
+            for (size_t device = 0; device < groups.size(); ++device)
+            {
+                if (groups[device] == domain)
+                {
+                    tracks.push_back({sources[i].label + " " + sources[i].devices[device].name + " power", i, domain, (int)device, false});
+                }
+            }
+        }
+    }
+}
+
+static double counter_value(const power_meter::DomainSeries &series, const power_meter::CounterTrack &track)
+{
+    if (track.device >= 0)
+    {
+        return series.devices(track.source).power()[track.device];
+    }
+    const auto &result = series.results(track.source)[track.domain];
+    return track.energy ? result.total_energy : result.power;
+}
+
+static const char *marker_category(uint32_t type)
+{
+    using namespace power_meter;
+    switch (type)
+    {
+    case MARKER_PHASE_BEGIN:
+    case MARKER_PHASE_END:
+        return "phase";
+    case MARKER_REGION_BEGIN:
+    case MARKER_REGION_END:
+        return "region";
+    default:
+        return "mark";
+    }
+}
+
+static void write_json_string(FILE *file, const char *text)
+{
+    fputc('"', file);
+    for (const char *c = text; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fputc('\\', file);
+            fputc(*c, file);
+        }
+        else if ((unsigned char)*c < 0x20)
+        {
+            fprintf(file, "\\u%04x", (unsigned int)*c);
+        }
+        else
+        {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+void power_meter::ChromeTraceSink::begin(const std::vector<SourceInfo> &sources)
+{
+    series.begin(sources);
+    counter_tracks(series, sources, tracks);
+    threads.clear();
+    file = fopen(path.c_str(), "w");
+    if (!file)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not create trace file %s\n", path.c_str());
+        return;
+    }
+    pid = getpid();
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":", (int)pid);
+    write_json_string(file, program_invocation_short_name);
+    fprintf(file, "}}");
+}
+
+void power_meter::ChromeTraceSink::write_sample(const SourceReading *readings)
+{
+    if (!file || !series.update(readings))
+    {
+        return;
+    }
+    for (const auto &track : tracks)
+    {
+        fprintf(file, ",\n{\"name\":");
+        write_json_string(file, track.name.c_str());
+        fprintf(file, ",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"args\":{\"%s\":%.6f}}",
+                (double)timespec_ns(readings[track.source].time) / 1E3, (int)pid, track.energy ? "J" : "W",
+                counter_value(series, track));
+    }
+}
+
+void power_meter::ChromeTraceSink::add_thread(uint32_t thread)
+{
+    if (thread < threads.size() && threads[thread])
+    {
+        return;
+    }
+    if (thread >= threads.size())
+    {
+        threads.resize(thread + 1, false);
+    }
+    threads[thread] = true;
+    fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"markers %u\"}}",
+            (int)pid, thread + 1, thread);
+}
+
+void power_meter::ChromeTraceSink::write_marker(const Marker &marker)
+{
+    if (!file)
+    {
+        return;
+    }
+    add_thread(marker.thread);
+    const char *phase = "i";
+    if (marker.type == MARKER_PHASE_BEGIN || marker.type == MARKER_REGION_BEGIN)
+    {
+        phase = "B";
+    }
+    else if (marker.type == MARKER_PHASE_END || marker.type == MARKER_REGION_END)
+    {
+        phase = "E";
+    }
+    fprintf(file, ",\n{\"name\":");
+    write_json_string(file, marker.name);
+    // Instants are scoped to their thread's track, tid 0 is left to the counters
+    fprintf(file, ",\"cat\":\"%s\",\"ph\":\"%s\",%s\"ts\":%.3f,\"pid\":%d,\"tid\":%u}", marker_category(marker.type),
+            phase, *phase == 'i' ? "\"s\":\"t\"," : "", (double)marker.time_ns / 1E3, (int)pid, marker.thread + 1);
+}
+
+void power_meter::ChromeTraceSink::flush()
+{
+    if (file)
+    {
+        fflush(file);
+    }
+}
+
+void power_meter::ChromeTraceSink::end()
+{
+    if (file)
+    {
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+static void put_varint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+static void put_key(std::string &out, unsigned int field, WIRE_TYPE type)
+{
+    put_varint(out, ((uint64_t)field << 3) | type);
+}
+
+static void put_uint(std::string &out, unsigned int field, uint64_t value)
+{
+    put_key(out, field, WIRE_VARINT);
+    put_varint(out, value);
+}
+
+static void put_double(std::string &out, unsigned int field, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_key(out, field, WIRE_FIXED64);
+    // Little endian whatever the host
+    for (int byte = 0; byte < 8; ++byte)
+    {
+        out.push_back((char)(bits >> (8 * byte)));
+    }
+}
+
+static void put_bytes(std::string &out, unsigned int field, const char *data, size_t size)
+{
+    put_key(out, field, WIRE_LENGTH_DELIMITED);
+    put_varint(out, size);
+    out.append(data, size);
+}
+
+static void put_bytes(std::string &out, unsigned int field, const std::string &data)
+{
+    put_bytes(out, field, data.data(), data.size());
+}
+
+void power_meter::PerfettoSink::begin_packet(uint64_t time_ns)
+{
+    packet.clear();
+    put_uint(packet, PERFETTO_PACKET_TIMESTAMP, time_ns);
+    put_uint(packet, PERFETTO_PACKET_CLOCK_ID, PERFETTO_CLOCK_MONOTONIC);
+    put_uint(packet, PERFETTO_PACKET_SEQUENCE_ID, PERFETTO_SEQUENCE_ID);
+}
+
+void power_meter::PerfettoSink::write_packet()
+{
+    // Key and length of the packet field
+    unsigned char header[1 + 10];
+    size_t size = 0;
+    header[size++] = (PERFETTO_TRACE_PACKET << 3) | WIRE_LENGTH_DELIMITED;
+    uint64_t length = packet.size();
+    while (length >= 0x80)
+    {
+        header[size++] = (unsigned char)(length | 0x80);
+        length >>= 7;
+    }
+    header[size++] = (unsigned char)length;
+    fwrite(header, 1, size, file);
+    fwrite(packet.data(), 1, packet.size(), file);
+}
+
+void power_meter::PerfettoSink::write_track_descriptor(uint64_t uuid, const std::string &name, const char *unit)
+{
+    begin_packet(clock_ns(CLOCK_MONOTONIC));
+    message.clear();
+    put_uint(message, PERFETTO_DESCRIPTOR_UUID, uuid);
+    put_uint(message, PERFETTO_DESCRIPTOR_PARENT_UUID, process_uuid);
+    put_bytes(message, PERFETTO_DESCRIPTOR_NAME, name);
+    if (unit)
+    {
+        nested.clear();
+        put_bytes(nested, PERFETTO_COUNTER_UNIT_NAME, unit, strlen(unit));
+        put_bytes(message, PERFETTO_DESCRIPTOR_COUNTER, nested);
+    }
+    put_bytes(packet, PERFETTO_PACKET_TRACK_DESCRIPTOR, message);
+    write_packet();
+}
+
+void power_meter::PerfettoSink::begin(const std::vector<SourceInfo> &sources)
+{
+    series.begin(sources);
+    counter_tracks(series, sources, tracks);
+    thread_uuids.clear();
+    file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not create trace file %s\n", path.c_str());
+        return;
+    }
+
+    // Snapshot of the clocks, for trace_processor to convert the monotonic timestamps to the
+    // trace's clock, and start of the sequence's state
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    begin_packet(now);
+    message.clear();
+    const std::pair<unsigned int, uint64_t> clocks[] = {{PERFETTO_CLOCK_MONOTONIC, now},
+                                                         {PERFETTO_CLOCK_REALTIME, clock_ns(CLOCK_REALTIME)},
+                                                         {PERFETTO_CLOCK_BOOTTIME, clock_ns(CLOCK_BOOTTIME)}};
+    for (const auto &clock : clocks)
+    {
+        nested.clear();
+        put_uint(nested, PERFETTO_CLOCK_ID, clock.first);
+        put_uint(nested, PERFETTO_CLOCK_TIMESTAMP, clock.second);
+        put_bytes(message, PERFETTO_SNAPSHOT_CLOCKS, nested);
+    }
+    put_bytes(packet, PERFETTO_PACKET_CLOCK_SNAPSHOT, message);
+    put_uint(packet, PERFETTO_PACKET_SEQUENCE_FLAGS, PERFETTO_SEQ_INCREMENTAL_STATE_CLEARED);
+    write_packet();
+
+    // The process's track, parent of every other track
+    pid_t pid = getpid();
+    process_uuid = (uint64_t)pid << 32;
+    begin_packet(now);
+    message.clear();
+    put_uint(message, PERFETTO_DESCRIPTOR_UUID, process_uuid);
+    nested.clear();
+    put_uint(nested, PERFETTO_PROCESS_PID, (uint64_t)pid);
+    put_bytes(nested, PERFETTO_PROCESS_NAME, program_invocation_short_name, strlen(program_invocation_short_name));
+    put_bytes(message, PERFETTO_DESCRIPTOR_PROCESS, nested);
+    put_bytes(packet, PERFETTO_PACKET_TRACK_DESCRIPTOR, message);
+    write_packet();
+
+    for (size_t track = 0; track < tracks.size(); ++track)
+    {
+        write_track_descriptor(process_uuid + 1 + track, tracks[track].name, tracks[track].energy ? "J" : "W");
+    }
+}
+
+void power_meter::PerfettoSink::write_sample(const SourceReading *readings)
+{
+    if (!file || !series.update(readings))
+    {
+        return;
+    }
+    for (size_t track = 0; track < tracks.size(); ++track)
+    {
+        begin_packet(timespec_ns(readings[tracks[track].source].time));
+        message.clear();
+        put_uint(message, PERFETTO_EVENT_TYPE, PERFETTO_COUNTER);
+        put_uint(message, PERFETTO_EVENT_TRACK_UUID, process_uuid + 1 + track);
+        put_double(message, PERFETTO_EVENT_DOUBLE_COUNTER_VALUE, counter_value(series, tracks[track]));
+        put_bytes(packet, PERFETTO_PACKET_TRACK_EVENT, message);
+        write_packet();
+    }
+}
+
+uint64_t power_meter::PerfettoSink::thread_track(uint32_t thread)
+{
+    if (thread >= thread_uuids.size())
+    {
+        thread_uuids.resize(thread + 1, 0);
+    }
+    if (!thread_uuids[thread])
+    {
+        thread_uuids[thread] = process_uuid + 1 + tracks.size() + thread;
+        write_track_descriptor(thread_uuids[thread], "markers " + std::to_string(thread), nullptr);
+    }
+    return thread_uuids[thread];
+}
+
+void power_meter::PerfettoSink::write_marker(const Marker &marker)
+{
+    if (!file)
+    {
+        return;
+    }
+    uint64_t track = thread_track(marker.thread);
+    PERFETTO_EVENT type = PERFETTO_INSTANT;
+    if (marker.type == MARKER_PHASE_BEGIN || marker.type == MARKER_REGION_BEGIN)
+    {
+        type = PERFETTO_SLICE_BEGIN;
+    }
+    else if (marker.type == MARKER_PHASE_END || marker.type == MARKER_REGION_END)
+    {
+        type = PERFETTO_SLICE_END;
+    }
+    begin_packet(marker.time_ns);
+    message.clear();
+    put_uint(message, PERFETTO_EVENT_TYPE, type);
+    put_uint(message, PERFETTO_EVENT_TRACK_UUID, track);
+    const char *category = marker_category(marker.type);
+    put_bytes(message, PERFETTO_EVENT_CATEGORIES, category, strlen(category));
+    // Slice ends close the innermost open slice of the track
+    if (type != PERFETTO_SLICE_END)
+    {
+        put_bytes(message, PERFETTO_EVENT_NAME, marker.name, strnlen(marker.name, MARKER_NAME_SIZE));
+    }
+    put_bytes(packet, PERFETTO_PACKET_TRACK_EVENT, message);
+    write_packet();
+}
+
+void power_meter::PerfettoSink::flush()
+{
+    if (file)
+    {
+        fflush(file);
+    }
+}
+
+void power_meter::PerfettoSink::end()
+{
+    if (file)
+    {
+        fclose(file);
+        file = nullptr;
+    }
+}
@@ -0,0 +1,517 @@
+#include "trace_format.hh"
+#include "trace_pyramid.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+using namespace power_meter;
+
+static void copy_name(char *destination, const std::string &name)
+{
+    memset(destination, 0, POWER_METER_TRACE_NAME_SIZE);
+    strncpy(destination, name.c_str(), POWER_METER_TRACE_NAME_SIZE - 1);
+}
+
+static long long to_ns(const struct timespec &time)
+{
+    return (long long)time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+static std::string parse_name(const char *name)
+{
+    return std::string(name, strnlen(name, POWER_METER_TRACE_NAME_SIZE));
+}
+
+TraceSourceHeader power_meter::make_source_header(const SourceInfo &source)
+{
+    TraceSourceHeader header{};
+    copy_name(header.label, source.label);
+    copy_name(header.name, source.name);
+    header.num_devices = (uint32_t)source.devices.size();
+    header.flags = source.device_times ? (uint32_t)TRACE_SOURCE_DEVICE_TIMES : 0;
+    return header;
+}
+
+TraceDeviceHeader power_meter::make_device_header(const DeviceInfo &device)
+{
+    TraceDeviceHeader header{};
+    copy_name(header.name, device.name);
+    copy_name(header.domain, device.domain);
+    header.energy_unit = device.energy_unit;
+    header.counter_max = device.counter_max;
+    return header;
+}
+
+SourceInfo power_meter::parse_source_header(const TraceSourceHeader &header, uint32_t version)
+{
+    SourceInfo source;
+    source.label = parse_name(header.label);
+    source.name = parse_name(header.name);
+    source.device_times = version >= 3 && (header.flags & TRACE_SOURCE_DEVICE_TIMES) != 0;
+    return source;
+}
+
+DeviceInfo power_meter::parse_device_header(const TraceDeviceHeader &header)
+{
+    return {parse_name(header.name), parse_name(header.domain), header.energy_unit, header.counter_max};
+}
+
+bool power_meter::write_all(int fd, const void *data, size_t size)
+{
+    size_t written = 0;
+    while (written < size)
+    {
+        ssize_t result = ::write(fd, (const char *)data + written, size - written);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            return false;
+        }
+        written += (size_t)result;
+    }
+    return true;
+}
+
+size_t power_meter::TraceInfo::sample_record_size() const
+{
+    size_t words = 1;
+    for (const auto &source : sources)
+    {
+        words += record_words(source);
+    }
+    return words * sizeof(uint64_t);
+}
+
+//////////////////////////////////////////////////////////////////////
+//						         WRITER
+//////////////////////////////////////////////////////////////////////
+
+power_meter::TraceWriter::TraceWriter(size_t buffer_size) : buffer(buffer_size) {}
+
+power_meter::TraceWriter::~TraceWriter()
+{
+    close();
+}
+
+bool power_meter::TraceWriter::open(const std::filesystem::path &path, const TraceInfo &info, bool compressed,
+                                    uint32_t block_records)
+{
+    close();
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not create trace file %s\n", path.c_str());
+        return false;
+    }
+
+    offset = 0;
+    write_failed = false;
+    this->compressed = compressed;
+    this->block_records = std::max(block_records, 1U);
+    TraceFileHeader header{};
+    if (compressed)
+    {
+        memcpy(header.magic, POWER_METER_COMPRESSED_TRACE_MAGIC, sizeof(POWER_METER_COMPRESSED_TRACE_MAGIC));
+    }
+    else
+    {
+        memcpy(header.magic, POWER_METER_TRACE_MAGIC, sizeof(POWER_METER_TRACE_MAGIC));
+    }
+    header.version = POWER_METER_TRACE_VERSION;
+    header.header_size = sizeof(TraceFileHeader);
+    for (const auto &source : info.sources)
+    {
+        header.header_size += sizeof(TraceSourceHeader) + source.devices.size() * sizeof(TraceDeviceHeader);
+    }
+    header.num_sources = (uint32_t)info.sources.size();
+    header.sampling_interval_us = info.sampling_interval_us;
+    header.energy_increment = info.energy_increment;
+    header.vendor_id = info.vendor_id;
+    header.numa_nodes = info.numa_nodes;
+    header.numcores = info.numcores;
+    header.num_gpus = info.num_gpus;
+    append(&header, sizeof(header));
+
+    sources = info.sources;
+    source_devices.clear();
+    source_device_times.clear();
+    for (const auto &source : info.sources)
+    {
+        TraceSourceHeader source_header = make_source_header(source);
+        append(&source_header, sizeof(source_header));
+        for (const auto &device : source.devices)
+        {
+            TraceDeviceHeader device_header = make_device_header(device);
+            append(&device_header, sizeof(device_header));
+        }
+        source_devices.push_back(source_header.num_devices);
+        source_device_times.push_back(source.device_times);
+    }
+    encoder.begin(info.sources);
+    index.clear();
+    samples = 0;
+    return true;
+}
+
+bool power_meter::TraceWriter::open_pyramid(const std::filesystem::path &path)
+{
+    if (fd < 0)
+    {
+        return false;
+    }
+    pyramid = std::make_unique<PyramidWriter>();
+    if (!pyramid->open(path, sources))
+    {
+        pyramid.reset();
+        return false;
+    }
+    return true;
+}
+
+void power_meter::TraceWriter::write_sample(const SourceReading *readings)
+{
+    if (pyramid)
+    {
+        pyramid->add_sample(readings);
+    }
+    if (compressed)
+    {
+        encoder.add_sample(readings);
+        if (encoder.records() >= block_records)
+        {
+            write_block();
+        }
+        return;
+    }
+    uint64_t type = TRACE_RECORD_SAMPLE;
+    append(&type, sizeof(type));
+    for (size_t i = 0; i < source_devices.size(); ++i)
+    {
+        long long time_ns = to_ns(readings[i].time);
+        append(&time_ns, sizeof(time_ns));
+        append(readings[i].counters.get(), source_devices[i] * sizeof(uint64_t));
+        if (source_device_times[i])
+        {
+            append(readings[i].device_times.get(), source_devices[i] * sizeof(uint64_t));
+        }
+    }
+}
+
+void power_meter::TraceWriter::write_marker(const Marker &marker)
+{
+    if (compressed)
+    {
+        encoder.add_marker(marker);
+        if (encoder.records() >= block_records)
+        {
+            write_block();
+        }
+        return;
+    }
+    uint64_t type = TRACE_RECORD_MARKER;
+    append(&type, sizeof(type));
+    append(&marker, sizeof(marker));
+}
+
+void power_meter::TraceWriter::write_block()
+{
+    if (encoder.records() == 0)
+    {
+        return;
+    }
+    TraceBlockHeader header = encoder.header();
+    index.push_back({offset, samples, header.first_time_ns, header.last_time_ns});
+    samples += header.num_samples;
+    append(&header, sizeof(header));
+    append(encoder.data(), encoder.size());
+    flush();
+    encoder.reset();
+}
+
+void power_meter::TraceWriter::append(const void *data, size_t size)
+{
+    offset += size;
+    if (buffered + size > buffer.size())
+    {
+        flush();
+    }
+    if (size > buffer.size())
+    {
+        // Larger than the whole buffer, write it directly
+        write_file(data, size);
+        return;
+    }
+    memcpy(buffer.data() + buffered, data, size);
+    buffered += size;
+}
+
+void power_meter::TraceWriter::flush()
+{
+    write_file(buffer.data(), buffered);
+    buffered = 0;
+}
+
+void power_meter::TraceWriter::write_file(const void *data, size_t size)
+{
+    if (fd < 0 || write_failed)
+    {
+        return;
+    }
+    if (!write_all(fd, data, size))
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not write to trace file\n");
+        write_failed = true;
+    }
+}
+
+void power_meter::TraceWriter::close()
+{
+    if (fd >= 0)
+    {
+        if (compressed)
+        {
+            write_block();
+            TraceBlockHeader header{TRACE_INDEX_MAGIC, (uint32_t)(index.size() * sizeof(TraceIndexEntry)),
+                                    (uint32_t)index.size(), 0, 0, 0};
+            if (!index.empty())
+            {
+                header.num_samples = (uint32_t)std::min(samples, (uint64_t)UINT32_MAX);
+                header.first_time_ns = index.front().first_time_ns;
+                header.last_time_ns = index.back().last_time_ns;
+            }
+            TraceIndexFooter footer{offset, {}};
+            memcpy(footer.magic, TRACE_INDEX_FOOTER_MAGIC, sizeof(TRACE_INDEX_FOOTER_MAGIC));
+            append(&header, sizeof(header));
+            append(index.data(), index.size() * sizeof(TraceIndexEntry));
+            append(&footer, sizeof(footer));
+        }
+        flush();
+        ::close(fd);
+        fd = -1;
+    }
+    if (pyramid)
+    {
+        pyramid->close();
+        pyramid.reset();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+//						         READER
+//////////////////////////////////////////////////////////////////////
+
+power_meter::TraceReader::~TraceReader()
+{
+    close();
+}
+
+bool power_meter::TraceReader::open(const std::filesystem::path &path)
+{
+    close();
+    file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not open trace file %s\n", path.c_str());
+        return false;
+    }
+
+    TraceFileHeader header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1;
+    compressed_trace = valid && memcmp(header.magic, POWER_METER_COMPRESSED_TRACE_MAGIC,
+                                       sizeof(POWER_METER_COMPRESSED_TRACE_MAGIC)) == 0;
+    if (!valid || (!compressed_trace && memcmp(header.magic, POWER_METER_TRACE_MAGIC, sizeof(POWER_METER_TRACE_MAGIC)) != 0))
+    {
+        fprintf(stderr, "POWER METER: ERROR: %s is not a power meter trace\n", path.c_str());
+        close();
+        return false;
+    }
+    if (header.version < 1 || header.version > POWER_METER_TRACE_VERSION)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Unsupported trace version %u\n", header.version);
+        close();
+        return false;
+    }
+
+    trace_info = TraceInfo{};
+    trace_info.sampling_interval_us = header.sampling_interval_us;
+    trace_info.energy_increment = header.energy_increment;
+    trace_info.vendor_id = header.vendor_id;
+    trace_info.numa_nodes = header.numa_nodes;
+    trace_info.numcores = header.numcores;
+    trace_info.num_gpus = header.num_gpus;
+
+    for (uint32_t i = 0; i < header.num_sources; ++i)
+    {
+        TraceSourceHeader source_header;
+        if (fread(&source_header, sizeof(source_header), 1, file) != 1)
+        {
+            close();
+            return false;
+        }
+        SourceInfo source = parse_source_header(source_header, header.version);
+        // Version 1 device headers have no domain
+        size_t device_header_size = header.version == 1 ? offsetof(TraceDeviceHeader, domain) : sizeof(TraceDeviceHeader);
+        for (uint32_t j = 0; j < source_header.num_devices; ++j)
+        {
+            TraceDeviceHeader device_header{};
+            if (fread(&device_header, device_header_size, 1, file) != 1)
+            {
+                close();
+                return false;
+            }
+            source.devices.push_back(parse_device_header(device_header));
+        }
+        trace_info.sources.push_back(std::move(source));
+    }
+
+    record.resize(trace_info.sample_record_size() / sizeof(uint64_t));
+    decoder.begin(trace_info.sources);
+    // The blocks start right after the header
+    if (compressed_trace)
+    {
+        fseeko(file, header.header_size, SEEK_SET);
+    }
+    return true;
+}
+
+bool power_meter::TraceReader::load_block()
+{
+    TraceBlockHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_BLOCK_MAGIC)
+    {
+        // The end of the blocks, or the index
+        return false;
+    }
+    block.resize(header.size);
+    if (fread(block.data(), 1, header.size, file) != header.size)
+    {
+        fprintf(stderr, "POWER METER: WARNING: The trace's last block is truncated\n");
+        return false;
+    }
+    decoder.load(block.data(), block.size(), header.num_records);
+    return true;
+}
+
+bool power_meter::TraceReader::seek(const TraceIndexEntry &entry)
+{
+    if (!file || !compressed_trace || fseeko(file, (off_t)entry.offset, SEEK_SET) != 0)
+    {
+        return false;
+    }
+    decoder.load(nullptr, 0, 0);
+    return true;
+}
+
+bool power_meter::TraceReader::next(std::vector<SourceReading> &readings)
+{
+    Marker marker;
+    uint64_t type;
+    while ((type = next_record(readings, marker)) == TRACE_RECORD_MARKER)
+    {
+    }
+    return type == TRACE_RECORD_SAMPLE;
+}
+
+uint64_t power_meter::TraceReader::next_record(std::vector<SourceReading> &readings, Marker &marker)
+{
+    if (compressed_trace)
+    {
+        uint64_t type = 0;
+        while (file && (type = decoder.next_record(readings, marker)) == 0)
+        {
+            if (!load_block())
+            {
+                return 0;
+            }
+        }
+        return file ? type : 0;
+    }
+    if (!file || fread(record.data(), sizeof(uint64_t), 1, file) != 1)
+    {
+        return 0;
+    }
+    if (record[0] == TRACE_RECORD_MARKER)
+    {
+        return fread(&marker, sizeof(marker), 1, file) == 1 ? (uint64_t)TRACE_RECORD_MARKER : 0;
+    }
+    if (record[0] != TRACE_RECORD_SAMPLE)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Unknown trace record type %llu\n", (unsigned long long)record[0]);
+        return 0;
+    }
+    if (fread(record.data() + 1, sizeof(uint64_t), record.size() - 1, file) != record.size() - 1)
+    {
+        return 0;
+    }
+
+    readings.resize(trace_info.sources.size());
+    const uint64_t *word = &record[1];
+    for (size_t i = 0; i < trace_info.sources.size(); ++i)
+    {
+        unsigned int num_devices = (unsigned int)trace_info.sources[i].devices.size();
+        if (!readings[i].counters)
+        {
+            readings[i].counters = std::make_unique<uint64_t[]>(num_devices);
+        }
+        long long time_ns = (long long)*word++;
+        readings[i].time.tv_sec = time_ns / 1000000000LL;
+        readings[i].time.tv_nsec = time_ns % 1000000000LL;
+        std::copy(word, word + num_devices, readings[i].counters.get());
+        word += num_devices;
+        if (trace_info.sources[i].device_times)
+        {
+            if (!readings[i].device_times)
+            {
+                readings[i].device_times = std::make_unique<uint64_t[]>(num_devices);
+            }
+            std::copy(word, word + num_devices, readings[i].device_times.get());
+            word += num_devices;
+        }
+    }
+    return TRACE_RECORD_SAMPLE;
+}
+
+void power_meter::TraceReader::close()
+{
+    if (file)
+    {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+//						          SINK
+//////////////////////////////////////////////////////////////////////
+
+void power_meter::BinarySink::begin(const std::vector<SourceInfo> &sources)
+{
+    info.sources = sources;
+    if (writer.open(path, info, compressed) && pyramid)
+    {
+        writer.open_pyramid(pyramid_path(path));
+    }
+}
+
+void power_meter::BinarySink::write_sample(const SourceReading *readings)
+{
+    writer.write_sample(readings);
+}
+
+void power_meter::BinarySink::write_marker(const Marker &marker)
+{
+    writer.write_marker(marker);
+}
+
+void power_meter::BinarySink::end()
+{
+    writer.close();
+}
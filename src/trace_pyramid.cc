@@ -0,0 +1,497 @@
+#include "trace_pyramid.hh"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <limits>
+
+using namespace power_meter;
+
+static uint64_t to_ns(const struct timespec &time)
+{
+    return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+}
+
+static PyramidBucket empty_bucket()
+{
+    return {0, 0, std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), 0, 0};
+}
+
+static void merge(PyramidBucket &bucket, const PyramidBucket &other)
+{
+    if (other.count == 0)
+    {
+        return;
+    }
+    if (bucket.count == 0)
+    {
+        bucket.first_time_ns = other.first_time_ns;
+    }
+    bucket.last_time_ns = other.last_time_ns;
+    bucket.min_power = std::min(bucket.min_power, other.min_power);
+    bucket.max_power = std::max(bucket.max_power, other.max_power);
+    bucket.energy += other.energy;
+    bucket.count += other.count;
+}
+
+std::filesystem::path power_meter::pyramid_path(const std::filesystem::path &trace_path)
+{
+    std::filesystem::path path = trace_path;
+    path += ".pyramid";
+    return path;
+}
+
+//////////////////////////////////////////////////////////////////////
+//						         WRITER
+//////////////////////////////////////////////////////////////////////
+
+power_meter::PyramidWriter::~PyramidWriter()
+{
+    close();
+}
+
+bool power_meter::PyramidWriter::open(const std::filesystem::path &path, const std::vector<SourceInfo> &sources)
+{
+    close();
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not create pyramid file %s\n", path.c_str());
+        return false;
+    }
+    offset = 0;
+    write_failed = false;
+    domains.begin(sources);
+    previous_time.assign(sources.size(), 0);
+    series_domains.clear();
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        for (size_t domain = 0; domain < domains.domains(i).size(); ++domain)
+        {
+            series_domains.push_back({i, domain});
+        }
+    }
+    levels.assign(series_domains.size(), {});
+    index.clear();
+
+    PyramidFileHeader header{};
+    memcpy(header.magic, POWER_METER_PYRAMID_MAGIC, sizeof(POWER_METER_PYRAMID_MAGIC));
+    header.version = POWER_METER_PYRAMID_VERSION;
+    header.fanout = PYRAMID_FANOUT;
+    header.num_series = (uint32_t)series_domains.size();
+    header.chunk_buckets = PYRAMID_CHUNK_BUCKETS;
+    write(&header, sizeof(header));
+    for (const auto &[source, domain] : series_domains)
+    {
+        PyramidSeriesHeader series{};
+        strncpy(series.label, sources[source].label.c_str(), POWER_METER_TRACE_NAME_SIZE - 1);
+        strncpy(series.domain, domains.domains(source)[domain].c_str(), POWER_METER_TRACE_NAME_SIZE - 1);
+        series.source = (uint32_t)source;
+        const auto &device_domains = domains.device_domains(source);
+        series.num_devices = (uint32_t)std::count(device_domains.begin(), device_domains.end(), (unsigned int)domain);
+        write(&series, sizeof(series));
+    }
+    return true;
+}
+
+void power_meter::PyramidWriter::add_sample(const SourceReading *readings)
+{
+    if (fd < 0)
+    {
+        return;
+    }
+    bool updated = domains.update(readings);
+    for (size_t series = 0; series < series_domains.size() && updated; ++series)
+    {
+        const auto &[source, domain] = series_domains[series];
+        const EnergyData &result = domains.results(source)[domain];
+        PyramidBucket interval{previous_time[source], to_ns(readings[source].time), result.power, result.power,
+                               result.energy, 1};
+        add_bucket(series, 0, interval, false);
+    }
+    for (size_t i = 0; i < previous_time.size(); ++i)
+    {
+        previous_time[i] = to_ns(readings[i].time);
+    }
+}
+
+void power_meter::PyramidWriter::add_bucket(size_t series, size_t level, const PyramidBucket &bucket, bool partial)
+{
+    auto &series_levels = levels[series];
+    if (level == series_levels.size())
+    {
+        series_levels.emplace_back();
+        series_levels.back().current = empty_bucket();
+    }
+    Level &current = series_levels[level];
+    merge(current.current, bucket);
+    if (++current.children < PYRAMID_FANOUT && !partial)
+    {
+        return;
+    }
+
+    // Complete, the bucket moves to the file and into the level above it
+    PyramidBucket complete = current.current;
+    current.chunk.push_back(complete);
+    current.current = empty_bucket();
+    current.children = 0;
+    if (current.chunk.size() == PYRAMID_CHUNK_BUCKETS)
+    {
+        write_chunk(series, level);
+    }
+    if (level + 1 < PYRAMID_MAX_LEVELS)
+    {
+        add_bucket(series, level + 1, complete, false);
+    }
+}
+
+void power_meter::PyramidWriter::write_chunk(size_t series, size_t level)
+{
+    auto &chunk = levels[series][level].chunk;
+    if (chunk.empty())
+    {
+        return;
+    }
+    PyramidChunkHeader header{PYRAMID_CHUNK_MAGIC, (uint32_t)series, (uint32_t)level, (uint32_t)chunk.size()};
+    index.push_back({offset, header.series, header.level, header.num_buckets, 0});
+    write(&header, sizeof(header));
+    write(chunk.data(), chunk.size() * sizeof(PyramidBucket));
+    chunk.clear();
+}
+
+void power_meter::PyramidWriter::write(const void *data, size_t size)
+{
+    if (fd >= 0 && !write_failed && !write_all(fd, data, size))
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not write to pyramid file\n");
+        write_failed = true;
+    }
+    offset += size;
+}
+
+void power_meter::PyramidWriter::close()
+{
+    if (fd < 0)
+    {
+        return;
+    }
+    for (size_t series = 0; series < levels.size(); ++series)
+    {
+        auto &series_levels = levels[series];
+        // The partial bucket of each level completes the level above it, up to the first level
+        // holding a single bucket
+        for (size_t level = 0; level < series_levels.size(); ++level)
+        {
+            Level &current = series_levels[level];
+            if (current.children == 0)
+            {
+                continue;
+            }
+            bool top = level + 1 == series_levels.size() && current.chunk.empty() &&
+                       std::none_of(index.begin(), index.end(), [&](const PyramidIndexEntry &entry)
+                                    { return entry.series == series && entry.level == level; });
+            if (top)
+            {
+                current.chunk.push_back(current.current);
+                current.children = 0;
+                break;
+            }
+            add_bucket(series, level, empty_bucket(), true);
+        }
+        for (size_t level = 0; level < series_levels.size(); ++level)
+        {
+            write_chunk(series, level);
+        }
+    }
+
+    PyramidChunkHeader header{PYRAMID_INDEX_MAGIC, 0, 0, (uint32_t)index.size()};
+    TraceIndexFooter footer{offset, {}};
+    memcpy(footer.magic, PYRAMID_INDEX_FOOTER_MAGIC, sizeof(PYRAMID_INDEX_FOOTER_MAGIC));
+    write(&header, sizeof(header));
+    write(index.data(), index.size() * sizeof(PyramidIndexEntry));
+    write(&footer, sizeof(footer));
+    ::close(fd);
+    fd = -1;
+}
+
+//////////////////////////////////////////////////////////////////////
+//						         READER
+//////////////////////////////////////////////////////////////////////
+
+bool power_meter::TracePyramid::open(const std::filesystem::path &path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not open pyramid file %s\n", path.c_str());
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(PyramidFileHeader))
+    {
+        fprintf(stderr, "POWER METER: ERROR: %s is not a power meter pyramid\n", path.c_str());
+        ::close(fd);
+        return false;
+    }
+    mapping_size = (size_t)status.st_size;
+    mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "POWER METER: ERROR: Could not map pyramid file %s\n", path.c_str());
+        mapping = nullptr;
+        return false;
+    }
+    const char *data = (const char *)mapping;
+
+    PyramidFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    size_t header_size = sizeof(header) + header.num_series * sizeof(PyramidSeriesHeader);
+    if (memcmp(header.magic, POWER_METER_PYRAMID_MAGIC, sizeof(POWER_METER_PYRAMID_MAGIC)) != 0 ||
+        header.version > POWER_METER_PYRAMID_VERSION || header.chunk_buckets == 0 || header_size > mapping_size)
+    {
+        fprintf(stderr, "POWER METER: ERROR: %s is not a power meter pyramid\n", path.c_str());
+        close();
+        return false;
+    }
+    chunk_buckets = header.chunk_buckets;
+    series_headers.resize(header.num_series);
+    memcpy(series_headers.data(), data + sizeof(header), header.num_series * sizeof(PyramidSeriesHeader));
+    levels.assign(header.num_series, {});
+
+    // Written when the pyramid was closed
+    std::vector<PyramidIndexEntry> index;
+    TraceIndexFooter footer;
+    PyramidChunkHeader chunk;
+    if (mapping_size >= header_size + sizeof(footer))
+    {
+        memcpy(&footer, data + mapping_size - sizeof(footer), sizeof(footer));
+        if (memcmp(footer.magic, PYRAMID_INDEX_FOOTER_MAGIC, sizeof(PYRAMID_INDEX_FOOTER_MAGIC)) == 0 &&
+            footer.index_offset + sizeof(chunk) <= mapping_size)
+        {
+            memcpy(&chunk, data + footer.index_offset, sizeof(chunk));
+            size_t index_end = footer.index_offset + sizeof(chunk) + chunk.num_buckets * sizeof(PyramidIndexEntry);
+            if (chunk.magic == PYRAMID_INDEX_MAGIC && index_end <= mapping_size)
+            {
+                index.resize(chunk.num_buckets);
+                memcpy(index.data(), data + footer.index_offset + sizeof(chunk), index.size() * sizeof(PyramidIndexEntry));
+            }
+        }
+    }
+    if (index.empty())
+    {
+        // Cut short, every complete chunk is kept
+        size_t offset = header_size;
+        while (offset + sizeof(chunk) <= mapping_size)
+        {
+            memcpy(&chunk, data + offset, sizeof(chunk));
+            size_t end = offset + sizeof(chunk) + chunk.num_buckets * sizeof(PyramidBucket);
+            if (chunk.magic != PYRAMID_CHUNK_MAGIC || end > mapping_size)
+            {
+                break;
+            }
+            index.push_back({offset, chunk.series, chunk.level, chunk.num_buckets, 0});
+            offset = end;
+        }
+    }
+
+    for (const auto &entry : index)
+    {
+        if (entry.series >= levels.size() || entry.level >= PYRAMID_MAX_LEVELS ||
+            entry.offset + sizeof(chunk) + entry.num_buckets * sizeof(PyramidBucket) > mapping_size)
+        {
+            continue;
+        }
+        auto &series_levels = levels[entry.series];
+        if (series_levels.size() <= entry.level)
+        {
+            series_levels.resize(entry.level + 1);
+        }
+        auto &level = series_levels[entry.level];
+        // Every chunk but the last is full, so buckets are found by their position
+        if (level.buckets % chunk_buckets != 0)
+        {
+            continue;
+        }
+        level.chunks.push_back((const PyramidBucket *)(data + entry.offset + sizeof(chunk)));
+        level.buckets += entry.num_buckets;
+    }
+    // The levels above a missing one (e.g. cut short before it was written) can't be used
+    for (auto &series_levels : levels)
+    {
+        auto missing = std::find_if(series_levels.begin(), series_levels.end(),
+                                    [](const LevelChunks &level) { return level.buckets == 0; });
+        series_levels.erase(missing, series_levels.end());
+    }
+    return true;
+}
+
+void power_meter::TracePyramid::close()
+{
+    if (mapping)
+    {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+    }
+    mapping_size = 0;
+    series_headers.clear();
+    levels.clear();
+}
+
+size_t power_meter::TracePyramid::find_series(const std::string &label, const std::string &domain) const
+{
+    for (size_t i = 0; i < series_headers.size(); ++i)
+    {
+        if (label == std::string(series_headers[i].label, strnlen(series_headers[i].label, POWER_METER_TRACE_NAME_SIZE)) &&
+            domain == std::string(series_headers[i].domain, strnlen(series_headers[i].domain, POWER_METER_TRACE_NAME_SIZE)))
+        {
+            return i;
+        }
+    }
+    return series_headers.size();
+}
+
+const PyramidBucket &power_meter::TracePyramid::bucket(size_t series, size_t level, size_t bucket) const
+{
+    return levels[series][level].chunks[bucket / chunk_buckets][bucket % chunk_buckets];
+}
+
+size_t power_meter::TracePyramid::find(size_t series, size_t level, uint64_t time_ns) const
+{
+    size_t low = 0, high = num_buckets(series, level);
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (bucket(series, level, middle).last_time_ns <= time_ns)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+size_t power_meter::TracePyramid::envelope(size_t series, uint64_t t0, uint64_t t1, size_t points,
+                                           PowerEnvelope &output) const
+{
+    output.time_ns.resize(points);
+    output.min_power.assign(points, 0);
+    output.max_power.assign(points, 0);
+    output.mean_power.assign(points, 0);
+    output.count.assign(points, 0);
+    if (points == 0 || t1 <= t0 || series >= levels.size() || levels[series].empty())
+    {
+        return 0;
+    }
+    const double step = (double)(t1 - t0) / (double)points;
+    for (size_t point = 0; point < points; ++point)
+    {
+        output.time_ns[point] = t0 + (uint64_t)((double)point * step);
+    }
+
+    // The coarsest level whose buckets are shorter than a point on average
+    size_t level = 0;
+    for (size_t candidate = levels[series].size(); candidate-- > 1;)
+    {
+        size_t buckets = num_buckets(series, candidate);
+        const PyramidBucket &first = bucket(series, candidate, 0);
+        const PyramidBucket &last = bucket(series, candidate, buckets - 1);
+        if ((double)(last.last_time_ns - first.first_time_ns) / (double)buckets <= step)
+        {
+            level = candidate;
+            break;
+        }
+    }
+
+    std::vector<PyramidBucket> merged(points, empty_bucket());
+    std::vector<double> seconds(points, 0);
+    // The first bucket overlapping each point, for the points no bucket's middle falls in
+    std::vector<const PyramidBucket *> cover(points, nullptr);
+    auto point_of = [&](uint64_t time_ns) { return std::min((size_t)((double)(time_ns - t0) / step), points - 1); };
+    const size_t buckets = num_buckets(series, level);
+    for (size_t i = find(series, level, t0); i < buckets; ++i)
+    {
+        const PyramidBucket &current = bucket(series, level, i);
+        if (current.first_time_ns >= t1)
+        {
+            break;
+        }
+        if (current.count == 0)
+        {
+            continue;
+        }
+        size_t last_point = point_of(std::min(current.last_time_ns, t1) - 1);
+        for (size_t point = point_of(std::max(current.first_time_ns, t0)); point <= last_point; ++point)
+        {
+            if (!cover[point])
+            {
+                cover[point] = &current;
+            }
+        }
+        uint64_t middle = current.first_time_ns + (current.last_time_ns - current.first_time_ns) / 2;
+        if (middle < t0 || middle >= t1)
+        {
+            continue;
+        }
+        size_t point = point_of(middle);
+        merge(merged[point], current);
+        seconds[point] += (double)(current.last_time_ns - current.first_time_ns) / 1E9;
+    }
+    for (size_t point = 0; point < points; ++point)
+    {
+        if (merged[point].count == 0 && cover[point])
+        {
+            // Within a longer bucket, whose intervals are counted at its middle
+            output.min_power[point] = cover[point]->min_power;
+            output.max_power[point] = cover[point]->max_power;
+            double bucket_seconds = (double)(cover[point]->last_time_ns - cover[point]->first_time_ns) / 1E9;
+            output.mean_power[point] = bucket_seconds > 0 ? cover[point]->energy / bucket_seconds : 0;
+            continue;
+        }
+        if (merged[point].count == 0)
+        {
+            continue;
+        }
+        output.min_power[point] = merged[point].min_power;
+        output.max_power[point] = merged[point].max_power;
+        output.mean_power[point] = seconds[point] > 0 ? merged[point].energy / seconds[point] : 0;
+        output.count[point] = merged[point].count;
+    }
+    return level;
+}
+
+//////////////////////////////////////////////////////////////////////
+//						      EXISTING TRACES
+//////////////////////////////////////////////////////////////////////
+
+bool power_meter::build_pyramid(const std::filesystem::path &trace_path)
+{
+    TraceReader reader;
+    if (!reader.open(trace_path))
+    {
+        return false;
+    }
+    PyramidWriter writer;
+    if (!writer.open(pyramid_path(trace_path), reader.info().sources))
+    {
+        return false;
+    }
+    std::vector<SourceReading> readings;
+    Marker marker;
+    while (uint64_t type = reader.next_record(readings, marker))
+    {
+        if (type == TRACE_RECORD_SAMPLE)
+        {
+            writer.add_sample(readings.data());
+        }
+    }
+    writer.close();
+    return true;
+}
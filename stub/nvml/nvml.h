@@ -0,0 +1,35 @@
+#ifndef POWER_METER_NVML_STUB_H
+#define POWER_METER_NVML_STUB_H
+
+/*
+Subset of NVML's API implemented by the stub library in nvml_stub.cc, the functions the power
+meter loads at runtime. Names and values match the real nvml.h
+*/
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct nvmlDevice_st *nvmlDevice_t;
+
+    typedef enum nvmlReturn_enum
+    {
+        NVML_SUCCESS = 0,
+        NVML_ERROR_UNINITIALIZED = 1,
+        NVML_ERROR_INVALID_ARGUMENT = 2,
+        NVML_ERROR_NOT_SUPPORTED = 3,
+        NVML_ERROR_DRIVER_NOT_LOADED = 9
+    } nvmlReturn_t;
+
+    nvmlReturn_t nvmlInit_v2(void);
+    nvmlReturn_t nvmlShutdown(void);
+    nvmlReturn_t nvmlDeviceGetCount_v2(unsigned int *deviceCount);
+    nvmlReturn_t nvmlDeviceGetHandleByIndex_v2(unsigned int index, nvmlDevice_t *device);
+    nvmlReturn_t nvmlDeviceGetTotalEnergyConsumption(nvmlDevice_t device, unsigned long long *energy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
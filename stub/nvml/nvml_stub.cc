@@ -0,0 +1,127 @@
+/*
+Stub NVML library, for building and testing the GPU path on machines without a GPU or driver.
+It exposes simulated GPUs drawing a constant power, configured through environment variables
+read by nvmlInit_v2:
+
+    POWER_METER_NVML_STUB_GPUS        Number of GPUs, 1 by default
+    POWER_METER_NVML_STUB_POWER       Power of GPU 0 in Watts, 100 by default. GPU i draws 10 * i W more
+    POWER_METER_NVML_STUB_LATENCY_US  Time an energy reading takes, 0 by default
+    POWER_METER_NVML_STUB_NO_DRIVER   If set, nvmlInit_v2 fails as if no driver was loaded
+*/
+#include "nvml.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#define STUB_MAX_GPUS 64
+
+struct nvmlDevice_st
+{
+    unsigned int index;
+};
+
+namespace
+{
+    bool initialized{false};
+    unsigned int num_gpus{0};
+    double base_power{100};
+    long latency_us{0};
+    struct timespec start_time;
+    nvmlDevice_st devices[STUB_MAX_GPUS];
+}
+
+static double read_env(const char *name, double fallback)
+{
+    const char *value = getenv(name);
+    return value ? atof(value) : fallback;
+}
+
+static void simulate_latency(long us)
+{
+    if (us > 0)
+    {
+        struct timespec latency{us / 1000000, (us % 1000000) * 1000};
+        nanosleep(&latency, nullptr);
+    }
+}
+
+extern "C"
+{
+    nvmlReturn_t nvmlInit_v2(void)
+    {
+        if (getenv("POWER_METER_NVML_STUB_NO_DRIVER"))
+        {
+            return NVML_ERROR_DRIVER_NOT_LOADED;
+        }
+        double gpus = read_env("POWER_METER_NVML_STUB_GPUS", 1);
+        num_gpus = gpus < 0 ? 0 : gpus > STUB_MAX_GPUS ? STUB_MAX_GPUS : (unsigned int)gpus;
+        base_power = read_env("POWER_METER_NVML_STUB_POWER", 100);
+        latency_us = (long)read_env("POWER_METER_NVML_STUB_LATENCY_US", 0);
+        for (unsigned int i = 0; i < STUB_MAX_GPUS; ++i)
+        {
+            devices[i].index = i;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        initialized = true;
+        return NVML_SUCCESS;
+    }
+
+    nvmlReturn_t nvmlShutdown(void)
+    {
+        if (!initialized)
+        {
+            return NVML_ERROR_UNINITIALIZED;
+        }
+        initialized = false;
+        return NVML_SUCCESS;
+    }
+
+    nvmlReturn_t nvmlDeviceGetCount_v2(unsigned int *deviceCount)
+    {
+        if (!initialized)
+        {
+            return NVML_ERROR_UNINITIALIZED;
+        }
+        if (!deviceCount)
+        {
+            return NVML_ERROR_INVALID_ARGUMENT;
+        }
+        *deviceCount = num_gpus;
+        return NVML_SUCCESS;
+    }
+
+    nvmlReturn_t nvmlDeviceGetHandleByIndex_v2(unsigned int index, nvmlDevice_t *device)
+    {
+        if (!initialized)
+        {
+            return NVML_ERROR_UNINITIALIZED;
+        }
+        if (index >= num_gpus || !device)
+        {
+            return NVML_ERROR_INVALID_ARGUMENT;
+        }
+        *device = &devices[index];
+        return NVML_SUCCESS;
+    }
+
+    nvmlReturn_t nvmlDeviceGetTotalEnergyConsumption(nvmlDevice_t device, unsigned long long *energy)
+    {
+        if (!initialized)
+        {
+            return NVML_ERROR_UNINITIALIZED;
+        }
+        if (!device || device->index >= num_gpus || !energy)
+        {
+            return NVML_ERROR_INVALID_ARGUMENT;
+        }
+        // The counter is sampled halfway through the call
+        simulate_latency(latency_us / 2);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        simulate_latency(latency_us - latency_us / 2);
+        double elapsed = (double)(now.tv_sec - start_time.tv_sec) + (double)(now.tv_nsec - start_time.tv_nsec) / 1E9;
+        // Energy since initialization in mili Joules
+        *energy = (unsigned long long)(elapsed * (base_power + 10.0 * device->index) * 1E3);
+        return NVML_SUCCESS;
+    }
+}
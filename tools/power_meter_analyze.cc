@@ -0,0 +1,207 @@
+/*
+Summarizes a binary trace with the power_meter_analysis library: the energy, mean and peak power
+and energy-delay product of every domain of every source, and the energy and mean power of each
+source during each phase
+
+Usage: power_meter_analyze [--from S] [--to S] [--resample S file.csv] [trace file]
+       power_meter_analyze [--from S] [--to S] --envelope N [trace file]
+
+--from and --to restrict the summary to a range in seconds since the first sample. --resample writes
+the mean power of every domain and their total on a common grid with a step of S seconds as CSV.
+--envelope prints the lowest, highest and mean power of every domain at N points of the range as
+CSV, from the trace's summary pyramid only (see trace_pyramid.hh), so it takes the same time
+whatever the length of the trace
+*/
+
+#include "trace_analysis.hh"
+#include "trace_pyramid.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+/*
+Prints the power envelope of every series of the trace's pyramid between from and to
+*/
+static int print_envelope(const char *trace_path, double from, double to, size_t points)
+{
+    power_meter::TracePyramid pyramid;
+    if (!pyramid.open(power_meter::pyramid_path(trace_path)))
+    {
+        return 1;
+    }
+    // The range of the trace is the range of the top level of its first series
+    if (pyramid.num_series() == 0 || pyramid.num_levels(0) == 0)
+    {
+        fprintf(stderr, "The pyramid is empty\n");
+        return 1;
+    }
+    size_t top = pyramid.num_levels(0) - 1;
+    const uint64_t first_time = pyramid.bucket(0, top, 0).first_time_ns;
+    const uint64_t last_time = pyramid.bucket(0, top, pyramid.num_buckets(0, top) - 1).last_time_ns;
+    const uint64_t t0 = first_time + (uint64_t)(from * 1E9);
+    const uint64_t t1 = to < 0 ? last_time : first_time + (uint64_t)(to * 1E9);
+
+    std::vector<power_meter::PowerEnvelope> envelopes(pyramid.num_series());
+    printf("Time");
+    for (size_t i = 0; i < pyramid.num_series(); ++i)
+    {
+        size_t level = pyramid.envelope(i, t0, t1, points, envelopes[i]);
+        const auto &series = pyramid.series(i);
+        fprintf(stderr, "%s %s: level %zu\n", series.label, series.domain, level);
+        printf(", %s %s min, %s %s max, %s %s mean", series.label, series.domain, series.label, series.domain,
+               series.label, series.domain);
+    }
+    printf("\n");
+    for (size_t point = 0; point < points; ++point)
+    {
+        printf("%.6f", (double)(envelopes[0].time_ns[point] - first_time) / 1E9);
+        for (const auto &envelope : envelopes)
+        {
+            printf(",%.3f,%.3f,%.3f", envelope.min_power[point], envelope.max_power[point], envelope.mean_power[point]);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    double from = 0, to = -1, step = 0;
+    const char *resample_path = nullptr;
+    size_t envelope_points = 0;
+    int arg = 1;
+    for (; arg < argc - 1; ++arg)
+    {
+        if (strcmp(argv[arg], "--from") == 0)
+        {
+            from = atof(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--to") == 0)
+        {
+            to = atof(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--envelope") == 0)
+        {
+            envelope_points = (size_t)atoll(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--resample") == 0 && arg + 2 < argc - 1)
+        {
+            step = atof(argv[++arg]);
+            resample_path = argv[++arg];
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (arg != argc - 1 || (resample_path && step <= 0))
+    {
+        fprintf(stderr, "Usage: %s [--from S] [--to S] [--resample S file.csv] [trace file]\n"
+                        "       %s [--from S] [--to S] --envelope N [trace file]\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+    if (envelope_points > 0)
+    {
+        return print_envelope(argv[arg], from, to, envelope_points);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    power_meter::MappedTrace trace;
+    if (!trace.open(argv[arg]))
+    {
+        return 1;
+    }
+    if (trace.num_samples() < 2)
+    {
+        fprintf(stderr, "The trace has less than 2 samples\n");
+        return 1;
+    }
+    const uint64_t first_time = trace.time(0, 0);
+    const uint64_t t0 = first_time + (uint64_t)(from * 1E9);
+    const uint64_t t1 = to < 0 ? UINT64_MAX : first_time + (uint64_t)(to * 1E9);
+
+    // One series per domain of every source, in order of first appearance
+    std::vector<std::string> names;
+    std::vector<power_meter::PowerSeries> series;
+    for (const auto &source : trace.info().sources)
+    {
+        std::vector<std::string> domains;
+        for (const auto &device : source.devices)
+        {
+            if (std::find(domains.begin(), domains.end(), device.domain) == domains.end())
+            {
+                domains.push_back(device.domain);
+            }
+        }
+        for (const auto &domain : domains)
+        {
+            names.push_back(source.label + " " + domain);
+            series.push_back(trace.series(source.label, domain));
+        }
+    }
+
+    printf("%zu samples, %zu markers\n\n", trace.num_samples(), trace.markers().size());
+    printf("%-24s %14s %12s %12s %14s\n", "Domain", "Energy (J)", "Mean (W)", "Peak (W)", "EDP (J*s)");
+    for (size_t i = 0; i < series.size(); ++i)
+    {
+        power_meter::PowerStats stats = power_meter::power_stats(trace, series[i], t0, t1);
+        printf("%-24s %14.3f %12.3f %12.3f %14.3f\n", names[i].c_str(), stats.energy, stats.mean_power,
+               stats.peak_power, stats.edp);
+    }
+
+    // Phases are measured on every device of each source
+    for (const auto &source : trace.info().sources)
+    {
+        auto phases = power_meter::phase_stats(trace, trace.series(source.label));
+        if (phases.empty())
+        {
+            continue;
+        }
+        printf("\nPhases, %s\n%-24s %8s %12s %14s %12s\n", source.label.c_str(), "Name", "Calls", "Time (s)",
+               "Energy (J)", "Mean (W)");
+        for (const auto &phase : phases)
+        {
+            printf("%-24s %8zu %12.6f %14.6f %12.3f\n", phase.name.c_str(), phase.calls, phase.duration, phase.energy,
+                   phase.mean_power);
+        }
+    }
+
+    if (resample_path)
+    {
+        uint64_t last_time = std::min(t1, trace.time(0, trace.num_samples() - 1));
+        auto grid = power_meter::time_grid(std::max(t0, first_time), last_time, (uint64_t)(step * 1E9));
+        std::vector<std::vector<double>> power(series.size());
+        for (size_t i = 0; i < series.size(); ++i)
+        {
+            power_meter::resample(trace, series[i], grid, power[i]);
+        }
+        std::ofstream csv(resample_path);
+        csv << "Time";
+        for (const auto &name : names)
+        {
+            csv << ", " << name;
+        }
+        csv << ", Total\n";
+        for (size_t k = 0; k + 1 < grid.size(); ++k)
+        {
+            csv << (double)(grid[k] - first_time) / 1E9;
+            double total = 0;
+            for (size_t i = 0; i < series.size(); ++i)
+            {
+                csv << "," << power[i][k];
+                total += power[i][k];
+            }
+            csv << "," << total << "\n";
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double bytes = (double)(trace.num_samples() * trace.stride() * sizeof(uint64_t));
+    printf("\nAnalyzed %.1f MB in %.3f s\n", bytes / 1E6, seconds);
+    return 0;
+}
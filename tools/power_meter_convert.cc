@@ -0,0 +1,207 @@
+/*
+Converts a binary trace written by the monitoring loop into the "Power, Energy, Total energy"
+CSV files it would have written in CSV mode, one per source, and the application markers it
+holds to the markers file. Or exports the trace as a timeline of counter tracks and marker spans
+for chrome://tracing and ui.perfetto.dev
+
+Usage: power_meter_convert [--devices | --top N] [trace file] [output directory, defaults to the trace's directory]
+       power_meter_convert --chrome | --perfetto [trace file] [output file]
+       power_meter_convert --compress | --decompress [trace file] [output file]
+       power_meter_convert --pyramid [trace file]
+
+--devices adds the power and energy of every device to the files, --top N the N devices that drew
+the most power in each interval, e.g. for the per-core counters. --chrome writes a trace-event
+JSON file, by default the trace's path with a .json extension, --perfetto a Perfetto protobuf
+trace (.perfetto-trace). --compress writes the trace delta and varint encoded (.pmz), --decompress
+a compressed trace back as a plain one (.pmt). --pyramid builds the summary pyramid of a trace
+written without one (.pyramid appended). Every mode reads both plain and compressed traces
+*/
+
+#include "output_sink.hh"
+#include "trace_format.hh"
+#include "trace_event_sink.hh"
+#include "trace_compression.hh"
+#include "trace_pyramid.hh"
+
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+
+/*
+Writes every record of the trace to the sink
+*/
+static int export_timeline(power_meter::TraceReader &reader, power_meter::OutputSink &sink)
+{
+    sink.begin(reader.info().sources);
+    std::vector<power_meter::SourceReading> readings;
+    power_meter::Marker marker;
+    unsigned long long samples = 0, markers = 0;
+    while (uint64_t type = reader.next_record(readings, marker))
+    {
+        if (type == power_meter::TRACE_RECORD_MARKER)
+        {
+            sink.write_marker(marker);
+            ++markers;
+            continue;
+        }
+        sink.write_sample(readings.data());
+        ++samples;
+    }
+    sink.end();
+    printf("Exported %llu samples of %zu sources and %llu markers\n", samples, reader.info().sources.size(), markers);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    power_meter::CSV_COLUMNS columns = power_meter::DOMAIN_COLUMNS;
+    unsigned int top_n = 0;
+    int arg = 1;
+    if (arg < argc && (strcmp(argv[arg], "--compress") == 0 || strcmp(argv[arg], "--decompress") == 0))
+    {
+        bool compress = strcmp(argv[arg], "--compress") == 0;
+        ++arg;
+        if (argc - arg < 1 || argc - arg > 2)
+        {
+            fprintf(stderr, "Usage: %s --compress | --decompress [trace file] [output file]\n", argv[0]);
+            return 1;
+        }
+        std::filesystem::path trace_path{argv[arg]};
+        std::filesystem::path output_path{argc - arg == 2 ? std::filesystem::path{argv[arg + 1]}
+                                                          : std::filesystem::path{trace_path}.replace_extension(compress ? ".pmz" : ".pmt")};
+        if (output_path == trace_path)
+        {
+            fprintf(stderr, "The output file must differ from the trace\n");
+            return 1;
+        }
+        if (!(compress ? power_meter::compress_trace(trace_path, output_path) : power_meter::decompress_trace(trace_path, output_path)))
+        {
+            return 1;
+        }
+        printf("Wrote %s, %ju bytes from %ju\n", output_path.c_str(), (uintmax_t)std::filesystem::file_size(output_path),
+               (uintmax_t)std::filesystem::file_size(trace_path));
+        return 0;
+    }
+    if (arg < argc && strcmp(argv[arg], "--pyramid") == 0)
+    {
+        if (argc - arg != 2)
+        {
+            fprintf(stderr, "Usage: %s --pyramid [trace file]\n", argv[0]);
+            return 1;
+        }
+        std::filesystem::path trace_path{argv[arg + 1]};
+        if (!power_meter::build_pyramid(trace_path))
+        {
+            return 1;
+        }
+        std::filesystem::path output_path = power_meter::pyramid_path(trace_path);
+        printf("Wrote %s, %ju bytes\n", output_path.c_str(), (uintmax_t)std::filesystem::file_size(output_path));
+        return 0;
+    }
+    if (arg < argc && (strcmp(argv[arg], "--chrome") == 0 || strcmp(argv[arg], "--perfetto") == 0))
+    {
+        bool chrome = strcmp(argv[arg], "--chrome") == 0;
+        ++arg;
+        if (argc - arg < 1 || argc - arg > 2)
+        {
+            fprintf(stderr, "Usage: %s --chrome | --perfetto [trace file] [output file]\n", argv[0]);
+            return 1;
+        }
+        std::filesystem::path trace_path{argv[arg]};
+        std::filesystem::path output_path{argc - arg == 2 ? std::filesystem::path{argv[arg + 1]}
+                                                          : std::filesystem::path{trace_path}.replace_extension(chrome ? ".json" : ".perfetto-trace")};
+        power_meter::TraceReader reader;
+        if (!reader.open(trace_path))
+        {
+            return 1;
+        }
+        if (chrome)
+        {
+            power_meter::ChromeTraceSink sink(output_path);
+            return export_timeline(reader, sink);
+        }
+        power_meter::PerfettoSink sink(output_path);
+        return export_timeline(reader, sink);
+    }
+    if (arg < argc && strcmp(argv[arg], "--devices") == 0)
+    {
+        columns = power_meter::DEVICE_COLUMNS;
+        ++arg;
+    }
+    else if (arg + 1 < argc && strcmp(argv[arg], "--top") == 0)
+    {
+        columns = power_meter::TOP_DEVICES;
+        top_n = (unsigned int)atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    if (argc - arg < 1 || argc - arg > 2)
+    {
+        fprintf(stderr, "Usage: %s [--devices | --top N] [trace file] [output directory]\n"
+                        "       %s --chrome | --perfetto [trace file] [output file]\n"
+                        "       %s --compress | --decompress [trace file] [output file]\n"
+                        "       %s --pyramid [trace file]\n",
+                argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+    std::filesystem::path trace_path{argv[arg]};
+    std::filesystem::path output_dir = argc - arg == 2 ? std::filesystem::path{argv[arg + 1]} : trace_path.parent_path();
+
+    power_meter::TraceReader reader;
+    if (!reader.open(trace_path))
+    {
+        return 1;
+    }
+    const auto &sources = reader.info().sources;
+
+    if (!output_dir.empty())
+    {
+        std::filesystem::create_directories(output_dir);
+    }
+    std::vector<std::unique_ptr<std::ofstream>> files;
+    std::vector<power_meter::CsvStream> streams;
+    for (const auto &source : sources)
+    {
+        files.push_back(std::make_unique<std::ofstream>(output_dir / source.label));
+        if (!*files.back())
+        {
+            fprintf(stderr, "Could not create %s\n", (output_dir / source.label).c_str());
+            return 1;
+        }
+        streams.push_back({files.back().get(), columns, top_n});
+    }
+
+    // The CSV sink computes the series exactly like the monitoring loop does
+    // Traces of the adaptive mode have no fixed interval, each row gets its own
+    power_meter::CsvSink csv(streams, reader.info().sampling_interval_us == 0);
+    csv.begin(sources);
+    // The markers file is only written if the trace has markers
+    std::ostringstream marker_rows;
+    power_meter::MarkerSink marker_sink(&marker_rows);
+    marker_sink.begin(sources);
+    std::vector<power_meter::SourceReading> readings;
+    power_meter::Marker marker;
+    unsigned long long samples = 0, markers = 0;
+    while (uint64_t type = reader.next_record(readings, marker))
+    {
+        if (type == power_meter::TRACE_RECORD_MARKER)
+        {
+            marker_sink.write_marker(marker);
+            ++markers;
+            continue;
+        }
+        csv.write_sample(readings.data());
+        marker_sink.write_sample(readings.data());
+        ++samples;
+    }
+    csv.end();
+    if (markers != 0)
+    {
+        std::ofstream(output_dir / "markers") << marker_rows.str();
+    }
+
+    printf("Converted %llu samples of %zu sources and %llu markers\n", samples, sources.size(), markers);
+    return 0;
+}
@@ -0,0 +1,186 @@
+/*
+Measures the energy of a command, like perf stat measures its events: runs it, samples the
+counters while it runs and prints a summary to stderr when it exits, with the energy, mean and
+peak power of every domain (CPU package, DRAM, GPUs...), the duration and the energy-delay
+product of the CPU packages and the GPUs
+
+Usage: power_meter_run [--interval-us N] [--trace DIR | --csv DIR | --chrome DIR | --perfetto DIR] [--no-gpu] [--synthetic] -- command [args...]
+
+--interval-us sets the sampling interval, 1000 us by default. --trace writes the binary trace
+of the run to DIR, --csv the CSV files, --chrome and --perfetto a timeline of the counters in
+the trace-event JSON and Perfetto formats. --synthetic replaces the counters with a simulated CPU
+drawing 100 W, to try it on machines without access to them. Exits with the command's exit
+status, 128 + the signal number if a signal killed it
+*/
+
+#include "power_meter.hh"
+#include "synthetic_source.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--interval-us N] [--trace DIR | --csv DIR | --chrome DIR | --perfetto DIR] [--no-gpu] [--synthetic] -- command [args...]\n",
+            program);
+}
+
+static double monotonic_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1E9;
+}
+
+int main(int argc, char **argv)
+{
+    long long interval_us = 1000;
+    bool synthetic = false;
+    int arg = 1;
+    power_meter::set_output_format(power_meter::NO_OUTPUT);
+    for (; arg < argc && strcmp(argv[arg], "--") != 0; ++arg)
+    {
+        bool has_value = arg + 1 < argc;
+        if (has_value && strcmp(argv[arg], "--interval-us") == 0)
+        {
+            interval_us = atoll(argv[++arg]);
+        }
+        else if (has_value && (strcmp(argv[arg], "--trace") == 0 || strcmp(argv[arg], "--csv") == 0))
+        {
+            power_meter::set_output_format(strcmp(argv[arg], "--trace") == 0 ? power_meter::BINARY : power_meter::CSV);
+            power_meter::set_output_dir(argv[++arg]);
+        }
+        else if (has_value && (strcmp(argv[arg], "--chrome") == 0 || strcmp(argv[arg], "--perfetto") == 0))
+        {
+            power_meter::set_output_format(strcmp(argv[arg], "--chrome") == 0 ? power_meter::CHROME_JSON : power_meter::PERFETTO);
+            power_meter::set_output_dir(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--no-gpu") == 0)
+        {
+            power_meter::set_gpu_energy(false);
+        }
+        else if (strcmp(argv[arg], "--synthetic") == 0)
+        {
+            synthetic = true;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (arg + 1 >= argc || interval_us <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    char **command = argv + arg + 1;
+    if (synthetic)
+    {
+        power_meter::set_cpu_source(std::make_unique<power_meter::SyntheticSource>(
+            std::vector<power_meter::PowerProfile>{power_meter::PowerProfile{}}));
+        power_meter::set_gpu_energy(false);
+    }
+
+    // The command is forked before the loop's threads are started, and waits for them before
+    // exec'ing, so its whole lifetime is sampled. A second pipe, closed by a successful exec,
+    // returns the error if it fails
+    int start_pipe[2], exec_pipe[2];
+    if (pipe2(start_pipe, O_CLOEXEC) != 0 || pipe2(exec_pipe, O_CLOEXEC) != 0)
+    {
+        perror("pipe");
+        return 1;
+    }
+    pid_t child = fork();
+    if (child < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+    if (child == 0)
+    {
+        close(start_pipe[1]);
+        close(exec_pipe[0]);
+        char go;
+        if (read(start_pipe[0], &go, 1) == 1)
+        {
+            execvp(command[0], command);
+            int error = errno;
+            ssize_t written = write(exec_pipe[1], &error, sizeof(error));
+            (void)written;
+        }
+        _exit(127);
+    }
+    close(start_pipe[0]);
+    close(exec_pipe[1]);
+
+    power_meter::RunSummary summary;
+    power_meter::add_output_sink(std::make_unique<power_meter::SummarySink>(summary));
+    if (!power_meter::launch_monitoring_loop(std::chrono::microseconds(interval_us)))
+    {
+        // Closing the start pipe without a byte makes the child exit
+        close(start_pipe[1]);
+        waitpid(child, nullptr, 0);
+        return 1;
+    }
+    // Like a shell running a foreground job, interrupts are for the command
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+
+    double start = monotonic_seconds();
+    char go = 1;
+    ssize_t written = write(start_pipe[1], &go, 1);
+    (void)written;
+    close(start_pipe[1]);
+    int exec_error = 0;
+    bool exec_failed = read(exec_pipe[0], &exec_error, sizeof(exec_error)) == sizeof(exec_error);
+    close(exec_pipe[0]);
+
+    // Blocks in the kernel until the command exits, the sampler sleeps between deadlines too
+    int status = 0;
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+    double elapsed = monotonic_seconds() - start;
+    power_meter::stop_monitoring_loop();
+
+    if (exec_failed)
+    {
+        fprintf(stderr, "%s: %s\n", command[0], strerror(exec_error));
+        return 127;
+    }
+
+    fprintf(stderr, "\n Power meter stats for '");
+    for (char **word = command; *word; ++word)
+    {
+        fprintf(stderr, "%s%s", word == command ? "" : " ", *word);
+    }
+    fprintf(stderr, "':\n\n");
+    // The EDP counts the energy of the CPU packages and the GPUs, the domains every source starts with
+    double energy = 0;
+    for (size_t i = 0; i < summary.domains.size(); ++i)
+    {
+        const auto &domain = summary.domains[i];
+        fprintf(stderr, "%16.3f J   %-4s %-12s  %10.3f W mean  %10.3f W peak\n", domain.energy,
+                domain.label.c_str(), domain.domain.c_str(), domain.mean_power, domain.peak_power);
+        if (i == 0 || domain.label != summary.domains[i - 1].label)
+        {
+            energy += domain.energy;
+        }
+    }
+    fprintf(stderr, "\n%16.6f s   elapsed\n", elapsed);
+    fprintf(stderr, "%16.3f J*s EDP\n\n", energy * elapsed);
+
+    if (WIFSIGNALED(status))
+    {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
@@ -0,0 +1,114 @@
+/*
+Runs the monitoring loop as a daemon publishing the samples to shared memory, where unprivileged
+processes read them with ShmClient (see shm_ring.hh) without access to the MSRs or NVML
+
+Usage: power_meterd [--interval-us N] [--name NAME] [--capacity N] [--no-gpu] [--synthetic] [--trace DIR | --compressed-trace DIR] [--pyramid]
+
+--name is the shared memory object, /power_meter by default, and --capacity the number of samples
+the ring keeps. --trace also writes a binary trace to DIR, --compressed-trace a compressed one for
+long-running monitoring, and --pyramid the trace's summary pyramid for fast zooming. --synthetic
+replaces the counters with a simulated CPU drawing a 100 W +/- 50 W square wave over 1 s, and no
+GPU, to test clients on machines without them. Runs until SIGINT or SIGTERM
+*/
+
+#include "power_meter.hh"
+#include "synthetic_source.hh"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char **argv)
+{
+    long long interval_us = 1000;
+    std::string name = POWER_METER_SHM_DEFAULT_NAME;
+    size_t capacity = 4096;
+    bool synthetic = false;
+    for (int arg = 1; arg < argc; ++arg)
+    {
+        bool has_value = arg + 1 < argc;
+        if (has_value && strcmp(argv[arg], "--interval-us") == 0)
+        {
+            interval_us = atoll(argv[++arg]);
+        }
+        else if (has_value && strcmp(argv[arg], "--name") == 0)
+        {
+            name = argv[++arg];
+        }
+        else if (has_value && strcmp(argv[arg], "--capacity") == 0)
+        {
+            capacity = (size_t)atoll(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--no-gpu") == 0)
+        {
+            power_meter::set_gpu_energy(false);
+        }
+        else if (strcmp(argv[arg], "--synthetic") == 0)
+        {
+            synthetic = true;
+        }
+        else if (strcmp(argv[arg], "--pyramid") == 0)
+        {
+            power_meter::set_trace_pyramid(true);
+        }
+        else if (has_value && (strcmp(argv[arg], "--trace") == 0 || strcmp(argv[arg], "--compressed-trace") == 0))
+        {
+            power_meter::set_output_format(strcmp(argv[arg], "--trace") == 0 ? power_meter::BINARY : power_meter::BINARY_COMPRESSED);
+            power_meter::set_output_dir(argv[++arg]);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--interval-us N] [--name NAME] [--capacity N] [--no-gpu] [--synthetic] [--trace DIR | --compressed-trace DIR] [--pyramid]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (interval_us <= 0 || capacity == 0)
+    {
+        fprintf(stderr, "The interval and the capacity must be positive\n");
+        return 1;
+    }
+    if (power_meter::output_format != power_meter::BINARY && power_meter::output_format != power_meter::BINARY_COMPRESSED)
+    {
+        power_meter::set_output_format(power_meter::NO_OUTPUT);
+    }
+    if (synthetic)
+    {
+        power_meter::PowerProfile profile;
+        profile.shape = power_meter::PowerProfile::SQUARE;
+        profile.amplitude = 50;
+        power_meter::set_cpu_source(std::make_unique<power_meter::SyntheticSource>(std::vector<power_meter::PowerProfile>{profile}));
+        power_meter::set_gpu_energy(false);
+    }
+    power_meter::set_shm_publishing(name, capacity);
+
+    // Blocked before the loop's threads are started so they inherit the mask, the signals are
+    // only taken by sigwait below
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    if (!power_meter::launch_monitoring_loop(std::chrono::microseconds(interval_us)))
+    {
+        return 1;
+    }
+    // The loop runs without publishing if the ring couldn't be created, nothing left to do then
+    power_meter::ShmClient ring;
+    if (!ring.open(name))
+    {
+        power_meter::stop_monitoring_loop();
+        return 1;
+    }
+    ring.close();
+    printf("POWER METER: Publishing to %s every %lld us\n", name.c_str(), interval_us);
+    fflush(stdout);
+
+    int signal = 0;
+    sigwait(&signals, &signal);
+    power_meter::stop_monitoring_loop();
+    return 0;
+}